@@ -39,8 +39,10 @@ int main(int argc, char *argv[]){
     for (int f_i = 0; f_i < forward.getFramesCount(); f_i++){
       const auto &b_frame = backward.getFrame(b_i);
       const auto &f_frame = forward.getFrame(f_i);
+      cv::Mat b_image = b_frame.getImage();
+      cv::Mat f_image = f_frame.getImage();
 
-      cv::imshow("forward", f_frame.image);
+      cv::imshow("forward", f_image);
 
       double glob_max = 0;
       cv::Mat maxtempl;
@@ -50,10 +52,10 @@ int main(int argc, char *argv[]){
       while (scale > 0.4){
         double angle = 0;
         while (angle < 360){
-          auto templ = cv::scaleRotateCropImage(f_frame.image, scale, angle);
+          auto templ = cv::scaleRotateCropImage(f_image, scale, angle);
 
           cv::Mat result;
-          cv::matchTemplate(b_frame.image, templ, result, match_method);
+          cv::matchTemplate(b_image, templ, result, match_method);
 
           double local_min, local_max;
           cv::minMaxLoc(result, &local_min, &local_max);
@@ -69,16 +71,16 @@ int main(int argc, char *argv[]){
         scale *= scale_step;
       }
 
-      visualizeCorrelation(b_frame.image, maxtempl, maxresult);
+      visualizeCorrelation(b_image, maxtempl, maxresult);
     }
   }
 
-  /*cv::imshow("Original", forward.getFrame(0).image);
+  /*cv::imshow("Original", forward.getFrame(0).getImage());
 
   for (double scale = 1; scale >= 0.5; scale -= 0.1){
     for (int angle = 0; angle < 360; angle += 20){
       cv::imshow("ScaleRotateCrop",
-                 cv::scaleRotateCropImage(forward.getFrame(0).image,
+                 cv::scaleRotateCropImage(forward.getFrame(0).getImage(),
                                           scale, angle)
                  );
       cv::waitKey(0);
@@ -20,7 +20,27 @@ SOURCES += \
     $$PWD/algorithms/restorer_by_frame_blocks.cpp \
     $$PWD/algorithms/local_restorer_by_frame.cpp \
     $$PWD/algorithms/feature2d_manager.cpp \
-    $$PWD/utils/image_transforms.cpp
+    $$PWD/utils/image_transforms.cpp \
+    $$PWD/algorithms/polygons_rtree.cpp \
+    $$PWD/algorithms/vlad_retriever.cpp \
+    $$PWD/algorithms/map_bundle.cpp \
+    $$PWD/utils/mapped_file.cpp \
+    $$PWD/algorithms/incremental_descriptor_index.cpp \
+    $$PWD/algorithms/similarity_estimator.cpp \
+    $$PWD/utils/parallel_for.cpp \
+    $$PWD/algorithms/restorer_trace.cpp \
+    $$PWD/algorithms/tracking_localizer.cpp \
+    $$PWD/algorithms/key_points_selector.cpp \
+    $$PWD/algorithms/quantized_matcher.cpp \
+    $$PWD/algorithms/key_points_deduplicator.cpp \
+    $$PWD/algorithms/flann_index_tuner.cpp \
+    $$PWD/algorithms/hamming_matcher.cpp \
+    $$PWD/algorithms/multi_index_hashing_matcher.cpp \
+    $$PWD/algorithms/matcher_self_check.cpp \
+    $$PWD/algorithms/scale_bucketed_index.cpp \
+    $$PWD/algorithms/hough_pre_voter.cpp \
+    $$PWD/utils/feature_extraction.cpp \
+    $$PWD/utils/image_cache.cpp
 
 HEADERS  += \
     $$PWD/utils/csv.h \
@@ -44,7 +64,28 @@ HEADERS  += \
     $$PWD/algorithms/saveable_flann_matcher.h \
     $$PWD/algorithms/local_restorer_by_frame.h \
     $$PWD/algorithms/feature2d_manager.h \
-    $$PWD/utils/image_transforms.h
+    $$PWD/utils/image_transforms.h \
+    $$PWD/algorithms/polygons_rtree.h \
+    $$PWD/algorithms/vlad_retriever.h \
+    $$PWD/algorithms/map_bundle.h \
+    $$PWD/utils/mapped_file.h \
+    $$PWD/algorithms/incremental_descriptor_index.h \
+    $$PWD/algorithms/similarity_estimator.h \
+    $$PWD/utils/parallel_for.h \
+    $$PWD/algorithms/restorer_trace.h \
+    $$PWD/algorithms/tracking_localizer.h \
+    $$PWD/algorithms/key_points_selector.h \
+    $$PWD/algorithms/quantized_matcher.h \
+    $$PWD/algorithms/key_points_deduplicator.h \
+    $$PWD/utils/convex_polygon.h \
+    $$PWD/algorithms/flann_index_tuner.h \
+    $$PWD/algorithms/hamming_matcher.h \
+    $$PWD/algorithms/multi_index_hashing_matcher.h \
+    $$PWD/algorithms/matcher_self_check.h \
+    $$PWD/algorithms/scale_bucketed_index.h \
+    $$PWD/algorithms/hough_pre_voter.h \
+    $$PWD/utils/feature_extraction.h \
+    $$PWD/utils/image_cache.h
 
 INCLUDEPATH += /home/ar/dev/opencv-3.1/include #/home/pisarik/Libs/opencv-3.1.0-build-debug/include
 LIBS += -L/home/ar/dev/opencv-3.1/lib \ #/home/pisarik/Libs/opencv-3.1.0-build-debug/lib \
@@ -1,5 +1,12 @@
 #include "feature_based_restorer.h"
 #include "transformator.h"
+#include "utils/parallel_for.h"
+#include "utils/feature_extraction.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <opencv2/calib3d.hpp>
 
 using namespace algorithmspkg;
 
@@ -8,7 +15,9 @@ FeatureBasedRestorer::FeatureBasedRestorer(DetectorPtr detector,
                                            MatcherPtr matcher,
                                            size_t max_key_points_per_frame)
   : detector(detector), descriptor(descriptor), matcher(matcher),
-    max_key_points_per_frame(max_key_points_per_frame)
+    max_key_points_per_frame(max_key_points_per_frame),
+    retrieval_top_k(0),
+    transformation_model(TransformationModel::SIMILARITY)
 {
 }
 
@@ -38,11 +47,7 @@ double FeatureBasedRestorer::recoverLocation(const cv::Mat &query_frame,
                                              double &angle,
                                              double &scale)
 {
-  query_key_points.clear();
-
-  detector->detect(query_frame, query_key_points);
-  descriptor->compute(query_frame, query_key_points,
-                                   query_descriptions);
+  extractFeatures(query_frame, query_key_points, query_descriptions);
 
   cv::Point2f image_center( query_frame.cols/2., query_frame.rows/2. );
 
@@ -58,6 +63,94 @@ double FeatureBasedRestorer::recoverLocation(const cv::Point2f &frame_center,
   return recoverLocation(frame_rect, pos, angle, scale);
 }
 
+double FeatureBasedRestorer::recoverLocation(const cv::Rect2f &frame_rect,
+                                             cv::Point2f &pos,
+                                             double &angle, double &scale)
+{
+  QueryResult result = query(query_key_points, query_descriptions,
+                             frame_rect);
+
+  pos = result.pos;
+  angle = result.angle;
+  scale = result.scale;
+  homography = result.homography;
+  matches.swap(result.matches);
+
+  return result.confidence;
+}
+
+FeatureBasedRestorer::QueryResult FeatureBasedRestorer::query(
+                                      const KeyPointsList &key_points,
+                                      const cv::Mat &descriptions,
+                                      const cv::Point2f &frame_center) const
+{
+  cv::Rect2f frame_rect(cv::Point2f(0, 0), frame_center*2);
+
+  return query(key_points, descriptions, frame_rect);
+}
+
+std::vector<FeatureBasedRestorer::QueryResult>
+                              FeatureBasedRestorer::recoverLocations(
+                              const std::vector<cv::Mat> &query_frames) const
+{
+  std::vector<KeyPointsList> frames_key_points(query_frames.size());
+  std::vector<cv::Mat> frames_descriptions(query_frames.size());
+  std::vector<cv::Rect2f> frames_rects(query_frames.size());
+
+  auto extract = [&](const DetectorPtr &detector,
+                     const DescriptorPtr &descriptor, size_t frame_num)
+  {
+    const cv::Mat &frame = query_frames[frame_num];
+    extractFeatures(detector, descriptor, frame, frames_key_points[frame_num],
+                    frames_descriptions[frame_num]);
+    frames_rects[frame_num] = cv::Rect2f(0, 0, frame.cols, frame.rows);
+  };
+
+  if (!hasFeature2DFactories())
+  {//shared instances of Feature2D aren't thread-safe
+    for (size_t frame_num = 0; frame_num < query_frames.size(); frame_num++)
+    {
+      extract(detector, descriptor, frame_num);
+    }
+  }
+  else
+  {//each task processes a range of frames with own instances
+    const size_t tasks_count = std::min<size_t>(
+                                    std::max(cv::getNumThreads(), 1),
+                                    query_frames.size());
+    utils::cv::parallelFor(tasks_count, [&](size_t task_num)
+    {
+      DetectorPtr task_detector = create_detector();
+      DescriptorPtr task_descriptor = create_descriptor();
+
+      const size_t begin = task_num * query_frames.size() / tasks_count;
+      const size_t end = (task_num + 1) * query_frames.size() / tasks_count;
+      for (size_t frame_num = begin; frame_num < end; frame_num++)
+      {
+        extract(task_detector, task_descriptor, frame_num);
+      }
+    });
+  }
+
+  return queryBatch(frames_key_points, frames_descriptions, frames_rects);
+}
+
+std::vector<FeatureBasedRestorer::QueryResult> FeatureBasedRestorer::queryBatch(
+                          const std::vector<KeyPointsList> &frames_key_points,
+                          const std::vector<cv::Mat> &frames_descriptions,
+                          const std::vector<cv::Rect2f> &frames_rects) const
+{
+  std::vector<QueryResult> results(frames_key_points.size());
+  utils::cv::parallelFor(results.size(), [&](size_t frame_num)
+  {
+    results[frame_num] = query(frames_key_points[frame_num],
+                               frames_descriptions[frame_num],
+                               frames_rects[frame_num]);
+  });
+
+  return results;
+}
+
 const FeatureBasedRestorer::MatchesList&
             FeatureBasedRestorer::getLastMatches() const
 {
@@ -90,6 +183,275 @@ size_t FeatureBasedRestorer::getMaxKeyPointsPerFrame() const
   return max_key_points_per_frame;
 }
 
+void FeatureBasedRestorer::setKeyPointsSelector(
+                                          const KeyPointsSelector &selector)
+{
+  key_points_selector = selector;
+}
+
+const KeyPointsSelector& FeatureBasedRestorer::getKeyPointsSelector() const
+{
+  return key_points_selector;
+}
+
+void FeatureBasedRestorer::setFeature2DFactories(
+                                      const Feature2DFactory &create_detector,
+                                      const Feature2DFactory &create_descriptor)
+{
+  this->create_detector = create_detector;
+  this->create_descriptor = create_descriptor;
+}
+
+bool FeatureBasedRestorer::hasFeature2DFactories() const
+{
+  return create_detector && create_descriptor;
+}
+
+void FeatureBasedRestorer::setMapSource(const MapBundle::Source &source)
+{
+  map_source = source;
+}
+
+const MapBundle::Source& FeatureBasedRestorer::getMapSource() const
+{
+  return map_source;
+}
+
+void FeatureBasedRestorer::setTransformationModel(
+                          FeatureBasedRestorer::TransformationModel model)
+{
+  transformation_model = model;
+}
+
+FeatureBasedRestorer::TransformationModel
+                          FeatureBasedRestorer::getTransformationModel() const
+{
+  return transformation_model;
+}
+
+void FeatureBasedRestorer::setTrace(std::shared_ptr<RestorerTrace> trace)
+{
+  this->trace = trace;
+}
+
+const std::shared_ptr<RestorerTrace>& FeatureBasedRestorer::getTrace() const
+{
+  return trace;
+}
+
+void FeatureBasedRestorer::trainRetriever(int words_count, size_t top_k)
+{
+  std::vector<cv::Mat> frames_descriptions;
+  for (size_t frame_num = 0; frame_num < getFramesCount(); frame_num++)
+  {
+    frames_descriptions.push_back(getFrameDescriptions(frame_num));
+  }
+
+  retriever = std::make_shared<VladRetriever>(words_count);
+  retriever->train(frames_descriptions);
+  if (!retriever->isTrained())
+  {
+    retriever.reset();
+    return;
+  }
+
+  for (const auto &descriptions: frames_descriptions)
+  {
+    retriever->addFrame(descriptions);
+  }
+  retrieval_top_k = top_k;
+}
+
+void FeatureBasedRestorer::saveRetriever(std::string filename) const
+{
+  if (retriever)
+  {
+    retriever->save(filename);
+  }
+  else
+  {
+    std::clog << "FeatureBasedRestorer: retriever isn't trained" << std::endl;
+  }
+}
+
+void FeatureBasedRestorer::loadRetriever(std::string filename, size_t top_k)
+{
+  retriever = std::make_shared<VladRetriever>();
+  retriever->load(filename);
+
+  if (retriever->getFramesCount() != getFramesCount())
+  {//signatures was saved for another map, recompute them
+    std::clog << "FeatureBasedRestorer: recomputing frames signatures" <<
+                 std::endl;
+    retriever->clearFrames();
+    for (size_t frame_num = 0; frame_num < getFramesCount(); frame_num++)
+    {
+      retriever->addFrame(getFrameDescriptions(frame_num));
+    }
+  }
+  retrieval_top_k = top_k;
+}
+
+void FeatureBasedRestorer::disableRetriever()
+{
+  retriever.reset();
+}
+
+bool FeatureBasedRestorer::isRetrieverEnabled() const
+{
+  return static_cast<bool>(retriever);
+}
+
+void FeatureBasedRestorer::enableHoughPreVoting(int angle_bins,
+                                                double octaves_per_bin)
+{
+  hough_voter = std::make_shared<HoughPreVoter>(angle_bins, octaves_per_bin);
+}
+
+void FeatureBasedRestorer::disableHoughPreVoting()
+{
+  hough_voter.reset();
+}
+
+bool FeatureBasedRestorer::isHoughPreVotingEnabled() const
+{
+  return static_cast<bool>(hough_voter);
+}
+
+void FeatureBasedRestorer::addFrameSignature(const cv::Mat &descriptions)
+{
+  if (retriever)
+  {
+    retriever->addFrame(descriptions);
+  }
+}
+
+void FeatureBasedRestorer::removeFirstFrameSignature()
+{
+  if (retriever)
+  {
+    retriever->removeFirstFrame();
+  }
+}
+
+std::vector<size_t> FeatureBasedRestorer::retrieveFrames(
+                                          const cv::Mat &descriptions) const
+{
+  return retriever->retrieve(descriptions, retrieval_top_k);
+}
+
+std::vector<size_t> FeatureBasedRestorer::retrieveFrames(
+                                  const cv::Mat &descriptions,
+                                  const std::vector<size_t> &candidates) const
+{
+  return retriever->retrieve(descriptions, retrieval_top_k, candidates);
+}
+
+cv::Mat FeatureBasedRestorer::estimateTransformation(
+                                 const std::vector<cv::Point2f> &query_pts,
+                                 const std::vector<cv::Point2f> &train_pts,
+                                 const FeatureBasedRestorer::MatchesList &rough_matches,
+                                 std::vector<char> &mask) const
+{
+  if (transformation_model == TransformationModel::HOMOGRAPHY)
+  {
+    return cv::findHomography(query_pts, train_pts, cv::RANSAC, 3, mask);
+  }
+
+  return similarity_estimator.estimate(query_pts, train_pts,
+                           SimilarityEstimator::orderByDistance(rough_matches),
+                           mask);
+}
+
+cv::Mat FeatureBasedRestorer::estimateTransformation(
+                                 const std::vector<cv::Point2f> &query_pts,
+                                 const std::vector<cv::Point2f> &train_pts,
+                                 const std::vector<float> &rotations,
+                                 const std::vector<float> &log_scales,
+                                 const FeatureBasedRestorer::MatchesList &rough_matches,
+                                 std::vector<char> &mask) const
+{
+  std::vector<char> kept;
+  HoughPreVoter::Vote vote;
+  if (!hough_voter || !hough_voter->vote(rotations, log_scales, kept, vote) ||
+      vote.kept_count == rough_matches.size())
+  {
+    return estimateTransformation(query_pts, train_pts, rough_matches, mask);
+  }
+
+  //only matches of the dominant pose go to estimation
+  std::vector<cv::Point2f> kept_query_pts, kept_train_pts;
+  MatchesList kept_matches;
+  std::vector<size_t> kept_nums;
+  for (size_t i = 0; i < kept.size(); i++)
+  {
+    if (kept[i])
+    {
+      kept_query_pts.push_back(query_pts[i]);
+      kept_train_pts.push_back(train_pts[i]);
+      kept_matches.push_back(rough_matches[i]);
+      kept_nums.push_back(i);
+    }
+  }
+
+  std::vector<char> kept_mask;
+  cv::Mat transformation;
+  if (transformation_model == TransformationModel::HOMOGRAPHY)
+  {
+    transformation = cv::findHomography(kept_query_pts, kept_train_pts,
+                                        cv::RANSAC, 3, kept_mask);
+  }
+  else
+  {
+    SimilarityEstimator::Prior prior;
+    prior.angle = vote.angle;
+    prior.scale = vote.scale;
+    prior.angle_tolerance = hough_voter->getAngleTolerance();
+    prior.scale_tolerance = hough_voter->getScaleTolerance();
+    transformation = similarity_estimator.estimate(kept_query_pts,
+                            kept_train_pts,
+                            SimilarityEstimator::orderByDistance(kept_matches),
+                            kept_mask, prior);
+  }
+
+  mask.assign(rough_matches.size(), 0);
+  for (size_t i = 0; i < kept_mask.size(); i++)
+  {
+    mask[kept_nums[i]] = kept_mask[i];
+  }
+
+  return transformation;
+}
+
+void FeatureBasedRestorer::extractFeatures(const cv::Mat &frame,
+                                 FeatureBasedRestorer::KeyPointsList &key_points,
+                                 cv::Mat &descriptions, size_t max_count) const
+{
+  extractFeatures(detector, descriptor, frame, key_points, descriptions,
+                  max_count);
+}
+
+void FeatureBasedRestorer::extractFeatures(const DetectorPtr &detector,
+                                 const DescriptorPtr &descriptor,
+                                 const cv::Mat &frame,
+                                 FeatureBasedRestorer::KeyPointsList &key_points,
+                                 cv::Mat &descriptions, size_t max_count) const
+{
+  //one pass is cheaper even if the most of descriptions are dropped then
+  if (max_count == 0 || utils::cv::isSameAlgorithm(detector, descriptor))
+  {
+    utils::cv::detectAndCompute(detector, descriptor, frame, key_points,
+                                descriptions);
+    key_points_selector.apply(key_points, descriptions, max_count);
+    return;
+  }
+
+  key_points.clear();
+  detector->detect(frame, key_points);
+  key_points_selector.apply(key_points, max_count);
+  descriptor->compute(frame, key_points, descriptions);
+}
+
 void FeatureBasedRestorer::transformKeyPointsPosition(
                     FeatureBasedRestorer::KeyPointsList &key_points,
                     const cv::Point2f &image_center,
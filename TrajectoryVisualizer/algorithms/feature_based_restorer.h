@@ -3,8 +3,18 @@
 
 #include "ilocation_restorer.h"
 
+#include <functional>
+#include <memory>
+
 #include <opencv2/features2d.hpp>
 
+#include "vlad_retriever.h"
+#include "similarity_estimator.h"
+#include "hough_pre_voter.h"
+#include "restorer_trace.h"
+#include "map_bundle.h"
+#include "key_points_selector.h"
+
 namespace algorithmspkg
 {
 
@@ -16,6 +26,30 @@ class FeatureBasedRestorer : public ILocationRestorer
   using DetectorPtr = cv::Ptr<cv::FeatureDetector>;
   using DescriptorPtr = cv::Ptr<cv::DescriptorExtractor>;
   using MatcherPtr = cv::Ptr<cv::DescriptorMatcher>;
+  using Feature2DFactory = std::function<cv::Ptr<cv::Feature2D>()>;
+
+  /**
+   * @brief The TransformationModel enum - model estimated from matches.
+   * SIMILARITY is enough for nadir frames and needs much less iterations
+   */
+  enum class TransformationModel
+  {
+    SIMILARITY,
+    HOMOGRAPHY
+  };
+
+  /**
+   * @brief The QueryResult struct - recovered location of the query frame
+   */
+  struct QueryResult
+  {
+    cv::Point2f pos;        //in preffered units
+    double      angle;      //counterclockwise in degrees [-180; 180]
+    double      scale;      //from pixels to preffered units
+    double      confidence; //the strength of the result [0..1]
+    cv::Mat     homography; //query to map, empty if location isn't recovered
+    MatchesList matches;    //inliers, queryIdx is index of query key point
+  };
 
   FeatureBasedRestorer() = delete;
   FeatureBasedRestorer(DetectorPtr detector,
@@ -58,6 +92,7 @@ class FeatureBasedRestorer : public ILocationRestorer
 
   /**
    * @brief recoverLocation - recover position, angle and scale of setted query
+   *                          (see query), stores last homography and matches
    * @param frame_rect - need for pos return and areaConfidence
    * @param pos - out position in preffered units
    * @param angle - out counterclockwise in degrees [-180; 180], 0 is east
@@ -66,7 +101,52 @@ class FeatureBasedRestorer : public ILocationRestorer
    */
   virtual double recoverLocation(const cv::Rect2f &frame_rect,
                                  cv::Point2f &pos,
-                                 double &angle, double &scale) = 0;
+                                 double &angle, double &scale);
+
+  /**
+   * @brief query - recovers location of query frame without changing the
+   * restorer, so one restorer may serve queries from several threads while
+   * frames aren't added. Call train before concurrent queries.
+   * @param key_points - key points of query frame
+   * @param descriptions - descriptions of key_points
+   * @param frame_rect - need for pos return and areaConfidence
+   */
+  virtual QueryResult query(const KeyPointsList &key_points,
+                            const cv::Mat &descriptions,
+                            const cv::Rect2f &frame_rect) const = 0;
+  QueryResult query(const KeyPointsList &key_points,
+                    const cv::Mat &descriptions,
+                    const cv::Point2f &frame_center) const;
+
+  /**
+   * @brief recoverLocations - recovers location of each frame (see query),
+   * features are detected in parallel and queries share the matching work
+   * if subclass supports it (see queryBatch). Doesn't change last matches
+   * and homography. Call train before. Features are detected sequentially
+   * unless factories of detector and descriptor are set
+   * (see setFeature2DFactories).
+   * @param query_frames - images of query frames
+   * @return results in the order of query_frames
+   */
+  std::vector<QueryResult> recoverLocations(
+                              const std::vector<cv::Mat> &query_frames) const;
+
+  /**
+   * @brief queryBatch - query for each frame, by default queries are
+   *                     processed in parallel independently
+   * @param frames_rects - need for pos return and areaConfidence
+   * @return results in the order of frames
+   */
+  virtual std::vector<QueryResult> queryBatch(
+                          const std::vector<KeyPointsList> &frames_key_points,
+                          const std::vector<cv::Mat> &frames_descriptions,
+                          const std::vector<cv::Rect2f> &frames_rects) const;
+
+  /**
+   * @brief train - prepares matchers of added frames, otherwise they are
+   *                trained lazily by the first query
+   */
+  virtual void train() = 0;
 
   virtual size_t getFramesCount() const = 0;
   virtual const KeyPointsList& getFrameKeyPoints(size_t frame_num) const = 0;
@@ -86,7 +166,124 @@ class FeatureBasedRestorer : public ILocationRestorer
   MatcherPtr    getMatcher() const;
   size_t        getMaxKeyPointsPerFrame() const;
 
+  /**
+   * @brief setKeyPointsSelector - selection of max_key_points_per_frame
+   *                               points of frames added as images
+   */
+  void setKeyPointsSelector(const KeyPointsSelector &selector);
+  const KeyPointsSelector& getKeyPointsSelector() const;
+
+  /**
+   * @brief setFeature2DFactories - recoverLocations creates own instances
+   * of detector and descriptor for each worker by them. They must create
+   * algorithms configured like detector and descriptor of restorer, empty
+   * factories disable parallel detection
+   */
+  void setFeature2DFactories(const Feature2DFactory &create_detector,
+                             const Feature2DFactory &create_descriptor);
+  bool hasFeature2DFactories() const;
+
+  /**
+   * @brief setMapSource - features which frames were added from, it's saved
+   *                       and loaded with the map (see MapBundle::Source)
+   */
+  void setMapSource(const MapBundle::Source &source);
+  const MapBundle::Source& getMapSource() const;
+
+  void setTransformationModel(TransformationModel model);
+  TransformationModel getTransformationModel() const;
+
+  /**
+   * @brief setTrace - enables recording of hypotheses of queries,
+   *                   nullptr disables it
+   */
+  void setTrace(std::shared_ptr<RestorerTrace> trace);
+  const std::shared_ptr<RestorerTrace>& getTrace() const;
+
+  /**
+   * @brief trainRetriever - trains vocabulary on descriptions of added frames
+   *                         and enables retrieval stage before matching
+   * @param words_count - size of vocabulary
+   * @param top_k - count of the most similar frames passed to matching
+   */
+  void trainRetriever(int words_count, size_t top_k);
+  void saveRetriever(std::string filename) const;
+  void loadRetriever(std::string filename, size_t top_k);
+  void disableRetriever();
+  bool isRetrieverEnabled() const;
+
+  /**
+   * @brief enableHoughPreVoting - matches are filtered by rotation and scale
+   *                               voting before estimation (see HoughPreVoter)
+   */
+  void enableHoughPreVoting(int angle_bins = 12, double octaves_per_bin = 0.5);
+  void disableHoughPreVoting();
+  bool isHoughPreVotingEnabled() const;
+
  protected:
+  /**
+   * @brief addFrameSignature - must be called by addFrame of subclasses,
+   *                            does nothing if retriever isn't enabled
+   */
+  void addFrameSignature(const cv::Mat &descriptions);
+  /**
+   * @brief removeFirstFrameSignature - must be called by subclasses which
+   *                                    remove the oldest frame
+   */
+  void removeFirstFrameSignature();
+  /**
+   * @brief retrieveFrames - the most similar frames to query
+   * @param candidates - frames to choose from
+   * @return at most top_k frames sorted by similarity descending
+   */
+  std::vector<size_t> retrieveFrames(const cv::Mat &descriptions) const;
+  std::vector<size_t> retrieveFrames(
+                                const cv::Mat &descriptions,
+                                const std::vector<size_t> &candidates) const;
+
+  /**
+   * @brief estimateTransformation - robust estimation of query to train
+   *                                 transformation (see TransformationModel)
+   * @param rough_matches - matches of points, distances define the order of
+   *                        PROSAC sampling
+   * @param mask - out inliers mask
+   * @return 3x3 matrix or empty
+   */
+  cv::Mat estimateTransformation(const std::vector<cv::Point2f> &query_pts,
+                                 const std::vector<cv::Point2f> &train_pts,
+                                 const MatchesList &rough_matches,
+                                 std::vector<char> &mask) const;
+  /**
+   * @brief estimateTransformation - the same with Hough pre-voting if it's
+   *                                 enabled, mask has size of rough_matches
+   * @param rotations - relative rotations of matches (see HoughPreVoter)
+   * @param log_scales - relative log-scales of matches
+   */
+  cv::Mat estimateTransformation(const std::vector<cv::Point2f> &query_pts,
+                                 const std::vector<cv::Point2f> &train_pts,
+                                 const std::vector<float> &rotations,
+                                 const std::vector<float> &log_scales,
+                                 const MatchesList &rough_matches,
+                                 std::vector<char> &mask) const;
+
+  /**
+   * @brief extractFeatures - detects and describes key points of frame, in
+   * one pass if detector and descriptor are the same algorithm
+   * @param max_count - at most max_count key points are kept by key points
+   *                    selector, 0 means all
+   */
+  void extractFeatures(const cv::Mat &frame, KeyPointsList &key_points,
+                       cv::Mat &descriptions, size_t max_count = 0) const;
+  /**
+   * @brief extractFeatures - the same with given instances of detector and
+   * descriptor. Feature2D isn't thread-safe, so concurrent calls need own
+   * instances
+   */
+  void extractFeatures(const DetectorPtr &detector,
+                       const DescriptorPtr &descriptor,
+                       const cv::Mat &frame, KeyPointsList &key_points,
+                       cv::Mat &descriptions, size_t max_count = 0) const;
+
   virtual void transformKeyPointsPosition(KeyPointsList &key_points,
                                           const cv::Point2f &image_center,
                                           const cv::Point2f &pos,
@@ -104,8 +301,21 @@ class FeatureBasedRestorer : public ILocationRestorer
   DetectorPtr detector;
   DescriptorPtr descriptor;
   MatcherPtr matcher;
+  Feature2DFactory create_detector;
+  Feature2DFactory create_descriptor;
+  MapBundle::Source map_source;
 
   const size_t max_key_points_per_frame;
+  KeyPointsSelector key_points_selector;
+
+  std::shared_ptr<VladRetriever> retriever;
+  size_t retrieval_top_k;
+
+  TransformationModel transformation_model;
+  SimilarityEstimator similarity_estimator;
+  std::shared_ptr<HoughPreVoter> hough_voter;
+
+  std::shared_ptr<RestorerTrace> trace;
 };
 
 }
@@ -0,0 +1,300 @@
+#include "flann_index_tuner.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <opencv2/features2d.hpp>
+
+using namespace algorithmspkg;
+
+namespace
+{
+//a single pass is easily slowed down by other processes or cold caches
+const int TIMED_PASSES = 3;
+
+bool isBinaryNorm(int norm_type)
+{
+  return norm_type == cv::NORM_HAMMING || norm_type == cv::NORM_HAMMING2;
+}
+}
+
+FlannIndexTuner::IndexChoice FlannIndexTuner::IndexChoice::defaults(
+                                                                  int norm_type)
+{
+  IndexChoice choice;
+  if (isBinaryNorm(norm_type))
+  {
+    choice.algorithm = LSH;
+  }
+
+  return choice;
+}
+
+cv::Ptr<cv::flann::IndexParams>
+                      FlannIndexTuner::IndexChoice::makeIndexParams() const
+{
+  if (algorithm == LSH)
+  {
+    return cv::makePtr<cv::flann::LshIndexParams>(table_number, key_size,
+                                                  multi_probe_level);
+  }
+
+  return cv::makePtr<cv::flann::KDTreeIndexParams>(trees);
+}
+
+cv::Ptr<cv::flann::SearchParams>
+                      FlannIndexTuner::IndexChoice::makeSearchParams() const
+{
+  return cv::makePtr<cv::flann::SearchParams>(checks);
+}
+
+cv::Ptr<SaveableFlannMatcher> FlannIndexTuner::IndexChoice::makeMatcher() const
+{
+  return cv::makePtr<SaveableFlannMatcher>(makeIndexParams(),
+                                           makeSearchParams());
+}
+
+void FlannIndexTuner::IndexChoice::save(const std::string &filename) const
+{
+  cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+  if (!fs.isOpened())
+  {
+    throw Exception("Cannot open file: " + filename);
+  }
+
+  fs << "algorithm" << (algorithm == LSH? std::string("LSH"):
+                                          std::string("KDTREE"));
+  fs << "trees" << trees;
+  fs << "checks" << checks;
+  fs << "table_number" << table_number;
+  fs << "key_size" << key_size;
+  fs << "multi_probe_level" << multi_probe_level;
+  fs << "recall" << recall;
+  fs << "query_ms" << query_ms;
+  fs << "descriptions_id" << descriptions_id;
+}
+
+void FlannIndexTuner::IndexChoice::load(const std::string &filename)
+{
+  cv::FileStorage fs(filename, cv::FileStorage::READ);
+  if (!fs.isOpened())
+  {
+    throw Exception("Cannot open file: " + filename);
+  }
+
+  std::string algorithm_name;
+  fs["algorithm"] >> algorithm_name;
+  if (algorithm_name != "LSH" && algorithm_name != "KDTREE")
+  {
+    throw Exception("Unknown index algorithm in " + filename);
+  }
+  algorithm = algorithm_name == "LSH"? LSH: KDTREE;
+  fs["trees"] >> trees;
+  fs["checks"] >> checks;
+  fs["table_number"] >> table_number;
+  fs["key_size"] >> key_size;
+  fs["multi_probe_level"] >> multi_probe_level;
+  fs["recall"] >> recall;
+  fs["query_ms"] >> query_ms;
+  //choices saved without it are treated as tuned on unknown descriptions
+  descriptions_id.clear();
+  if (!fs["descriptions_id"].empty())
+  {
+    fs["descriptions_id"] >> descriptions_id;
+  }
+}
+
+FlannIndexTuner::FlannIndexTuner(double target_recall, int k,
+                                 int queries_count, int hold_out_step)
+  : target_recall(target_recall), k(std::max(k, 1)),
+    queries_count(std::max(queries_count, 1)),
+    hold_out_step(std::max(hold_out_step, 2))
+{
+}
+
+FlannIndexTuner::IndexChoice FlannIndexTuner::tune(
+                            const std::vector<cv::Mat> &frames_descriptions,
+                            int norm_type)
+{
+  const bool is_binary = isBinaryNorm(norm_type);
+
+  cv::Mat train, queries;
+  sampleQueries(frames_descriptions, train, queries);
+  if (!is_binary && train.type() != CV_32F)
+  {
+    train.convertTo(train, CV_32F);
+    queries.convertTo(queries, CV_32F);
+  }
+
+  std::vector<std::vector<cv::DMatch>> exact;
+  cv::BFMatcher(norm_type).knnMatch(queries, train, exact, k);
+
+  std::vector<IndexChoice> evaluated;
+  setProgressBarTitle("Tuning index");
+  if (is_binary)
+  {
+    const int choices_count = 4 * 4 * 3;
+    for (int table_number: {6, 10, 15, 20})
+    for (int key_size: {12, 16, 20, 24})
+    for (int multi_probe_level: {0, 1, 2})
+    {
+      IndexChoice choice = IndexChoice::defaults(norm_type);
+      choice.table_number = table_number;
+      choice.key_size = key_size;
+      choice.multi_probe_level = multi_probe_level;
+
+      cv::flann::Index index(train, *choice.makeIndexParams(),
+                             cvflann::FLANN_DIST_HAMMING);
+      evaluate(choice, index, train, queries, exact, norm_type);
+      evaluated.push_back(choice);
+      notifyProgressBar(evaluated.size(), choices_count);
+    }
+  }
+  else
+  {
+    const int trees_count = 4;
+    int trees_num = 0;
+    for (int trees: {1, 2, 4, 8})
+    {
+      IndexChoice choice = IndexChoice::defaults(norm_type);
+      choice.trees = trees;
+      cv::flann::Index index(train, *choice.makeIndexParams());
+
+      //more checks are only slower after target recall is met
+      for (int checks: {16, 32, 64, 128, 256})
+      {
+        choice.checks = checks;
+        evaluate(choice, index, train, queries, exact, norm_type);
+        evaluated.push_back(choice);
+        if (choice.recall >= target_recall)
+        {
+          break;
+        }
+      }
+      notifyProgressBar(++trees_num, trees_count);
+    }
+  }
+
+  IndexChoice best = evaluated.front();
+  for (const IndexChoice &choice: evaluated)
+  {
+    const bool meets = choice.recall >= target_recall;
+    const bool best_meets = best.recall >= target_recall;
+    if ((meets && (!best_meets || choice.query_ms < best.query_ms)) ||
+        (!meets && !best_meets && choice.recall > best.recall))
+    {
+      best = choice;
+    }
+  }
+
+  if (best.recall < target_recall)
+  {
+    std::clog << "FlannIndexTuner: target recall isn't reached, the best is "
+              << best.recall << std::endl;
+  }
+
+  return best;
+}
+
+void FlannIndexTuner::sampleQueries(
+                              const std::vector<cv::Mat> &frames_descriptions,
+                              cv::Mat &train, cv::Mat &queries) const
+{
+  std::vector<cv::Mat> held_out;
+  int held_out_rows = 0;
+  train.release();
+  for (size_t frame_num = 0; frame_num < frames_descriptions.size();
+       frame_num++)
+  {
+    const cv::Mat &descriptions = frames_descriptions[frame_num];
+    if (descriptions.empty())
+    {
+      continue;
+    }
+
+    if (frame_num % hold_out_step == static_cast<size_t>(hold_out_step / 2))
+    {
+      held_out.push_back(descriptions);
+      held_out_rows += descriptions.rows;
+    }
+    else
+    {
+      train.push_back(descriptions);
+    }
+  }
+
+  if (train.empty() || held_out.empty())
+  {
+    throw Exception("Not enough frames to hold out queries");
+  }
+
+  //queries are sampled uniformly from held out frames
+  const int step = std::max(1, held_out_rows / queries_count);
+  queries.release();
+  int global_row = 0;
+  for (const cv::Mat &descriptions: held_out)
+  {
+    for (int row = 0; row < descriptions.rows; row++, global_row++)
+    {
+      if (global_row % step == 0 && queries.rows < queries_count)
+      {
+        queries.push_back(descriptions.row(row));
+      }
+    }
+  }
+}
+
+void FlannIndexTuner::evaluate(IndexChoice &choice, cv::flann::Index &index,
+                         const cv::Mat &train, const cv::Mat &queries,
+                         const std::vector<std::vector<cv::DMatch>> &exact,
+                         int norm_type) const
+{
+  cv::Mat indices, distances;
+  const cv::Ptr<cv::flann::SearchParams> search_params =
+                                                    choice.makeSearchParams();
+  index.knnSearch(queries, indices, distances, k, *search_params);
+  double elapsed_ms = 0;
+  for (int pass = 0; pass < TIMED_PASSES; pass++)
+  {
+    int64 start = cv::getTickCount();
+    index.knnSearch(queries, indices, distances, k, *search_params);
+    const double pass_ms = (cv::getTickCount() - start) * 1000. /
+                           cv::getTickFrequency();
+    elapsed_ms = pass == 0? pass_ms: std::min(elapsed_ms, pass_ms);
+  }
+
+  //found neighbour is a hit if it isn't farther than k-th exact one,
+  //so equidistant neighbours aren't counted as misses
+  size_t hits = 0, total = 0;
+  for (int query_idx = 0; query_idx < queries.rows; query_idx++)
+  {
+    const auto &query_exact = exact[query_idx];
+    if (query_exact.empty())
+    {
+      continue;
+    }
+    const float max_distance = query_exact.back().distance;
+
+    size_t query_hits = 0;
+    const int *found = indices.ptr<int>(query_idx);
+    for (int i = 0; i < indices.cols; i++)
+    {
+      if (found[i] < 0 || found[i] >= train.rows)
+      {
+        continue;
+      }
+      double distance = cv::norm(queries.row(query_idx), train.row(found[i]),
+                                 norm_type);
+      if (distance <= max_distance + 1e-4)
+      {
+        query_hits++;
+      }
+    }
+
+    hits += std::min(query_hits, query_exact.size());
+    total += query_exact.size();
+  }
+
+  choice.recall = total? double(hits) / total: 0;
+  choice.query_ms = elapsed_ms / std::max(queries.rows, 1);
+}
@@ -0,0 +1,113 @@
+#ifndef FLANN_INDEX_TUNER_H
+#define FLANN_INDEX_TUNER_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include <opencv2/core.hpp>
+#include <opencv2/flann.hpp>
+
+#include "saveable_flann_matcher.h"
+#include "progress_bar_notifier.h"
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The FlannIndexTuner class - chooses parameters of FLANN index for
+ * descriptions of a map. Every hold_out_step-th frame is held out, its
+ * descriptions are queries to the index over the other frames. Recall@k is
+ * measured against exact brute force, the fastest parameters meeting
+ * target recall are chosen (KD-trees for float descriptions, LSH for binary).
+ * Evaluated parameters are reported to the progress bar.
+ */
+class FlannIndexTuner: public ProgressBarNotifier
+{
+ public:
+  /**
+   * @brief The IndexChoice struct - parameters of index, saved alongside
+   *                                 the map
+   */
+  struct IndexChoice
+  {
+    enum Algorithm
+    {
+      KDTREE,
+      LSH
+    };
+
+    Algorithm algorithm = KDTREE;
+    int trees = 4;               //KDTREE
+    int checks = 32;             //KDTREE, leafs visited by search
+    int table_number = 20;       //LSH
+    int key_size = 10;           //LSH, bits of hash
+    int multi_probe_level = 2;   //LSH
+    double recall = 0;           //measured recall@k, 0 if not tuned
+    double query_ms = 0;         //measured time of one query
+    std::string descriptions_id; //descriptions it was tuned on, set by user
+
+    /**
+     * @brief defaults - untuned parameters for descriptions of norm_type
+     */
+    static IndexChoice defaults(int norm_type);
+
+    cv::Ptr<cv::flann::IndexParams> makeIndexParams() const;
+    cv::Ptr<cv::flann::SearchParams> makeSearchParams() const;
+    cv::Ptr<SaveableFlannMatcher> makeMatcher() const;
+
+    void save(const std::string &filename) const;
+    void load(const std::string &filename);
+  };
+
+  /**
+   * @brief FlannIndexTuner
+   * @param target_recall - min recall@k of chosen parameters
+   * @param k - count of nearest neighbours checked for recall
+   * @param queries_count - max count of sampled query descriptions
+   * @param hold_out_step - every hold_out_step-th frame is held out
+   */
+  explicit FlannIndexTuner(double target_recall = 0.9, int k = 2,
+                           int queries_count = 1000, int hold_out_step = 10);
+
+  /**
+   * @brief tune - searches trees and checks (KDTREE) or table number,
+   *               key size and multi-probe level (LSH)
+   * @param frames_descriptions - descriptions of map frames
+   * @param norm_type - norm of descriptions (e.g. defaultNorm of descriptor)
+   * @return the fastest parameters meeting target recall or parameters with
+   *         the best recall if none meets it
+   */
+  IndexChoice tune(const std::vector<cv::Mat> &frames_descriptions,
+                   int norm_type);
+
+  class Exception: public std::runtime_error
+  {
+  public:
+    Exception(const std::string &what):
+      std::runtime_error("FlannIndexTuner: " + what)
+    {}
+  };
+
+ private:
+  void sampleQueries(const std::vector<cv::Mat> &frames_descriptions,
+                     cv::Mat &train, cv::Mat &queries) const;
+  /**
+   * @brief evaluate - measures recall and query time of choice, the time is
+   *                   the fastest of several passes after a warm-up one
+   * @param exact - k nearest train rows of each query by brute force
+   */
+  void evaluate(IndexChoice &choice, cv::flann::Index &index,
+                const cv::Mat &train, const cv::Mat &queries,
+                const std::vector<std::vector<cv::DMatch>> &exact,
+                int norm_type) const;
+
+  const double target_recall;
+  const int k;
+  const int queries_count;
+  const int hold_out_step;
+};
+
+}
+
+#endif // FLANN_INDEX_TUNER_H
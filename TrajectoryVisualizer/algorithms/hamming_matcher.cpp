@@ -0,0 +1,571 @@
+#include "hamming_matcher.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "algorithms/matcher_self_check.h"
+#include "utils/parallel_for.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAMMING_MATCHER_X86
+#include <immintrin.h>
+#if (defined(__clang__) && __clang_major__ >= 6) || \
+    (!defined(__clang__) && __GNUC__ >= 8)
+#define HAMMING_MATCHER_AVX512
+#endif
+#endif
+
+using namespace algorithmspkg;
+
+namespace
+{
+const int QUERY_BLOCK = 64;   //queries of one parallel task
+const int TRAIN_BLOCK = 2048; //rows of one block, 64 KB of 32 byte rows
+const int ROW_ALIGNMENT = 32;
+
+inline int popcount64(uint64_t x)
+{
+#ifdef __GNUC__
+  return __builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+void distancesPortable(const uint8_t *query, const uint8_t *rows,
+                       int rows_count, int stride, int *distances)
+{
+  for (int row = 0; row < rows_count; row++, rows += stride)
+  {
+    int distance = 0;
+    for (int i = 0; i < stride; i += 8)
+    {
+      uint64_t a, b;
+      std::memcpy(&a, query + i, 8);
+      std::memcpy(&b, rows + i, 8);
+      distance += popcount64(a ^ b);
+    }
+    distances[row] = distance;
+  }
+}
+
+#ifdef HAMMING_MATCHER_X86
+__attribute__((target("popcnt")))
+void distancesPopcnt(const uint8_t *query, const uint8_t *rows,
+                     int rows_count, int stride, int *distances)
+{
+  for (int row = 0; row < rows_count; row++, rows += stride)
+  {
+    int distance = 0;
+    for (int i = 0; i < stride; i += 8)
+    {
+      uint64_t a, b;
+      std::memcpy(&a, query + i, 8);
+      std::memcpy(&b, rows + i, 8);
+      distance += __builtin_popcountll(a ^ b);
+    }
+    distances[row] = distance;
+  }
+}
+
+/**
+ * @brief distancesAvx2 - popcount of bytes by lookup of nibbles,
+ *                        bytes are summed by sad
+ */
+__attribute__((target("avx2")))
+void distancesAvx2(const uint8_t *query, const uint8_t *rows,
+                   int rows_count, int stride, int *distances)
+{
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+
+  for (int row = 0; row < rows_count; row++, rows += stride)
+  {
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < stride; i += 32)
+    {
+      __m256i x = _mm256_xor_si256(
+               _mm256_loadu_si256(reinterpret_cast<const __m256i*>(query + i)),
+               _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i)));
+      __m256i low = _mm256_and_si256(x, low_mask);
+      __m256i high = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+      __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low),
+                                       _mm256_shuffle_epi8(lookup, high));
+      sum = _mm256_add_epi64(sum, _mm256_sad_epu8(counts, zero));
+    }
+
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum),
+                                 _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi64(half, _mm_unpackhi_epi64(half, half));
+    distances[row] = _mm_cvtsi128_si32(half);
+  }
+}
+#endif
+
+#ifdef HAMMING_MATCHER_AVX512
+__attribute__((target("avx512f,avx512vl,avx512vpopcntdq")))
+void distancesAvx512(const uint8_t *query, const uint8_t *rows,
+                     int rows_count, int stride, int *distances)
+{
+  for (int row = 0; row < rows_count; row++, rows += stride)
+  {
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < stride; i += 32)
+    {
+      __m256i x = _mm256_xor_si256(
+               _mm256_loadu_si256(reinterpret_cast<const __m256i*>(query + i)),
+               _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i)));
+      sum = _mm256_add_epi64(sum, _mm256_popcnt_epi64(x));
+    }
+
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum),
+                                 _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi64(half, _mm_unpackhi_epi64(half, half));
+    distances[row] = _mm_cvtsi128_si32(half);
+  }
+}
+#endif
+
+struct Kernel
+{
+  HammingMatcher::DistancesKernel function;
+  const char *name;
+};
+
+/**
+ * @brief supportedKernels - kernels supported by this CPU, the fastest last
+ */
+std::vector<Kernel> supportedKernels()
+{
+  std::vector<Kernel> kernels = {{distancesPortable, "portable"}};
+#ifdef HAMMING_MATCHER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("popcnt"))
+  {
+    kernels.push_back({distancesPopcnt, "POPCNT"});
+  }
+  if (__builtin_cpu_supports("avx2"))
+  {
+    kernels.push_back({distancesAvx2, "AVX2"});
+  }
+#ifdef HAMMING_MATCHER_AVX512
+  if (__builtin_cpu_supports("avx512vpopcntdq") &&
+      __builtin_cpu_supports("avx512vl"))
+  {
+    kernels.push_back({distancesAvx512, "AVX-512 VPOPCNTDQ"});
+  }
+#endif
+#endif
+  return kernels;
+}
+
+Kernel detectKernel()
+{
+  return supportedKernels().back();
+}
+}
+
+HammingMatcher::HammingMatcher()
+  : distances_kernel(detectKernel().function),
+    descriptor_size(0), stride(0)
+{
+}
+
+bool HammingMatcher::isMaskSupported() const
+{
+  return false;
+}
+
+cv::Ptr<cv::DescriptorMatcher> HammingMatcher::clone(
+                                                  bool emptyTrainData) const
+{
+  auto matcher = cv::makePtr<HammingMatcher>();
+  if (!emptyTrainData)
+  {
+    matcher->trainDescCollection = trainDescCollection;
+    matcher->descriptor_size = descriptor_size;
+    matcher->stride = stride;
+    matcher->codes = codes.clone();
+    matcher->images_starts = images_starts;
+  }
+
+  return matcher;
+}
+
+void HammingMatcher::clear()
+{
+  cv::DescriptorMatcher::clear();
+  descriptor_size = 0;
+  stride = 0;
+  codes.release();
+  images_starts.clear();
+}
+
+void HammingMatcher::train()
+{
+  if (images_starts.size() == trainDescCollection.size())
+  {
+    return;
+  }
+
+  for (size_t img_idx = images_starts.size();
+       img_idx < trainDescCollection.size(); img_idx++)
+  {
+    const cv::Mat &descriptors = trainDescCollection[img_idx];
+    if (descriptors.empty())
+    {
+      continue;
+    }
+    if (descriptors.type() != CV_8U)
+    {
+      throw Exception("Only binary (CV_8U) descriptors are supported");
+    }
+    if (descriptor_size == 0)
+    {
+      descriptor_size = descriptors.cols;
+      stride = (descriptor_size + ROW_ALIGNMENT - 1) /
+               ROW_ALIGNMENT * ROW_ALIGNMENT;
+    }
+    else if (descriptors.cols != descriptor_size)
+    {
+      throw Exception("Descriptors of different sizes");
+    }
+  }
+
+  for (size_t img_idx = images_starts.size();
+       img_idx < trainDescCollection.size(); img_idx++)
+  {
+    images_starts.push_back(codes.rows);
+    if (!trainDescCollection[img_idx].empty())
+    {
+      cv::Mat padded;
+      pad(trainDescCollection[img_idx], padded);
+      codes.push_back(padded);
+    }
+  }
+}
+
+std::string HammingMatcher::getKernelName()
+{
+  return detectKernel().name;
+}
+
+HammingMatcher::DistancesKernel HammingMatcher::getDistancesKernel()
+{
+  return detectKernel().function;
+}
+
+void HammingMatcher::selfCheck()
+{
+  cv::RNG rng(41);
+  for (int bytes: {32, 64})
+  {
+    //every kernel supported by this CPU gives distances of cv::norm
+    cv::Mat rows = MatcherSelfCheck::makeRandom(rng, 257, bytes);
+    cv::Mat query = MatcherSelfCheck::makeNear(rng, rows, 16, bytes * 4);
+    std::vector<int> distances(rows.rows);
+    for (const Kernel &kernel: supportedKernels())
+    for (int query_idx = 0; query_idx < query.rows; query_idx++)
+    {
+      kernel.function(query.ptr<uint8_t>(query_idx), rows.ptr<uint8_t>(),
+                      rows.rows, bytes, distances.data());
+      for (int row = 0; row < rows.rows; row++)
+      {
+        if (distances[row] != cv::norm(query.row(query_idx), rows.row(row),
+                                       cv::NORM_HAMMING))
+        {
+          throw Exception(std::string(kernel.name) + " kernel differs from "
+                          "cv::norm on " + std::to_string(bytes) + " bytes");
+        }
+      }
+    }
+  }
+
+  for (int bytes: {32, 61, 64})
+  {
+    //train rows take three blocks, the last image repeats rows of the first
+    //one, so equal distances are merged across blocks
+    std::vector<cv::Mat> train = {MatcherSelfCheck::makeRandom(rng, 1500, bytes),
+                                  cv::Mat(),
+                                  MatcherSelfCheck::makeRandom(rng, 2700, bytes)};
+    train.push_back(train[0].rowRange(0, 700).clone());
+
+    cv::Mat query;
+    cv::vconcat(MatcherSelfCheck::makeNear(rng, train[0], 150, 8),
+                MatcherSelfCheck::makeNear(rng, train[2], 50, 8), query);
+    cv::vconcat(query, MatcherSelfCheck::makeRandom(rng, 56, bytes), query);
+
+    HammingMatcher matcher;
+    matcher.add(train);
+    MatcherSelfCheck::compare("HammingMatcher (" + getKernelName() + ", " +
+                              std::to_string(bytes) + " bytes)",
+                              matcher, query, {1, 2, 5}, {1, 40, bytes * 4.f});
+  }
+}
+
+void HammingMatcher::knnMatchImpl(cv::InputArray queryDescriptors,
+                              std::vector<std::vector<cv::DMatch>> &matches,
+                              int k, cv::InputArrayOfArrays /*masks*/,
+                              bool compactResult)
+{
+  train();
+
+  cv::Mat query = queryDescriptors.getMat();
+  matches.assign(query.rows, std::vector<cv::DMatch>());
+  if (query.empty() || codes.empty() || k <= 0)
+  {
+    return;
+  }
+  checkQuery(query);
+
+  cv::Mat query_codes;
+  pad(query, query_codes);
+
+  const size_t blocks_count = (query.rows + QUERY_BLOCK - 1) / QUERY_BLOCK;
+  utils::cv::parallelFor(blocks_count,
+                         [this, &query_codes, &matches, k](size_t block)
+  {
+    const int begin = static_cast<int>(block) * QUERY_BLOCK;
+    const int end = std::min(begin + QUERY_BLOCK, query_codes.rows);
+    if (k <= 2)
+    {
+      matchTop2(query_codes, begin, end, k, matches);
+    }
+    else
+    {
+      matchTopK(query_codes, begin, end, k, matches);
+    }
+  });
+
+  if (compactResult)
+  {
+    matches.erase(std::remove_if(matches.begin(), matches.end(),
+                                 [](const std::vector<cv::DMatch> &m)
+                                 { return m.empty(); }),
+                  matches.end());
+  }
+}
+
+void HammingMatcher::radiusMatchImpl(cv::InputArray queryDescriptors,
+                              std::vector<std::vector<cv::DMatch>> &matches,
+                              float maxDistance,
+                              cv::InputArrayOfArrays /*masks*/,
+                              bool compactResult)
+{
+  train();
+
+  cv::Mat query = queryDescriptors.getMat();
+  matches.assign(query.rows, std::vector<cv::DMatch>());
+  if (query.empty() || codes.empty())
+  {
+    return;
+  }
+  checkQuery(query);
+
+  cv::Mat query_codes;
+  pad(query, query_codes);
+
+  const size_t blocks_count = (query.rows + QUERY_BLOCK - 1) / QUERY_BLOCK;
+  utils::cv::parallelFor(blocks_count,
+                         [this, &query_codes, &matches, maxDistance]
+                         (size_t block)
+  {
+    const int begin = static_cast<int>(block) * QUERY_BLOCK;
+    const int end = std::min(begin + QUERY_BLOCK, query_codes.rows);
+    int distances[TRAIN_BLOCK];
+
+    for (int train_begin = 0; train_begin < codes.rows;
+         train_begin += TRAIN_BLOCK)
+    {
+      const int rows_count = std::min(TRAIN_BLOCK, codes.rows - train_begin);
+      const uint8_t *rows = codes.ptr<uint8_t>(train_begin);
+      for (int query_idx = begin; query_idx < end; query_idx++)
+      {
+        distances_kernel(query_codes.ptr<uint8_t>(query_idx), rows,
+                         rows_count, stride, distances);
+        for (int row = 0; row < rows_count; row++)
+        {
+          if (distances[row] < maxDistance)
+          {
+            int img_idx = 0, local_idx = 0;
+            locate(train_begin + row, img_idx, local_idx);
+            matches[query_idx].push_back(cv::DMatch(query_idx, local_idx,
+                                                    img_idx, distances[row]));
+          }
+        }
+      }
+    }
+
+    for (int query_idx = begin; query_idx < end; query_idx++)
+    {
+      std::sort(matches[query_idx].begin(), matches[query_idx].end());
+    }
+  });
+
+  if (compactResult)
+  {
+    matches.erase(std::remove_if(matches.begin(), matches.end(),
+                                 [](const std::vector<cv::DMatch> &m)
+                                 { return m.empty(); }),
+                  matches.end());
+  }
+}
+
+void HammingMatcher::pad(const cv::Mat &descriptors, cv::Mat &padded) const
+{
+  padded = cv::Mat(descriptors.rows, stride, CV_8U, cv::Scalar(0));
+  for (int row = 0; row < descriptors.rows; row++)
+  {
+    std::memcpy(padded.ptr<uint8_t>(row), descriptors.ptr<uint8_t>(row),
+                descriptor_size);
+  }
+}
+
+void HammingMatcher::checkQuery(const cv::Mat &query) const
+{
+  if (query.type() != CV_8U || query.cols != descriptor_size)
+  {
+    throw Exception("Query descriptors don't match train descriptors");
+  }
+}
+
+void HammingMatcher::locate(int global_idx, int &img_idx,
+                            int &local_idx) const
+{
+  //the last image starting not after global_idx (skipping empty images)
+  auto it = std::upper_bound(images_starts.begin(), images_starts.end(),
+                             global_idx) - 1;
+  img_idx = it - images_starts.begin();
+  local_idx = global_idx - *it;
+}
+
+void HammingMatcher::matchTop2(const cv::Mat &query_codes, int begin,
+                            int end, int k,
+                            std::vector<std::vector<cv::DMatch>> &matches) const
+{
+  int best[QUERY_BLOCK], second[QUERY_BLOCK];
+  int best_rows[QUERY_BLOCK], second_rows[QUERY_BLOCK];
+  std::fill(best, best + QUERY_BLOCK, INT_MAX);
+  std::fill(second, second + QUERY_BLOCK, INT_MAX);
+  std::fill(best_rows, best_rows + QUERY_BLOCK, -1);
+  std::fill(second_rows, second_rows + QUERY_BLOCK, -1);
+  int distances[TRAIN_BLOCK];
+
+  //each block of train rows stays in cache for all queries of the task
+  for (int train_begin = 0; train_begin < codes.rows;
+       train_begin += TRAIN_BLOCK)
+  {
+    const int rows_count = std::min(TRAIN_BLOCK, codes.rows - train_begin);
+    const uint8_t *rows = codes.ptr<uint8_t>(train_begin);
+    for (int query_idx = begin; query_idx < end; query_idx++)
+    {
+      distances_kernel(query_codes.ptr<uint8_t>(query_idx), rows, rows_count,
+                       stride, distances);
+
+      const int i = query_idx - begin;
+      int best_distance = best[i], second_distance = second[i];
+      int best_row = best_rows[i], second_row = second_rows[i];
+      for (int row = 0; row < rows_count; row++)
+      {
+        const int distance = distances[row];
+        if (distance < second_distance)
+        {
+          if (distance < best_distance)
+          {
+            second_distance = best_distance;
+            second_row = best_row;
+            best_distance = distance;
+            best_row = train_begin + row;
+          }
+          else
+          {
+            second_distance = distance;
+            second_row = train_begin + row;
+          }
+        }
+      }
+      best[i] = best_distance;
+      second[i] = second_distance;
+      best_rows[i] = best_row;
+      second_rows[i] = second_row;
+    }
+  }
+
+  for (int query_idx = begin; query_idx < end; query_idx++)
+  {
+    const int i = query_idx - begin;
+    int img_idx = 0, local_idx = 0;
+    if (best_rows[i] >= 0)
+    {
+      locate(best_rows[i], img_idx, local_idx);
+      matches[query_idx].push_back(cv::DMatch(query_idx, local_idx, img_idx,
+                                              best[i]));
+    }
+    if (k == 2 && second_rows[i] >= 0)
+    {
+      locate(second_rows[i], img_idx, local_idx);
+      matches[query_idx].push_back(cv::DMatch(query_idx, local_idx, img_idx,
+                                              second[i]));
+    }
+  }
+}
+
+void HammingMatcher::matchTopK(const cv::Mat &query_codes, int begin,
+                            int end, int k,
+                            std::vector<std::vector<cv::DMatch>> &matches) const
+{
+  using Neighbour = std::pair<int, int>; //distance, row
+  std::vector<std::vector<Neighbour>> nearest(end - begin);
+  int distances[TRAIN_BLOCK];
+
+  for (int train_begin = 0; train_begin < codes.rows;
+       train_begin += TRAIN_BLOCK)
+  {
+    const int rows_count = std::min(TRAIN_BLOCK, codes.rows - train_begin);
+    const uint8_t *rows = codes.ptr<uint8_t>(train_begin);
+    for (int query_idx = begin; query_idx < end; query_idx++)
+    {
+      distances_kernel(query_codes.ptr<uint8_t>(query_idx), rows, rows_count,
+                       stride, distances);
+
+      //sorted by distance, the nearest first
+      auto &query_nearest = nearest[query_idx - begin];
+      for (int row = 0; row < rows_count; row++)
+      {
+        const int distance = distances[row];
+        if (query_nearest.size() == static_cast<size_t>(k) &&
+            distance >= query_nearest.back().first)
+        {
+          continue;
+        }
+        const Neighbour neighbour(distance, train_begin + row);
+        query_nearest.insert(std::upper_bound(query_nearest.begin(),
+                                              query_nearest.end(), neighbour),
+                             neighbour);
+        if (query_nearest.size() > static_cast<size_t>(k))
+        {
+          query_nearest.pop_back();
+        }
+      }
+    }
+  }
+
+  for (int query_idx = begin; query_idx < end; query_idx++)
+  {
+    for (const Neighbour &neighbour: nearest[query_idx - begin])
+    {
+      int img_idx = 0, local_idx = 0;
+      locate(neighbour.second, img_idx, local_idx);
+      matches[query_idx].push_back(cv::DMatch(query_idx, local_idx, img_idx,
+                                              neighbour.first));
+    }
+  }
+}
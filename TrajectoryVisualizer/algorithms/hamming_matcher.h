@@ -0,0 +1,110 @@
+#ifndef HAMMING_MATCHER_H
+#define HAMMING_MATCHER_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The HammingMatcher class - exact brute force matcher of binary
+ * descriptors (ORB, BRISK, FREAK, AKAZE) by Hamming distance. Train
+ * descriptors are copied to rows padded to 32 bytes. Distances from a query
+ * to a block of train rows are computed by popcount kernel chosen at runtime
+ * (AVX-512 VPOPCNTDQ, AVX2, POPCNT or portable), queries and train rows are
+ * processed in blocks fitting into cache, blocks of queries in parallel.
+ * For k <= 2 the best and the second distances are selected in one pass.
+ */
+class HammingMatcher : public cv::DescriptorMatcher
+{
+ public:
+  HammingMatcher();
+
+  bool isMaskSupported() const override;
+  cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const
+                                                                      override;
+
+  void clear() override;
+
+  /**
+   * @brief train - copies not copied train descriptors to padded rows
+   */
+  void train() override;
+
+  /**
+   * @brief getKernelName - popcount kernel used on this CPU
+   */
+  static std::string getKernelName();
+
+  class Exception: public std::runtime_error
+  {
+  public:
+    Exception(const std::string &what):
+      std::runtime_error("HammingMatcher: " + what)
+    {}
+  };
+
+  /**
+   * @brief DistancesKernel - distances from query to rows_count rows
+   * @param stride - length of query and rows in bytes, multiple of 32
+   */
+  using DistancesKernel = void (*)(const uint8_t *query, const uint8_t *rows,
+                                   int rows_count, int stride,
+                                   int *distances);
+  /**
+   * @brief getDistancesKernel - the fastest kernel supported by this CPU
+   */
+  static DistancesKernel getDistancesKernel();
+
+  /**
+   * @brief selfCheck - compares every kernel supported by this CPU with
+   * cv::norm and knnMatch (k = 1, 2, 5), radiusMatch with cv::BFMatcher on
+   * random 32, 61 and 64 bytes descriptors (see MatcherSelfCheck)
+   * @throw MatcherSelfCheck::Exception or Exception on the first difference
+   */
+  static void selfCheck();
+
+ protected:
+  void knnMatchImpl(cv::InputArray queryDescriptors,
+                    std::vector<std::vector<cv::DMatch>> &matches, int k,
+                    cv::InputArrayOfArrays masks = cv::noArray(),
+                    bool compactResult = false) override;
+  void radiusMatchImpl(cv::InputArray queryDescriptors,
+                       std::vector<std::vector<cv::DMatch>> &matches,
+                       float maxDistance,
+                       cv::InputArrayOfArrays masks = cv::noArray(),
+                       bool compactResult = false) override;
+
+ private:
+  /**
+   * @brief pad - copies descriptors to rows of stride bytes
+   */
+  void pad(const cv::Mat &descriptors, cv::Mat &padded) const;
+  void checkQuery(const cv::Mat &query) const;
+  void locate(int global_idx, int &img_idx, int &local_idx) const;
+
+  /**
+   * @brief matchTop2 - k <= 2 nearest rows for queries [begin, end)
+   */
+  void matchTop2(const cv::Mat &query_codes, int begin, int end, int k,
+                 std::vector<std::vector<cv::DMatch>> &matches) const;
+  void matchTopK(const cv::Mat &query_codes, int begin, int end, int k,
+                 std::vector<std::vector<cv::DMatch>> &matches) const;
+
+  const DistancesKernel distances_kernel;
+
+  int               descriptor_size; //bytes, 0 if nothing is trained
+  int               stride;          //descriptor_size rounded up to 32
+  cv::Mat           codes;           //CV_8U, padded train descriptors
+  std::vector<int>  images_starts;   //first row of each train image
+};
+
+}
+
+#endif // HAMMING_MATCHER_H
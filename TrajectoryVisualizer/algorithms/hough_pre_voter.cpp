@@ -0,0 +1,154 @@
+#include "hough_pre_voter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace algorithmspkg;
+
+namespace
+{
+const int MAX_SCALE_BINS = 64;
+const double NOT_VOTED = std::numeric_limits<double>::quiet_NaN();
+}
+
+HoughPreVoter::HoughPreVoter(int angle_bins, double octaves_per_bin,
+                             size_t min_kept)
+  : angle_bins(std::max(angle_bins, 1)),
+    octaves_per_bin(std::max(octaves_per_bin, 1e-3)),
+    min_kept(min_kept)
+{
+}
+
+void HoughPreVoter::relativePose(const cv::KeyPoint &query,
+                                 const cv::KeyPoint &train,
+                                 float &rotation, float &log_scale)
+{
+  rotation = query.angle >= 0 && train.angle >= 0?
+             train.angle - query.angle:
+             std::numeric_limits<float>::quiet_NaN();
+  log_scale = query.size > 0 && train.size > 0?
+              std::log2(train.size / query.size):
+              std::numeric_limits<float>::quiet_NaN();
+}
+
+bool HoughPreVoter::vote(const std::vector<float> &rotations,
+                         const std::vector<float> &log_scales,
+                         std::vector<char> &kept, Vote &dominant) const
+{
+  const size_t count = std::min(rotations.size(), log_scales.size());
+  kept.assign(count, 1);
+  dominant.angle = dominant.scale = NOT_VOTED;
+  dominant.kept_count = count;
+  if (count < min_kept)
+  {
+    return false;
+  }
+
+  //a dimension is voted only if all matches have it
+  bool vote_angle = angle_bins > 1;
+  bool vote_scale = true;
+  float min_log_scale = std::numeric_limits<float>::max();
+  float max_log_scale = -std::numeric_limits<float>::max();
+  for (size_t i = 0; i < count; i++)
+  {
+    vote_angle = vote_angle && !std::isnan(rotations[i]);
+    vote_scale = vote_scale && !std::isnan(log_scales[i]);
+    if (vote_scale)
+    {
+      min_log_scale = std::min(min_log_scale, log_scales[i]);
+      max_log_scale = std::max(max_log_scale, log_scales[i]);
+    }
+  }
+  if (!vote_angle && !vote_scale)
+  {
+    return false;
+  }
+
+  const int used_angle_bins = vote_angle? angle_bins: 1;
+  const double angle_bin_width = 360. / used_angle_bins;
+  const int scale_bins = vote_scale?
+        std::min(MAX_SCALE_BINS, static_cast<int>(
+                   (max_log_scale - min_log_scale) / octaves_per_bin) + 1): 1;
+
+  std::vector<int> angle_of(count, 0), scale_of(count, 0);
+  std::vector<size_t> histogram(used_angle_bins * scale_bins, 0);
+  for (size_t i = 0; i < count; i++)
+  {
+    if (vote_angle)
+    {
+      double angle = std::fmod(double(rotations[i]), 360.);
+      angle = angle < 0? angle + 360: angle;
+      angle_of[i] = std::min(static_cast<int>(angle / angle_bin_width),
+                             used_angle_bins - 1);
+    }
+    if (vote_scale)
+    {
+      scale_of[i] = std::min(static_cast<int>(
+                          (log_scales[i] - min_log_scale) / octaves_per_bin),
+                             scale_bins - 1);
+    }
+    histogram[angle_of[i] * scale_bins + scale_of[i]]++;
+  }
+
+  const size_t best_bin = std::max_element(histogram.begin(),
+                                           histogram.end()) -
+                          histogram.begin();
+  const int best_angle = best_bin / scale_bins;
+  const int best_scale = best_bin % scale_bins;
+
+  //matches of neighbour bins are kept, rotation bins are cyclic
+  size_t kept_count = 0;
+  double sum_sin = 0, sum_cos = 0, sum_log_scale = 0;
+  size_t in_best_bin = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    int angle_diff = std::abs(angle_of[i] - best_angle);
+    angle_diff = std::min(angle_diff, used_angle_bins - angle_diff);
+    const int scale_diff = std::abs(scale_of[i] - best_scale);
+    kept[i] = angle_diff <= 1 && scale_diff <= 1;
+    kept_count += kept[i];
+
+    if (angle_of[i] == best_angle && scale_of[i] == best_scale)
+    {
+      if (vote_angle)
+      {
+        sum_sin += std::sin(rotations[i] * CV_PI / 180);
+        sum_cos += std::cos(rotations[i] * CV_PI / 180);
+      }
+      if (vote_scale)
+      {
+        sum_log_scale += log_scales[i];
+      }
+      in_best_bin++;
+    }
+  }
+
+  if (kept_count < min_kept)
+  {
+    kept.assign(count, 1);
+    return false;
+  }
+
+  dominant.kept_count = kept_count;
+  if (vote_angle)
+  {
+    dominant.angle = std::atan2(sum_sin, sum_cos) * 180 / CV_PI;
+  }
+  if (vote_scale)
+  {
+    dominant.scale = std::exp2(sum_log_scale / in_best_bin);
+  }
+
+  return true;
+}
+
+double HoughPreVoter::getAngleTolerance() const
+{
+  return angle_bins > 1? 2 * 360. / angle_bins: 180.;
+}
+
+double HoughPreVoter::getScaleTolerance() const
+{
+  return 2 * octaves_per_bin;
+}
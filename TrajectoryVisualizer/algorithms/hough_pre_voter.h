@@ -0,0 +1,80 @@
+#ifndef HOUGH_PRE_VOTER_H
+#define HOUGH_PRE_VOTER_H
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The HoughPreVoter class - cheap filter of matches before geometric
+ * verification. Each match votes its relative rotation and log-scale of key
+ * points into 2D histogram, matches of the dominant bin and its neighbours
+ * are kept. Correct matches agree in rotation and scale, while outliers
+ * are spread over the histogram. Rotation isn't voted if key points have
+ * no orientation (angle -1), scale isn't voted if they have no size.
+ */
+class HoughPreVoter
+{
+ public:
+  /**
+   * @brief The Vote struct - the dominant bin
+   */
+  struct Vote
+  {
+    double angle;       //mean rotation in bin in degrees, NaN if not voted
+    double scale;       //mean scale in bin, NaN if not voted
+    size_t kept_count;  //matches in bin and its neighbours
+  };
+
+  /**
+   * @brief HoughPreVoter
+   * @param angle_bins - count of rotation bins over 360 degrees
+   * @param octaves_per_bin - width of scale bin, log2 of scales ratio
+   * @param min_kept - matches aren't filtered if less would be kept
+   */
+  explicit HoughPreVoter(int angle_bins = 12, double octaves_per_bin = 0.5,
+                         size_t min_kept = 6);
+
+  /**
+   * @brief relativePose - rotation and log2 of scale from query key point
+   *                       to train key point, NaN if unknown
+   */
+  static void relativePose(const cv::KeyPoint &query,
+                           const cv::KeyPoint &train,
+                           float &rotation, float &log_scale);
+
+  /**
+   * @brief vote - O(n) voting
+   * @param rotations - relative rotations of matches in degrees
+   * @param log_scales - log2 of relative scales of matches
+   * @param kept - out mask of kept matches
+   * @param dominant - out the dominant bin
+   * @return false if matches aren't filtered (too few), all are kept then
+   */
+  bool vote(const std::vector<float> &rotations,
+            const std::vector<float> &log_scales,
+            std::vector<char> &kept, Vote &dominant) const;
+
+  /**
+   * @brief getAngleTolerance - max deviation of kept rotation from the
+   *                            centre of the dominant bin in degrees
+   */
+  double getAngleTolerance() const;
+  /**
+   * @brief getScaleTolerance - the same for scale in octaves
+   */
+  double getScaleTolerance() const;
+
+ private:
+  const int angle_bins;
+  const double octaves_per_bin;
+  const size_t min_kept;
+};
+
+}
+
+#endif // HOUGH_PRE_VOTER_H
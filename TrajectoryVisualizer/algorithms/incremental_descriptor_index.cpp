@@ -0,0 +1,252 @@
+#include "incremental_descriptor_index.h"
+
+using namespace algorithmspkg;
+
+IncrementalDescriptorIndex::IncrementalDescriptorIndex(
+                                   IncrementalDescriptorIndex::MatcherPtr prototype,
+                                   int norm_type,
+                                   size_t min_pending_frames,
+                                   double growth_ratio)
+  : prototype(prototype), norm_type(norm_type),
+    min_pending_frames(min_pending_frames), growth_ratio(growth_ratio),
+    is_rebuilding(false)
+{
+  auto empty = std::make_shared<Snapshot>();
+  empty->trained_count = 0;
+  snapshot = empty;
+}
+
+IncrementalDescriptorIndex::~IncrementalDescriptorIndex()
+{
+  waitRebuild();
+}
+
+size_t IncrementalDescriptorIndex::add(const cv::Mat &descriptions)
+{
+  size_t frame_num = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    frame_num = frames.size();
+    frames.push_back(descriptions);
+
+    auto updated = std::make_shared<Snapshot>(*snapshot);
+    updated->pending = buildPending(updated->trained_count);
+    snapshot = updated;
+  }
+
+  startRebuildIfNeeded();
+  return frame_num;
+}
+
+void IncrementalDescriptorIndex::match(const cv::Mat &query_descriptions,
+                                 IncrementalDescriptorIndex::MatchesList &matches) const
+{
+  matches.clear();
+  if (query_descriptions.empty())
+  {
+    return;
+  }
+
+  std::shared_ptr<const Snapshot> current;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current = snapshot;
+  }
+
+  MatchesList trained_matches;
+  if (current->trained && !current->trained->empty())
+  {
+    current->trained->match(query_descriptions, trained_matches);
+  }
+
+  MatchesList pending_matches;
+  if (current->pending && !current->pending->empty())
+  {
+    current->pending->match(query_descriptions, pending_matches);
+    for (auto &match: pending_matches)
+    {
+      match.imgIdx += current->trained_count;
+    }
+  }
+
+  if (pending_matches.empty())
+  {
+    matches.swap(trained_matches);
+    return;
+  }
+  if (trained_matches.empty())
+  {
+    matches.swap(pending_matches);
+    return;
+  }
+
+  //both parts return the best match of each query row (sorted by queryIdx)
+  matches.reserve(trained_matches.size());
+  size_t i = 0, j = 0;
+  while (i < trained_matches.size() && j < pending_matches.size())
+  {
+    const cv::DMatch &left = trained_matches[i];
+    const cv::DMatch &right = pending_matches[j];
+    if (left.queryIdx == right.queryIdx)
+    {
+      matches.push_back(left.distance <= right.distance? left: right);
+      i++;
+      j++;
+    }
+    else if (left.queryIdx < right.queryIdx)
+    {
+      matches.push_back(trained_matches[i++]);
+    }
+    else
+    {
+      matches.push_back(pending_matches[j++]);
+    }
+  }
+  matches.insert(matches.end(), trained_matches.begin() + i,
+                 trained_matches.end());
+  matches.insert(matches.end(), pending_matches.begin() + j,
+                 pending_matches.end());
+}
+
+void IncrementalDescriptorIndex::train()
+{
+  waitRebuild();
+
+  std::vector<cv::Mat> frames_copy;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (snapshot->trained_count == frames.size())
+    {
+      return;
+    }
+    frames_copy = frames;
+  }
+
+  MatcherPtr trained = buildTrained(frames_copy);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto updated = std::make_shared<Snapshot>();
+  updated->trained = trained;
+  updated->trained_count = frames_copy.size();
+  updated->pending = buildPending(updated->trained_count);
+  snapshot = updated;
+}
+
+void IncrementalDescriptorIndex::reset(
+                               const std::vector<cv::Mat> &frames_descriptions,
+                               IncrementalDescriptorIndex::MatcherPtr trained_matcher)
+{
+  waitRebuild();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  frames = frames_descriptions;
+
+  auto updated = std::make_shared<Snapshot>();
+  updated->trained = trained_matcher;
+  updated->trained_count = frames.size();
+  snapshot = updated;
+}
+
+void IncrementalDescriptorIndex::clear()
+{
+  reset(std::vector<cv::Mat>(), MatcherPtr());
+}
+
+size_t IncrementalDescriptorIndex::getFramesCount() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return frames.size();
+}
+
+cv::Mat IncrementalDescriptorIndex::getFrameDescriptions(size_t frame_num) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return frames[frame_num];
+}
+
+std::vector<cv::Mat> IncrementalDescriptorIndex::getAllDescriptions() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return frames;
+}
+
+IncrementalDescriptorIndex::MatcherPtr
+                          IncrementalDescriptorIndex::getTrainedMatcher() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return snapshot->trained;
+}
+
+IncrementalDescriptorIndex::MatcherPtr IncrementalDescriptorIndex::buildTrained(
+                                      const std::vector<cv::Mat> &frames) const
+{
+  MatcherPtr trained = prototype->clone(true);
+  trained->add(frames);
+  trained->train();
+
+  return trained;
+}
+
+IncrementalDescriptorIndex::MatcherPtr
+              IncrementalDescriptorIndex::buildPending(size_t first_frame) const
+{
+  if (first_frame >= frames.size())
+  {
+    return MatcherPtr();
+  }
+
+  //brute force matcher stores only headers of descriptions
+  MatcherPtr pending = cv::makePtr<cv::BFMatcher>(norm_type);
+  pending->add(std::vector<cv::Mat>(frames.begin() + first_frame,
+                                    frames.end()));
+
+  return pending;
+}
+
+void IncrementalDescriptorIndex::startRebuildIfNeeded()
+{
+  if (is_rebuilding)
+  {
+    return;
+  }
+
+  std::vector<cv::Mat> frames_copy;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t pending_count = frames.size() - snapshot->trained_count;
+    if (pending_count < min_pending_frames ||
+        pending_count < growth_ratio * snapshot->trained_count)
+    {
+      return;
+    }
+    frames_copy = frames;
+  }
+
+  if (rebuild_thread.joinable())
+  {
+    rebuild_thread.join();
+  }
+
+  is_rebuilding = true;
+  rebuild_thread = std::thread([this, frames_copy]()
+  {
+    MatcherPtr trained = buildTrained(frames_copy);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto updated = std::make_shared<Snapshot>();
+      updated->trained = trained;
+      updated->trained_count = frames_copy.size();
+      updated->pending = buildPending(updated->trained_count);
+      snapshot = updated;
+    }
+    is_rebuilding = false;
+  });
+}
+
+void IncrementalDescriptorIndex::waitRebuild()
+{
+  if (rebuild_thread.joinable())
+  {
+    rebuild_thread.join();
+  }
+}
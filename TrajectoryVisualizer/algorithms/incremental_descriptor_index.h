@@ -0,0 +1,113 @@
+#ifndef INCREMENTAL_DESCRIPTOR_INDEX_H
+#define INCREMENTAL_DESCRIPTOR_INDEX_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The IncrementalDescriptorIndex class - descriptor index which
+ * accepts frames during queries.
+ * Frames are split into the trained part (matcher cloned from prototype,
+ * e.g. FLANN) and the pending part (brute force over recently added frames).
+ * When pending part grows, the trained part is rebuilt in background thread,
+ * queries are served from the current snapshot meanwhile.
+ * Rebuilds are triggered geometrically, so total rebuild cost is amortized.
+ * match and getters may be called from any thread concurrently with add,
+ * the modifying methods (add, train, reset, clear) are called from one thread.
+ */
+class IncrementalDescriptorIndex
+{
+ public:
+  using MatcherPtr = cv::Ptr<cv::DescriptorMatcher>;
+  using MatchesList = std::vector<cv::DMatch>;
+
+  /**
+   * @brief IncrementalDescriptorIndex
+   * @param prototype - matcher for trained part, cloned with empty train data
+   * @param norm_type - norm for brute force over pending frames
+   * @param min_pending_frames - pending frames count to start rebuild
+   * @param growth_ratio - rebuild starts also only if pending part is not
+   *                       less than growth_ratio * trained part
+   */
+  IncrementalDescriptorIndex(MatcherPtr prototype, int norm_type,
+                             size_t min_pending_frames = 8,
+                             double growth_ratio = 0.25);
+  ~IncrementalDescriptorIndex();
+
+  IncrementalDescriptorIndex(const IncrementalDescriptorIndex&) = delete;
+  IncrementalDescriptorIndex& operator=(const IncrementalDescriptorIndex&)
+                                                                      = delete;
+
+  /**
+   * @brief add - adds frame, descriptions must be alive while index lives
+   * @return frame number (imgIdx of matches)
+   */
+  size_t add(const cv::Mat &descriptions);
+
+  /**
+   * @brief match - the best match for each query description over all frames
+   */
+  void match(const cv::Mat &query_descriptions, MatchesList &matches) const;
+
+  /**
+   * @brief train - synchronously moves all frames to the trained part
+   */
+  void train();
+
+  /**
+   * @brief reset - replaces all frames by already trained matcher
+   * @param frames_descriptions - descriptions of frames in matcher
+   * @param trained_matcher - matcher with added frames_descriptions
+   */
+  void reset(const std::vector<cv::Mat> &frames_descriptions,
+             MatcherPtr trained_matcher);
+
+  void clear();
+
+  size_t getFramesCount() const;
+  cv::Mat getFrameDescriptions(size_t frame_num) const;
+  std::vector<cv::Mat> getAllDescriptions() const;
+
+  /**
+   * @brief getTrainedMatcher - matcher of trained part (see train)
+   */
+  MatcherPtr getTrainedMatcher() const;
+
+ private:
+  struct Snapshot
+  {
+    MatcherPtr trained;          //frames [0, trained_count)
+    size_t trained_count;
+    MatcherPtr pending;          //frames [trained_count, ...)
+  };
+
+  MatcherPtr buildTrained(const std::vector<cv::Mat> &frames) const;
+  MatcherPtr buildPending(size_t first_frame) const;
+
+  void startRebuildIfNeeded();
+  void waitRebuild();
+
+  const MatcherPtr prototype;
+  const int norm_type;
+  const size_t min_pending_frames;
+  const double growth_ratio;
+
+  mutable std::mutex mutex; //guards frames and snapshot
+  std::vector<cv::Mat> frames;
+  std::shared_ptr<const Snapshot> snapshot;
+
+  std::thread rebuild_thread;
+  std::atomic<bool> is_rebuilding;
+};
+
+}
+
+#endif // INCREMENTAL_DESCRIPTOR_INDEX_H
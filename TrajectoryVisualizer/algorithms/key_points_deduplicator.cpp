@@ -0,0 +1,144 @@
+#include "key_points_deduplicator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <unordered_map>
+
+using namespace algorithmspkg;
+
+namespace
+{
+struct PointRef
+{
+  size_t frame_num;
+  size_t kp_num;
+};
+
+uint64_t cellKey(int col, int row)
+{
+  return (uint64_t(uint32_t(col)) << 32) | uint32_t(row);
+}
+}
+
+KeyPointsDeduplicator::KeyPointsDeduplicator(double radius,
+                                             double max_distance,
+                                             int norm_type)
+  : radius(radius), max_distance(max_distance), norm_type(norm_type)
+{
+}
+
+size_t KeyPointsDeduplicator::deduplicate(
+                  const std::vector<KeyPointsList> &frames_key_points,
+                  const std::vector<cv::Mat> &frames_descriptions,
+                  std::vector<std::vector<size_t>> &kept,
+                  std::vector<std::vector<int>> &observations) const
+{
+  kept.assign(frames_key_points.size(), std::vector<size_t>());
+  observations.assign(frames_key_points.size(), std::vector<int>());
+
+  std::vector<PointRef> points;
+  for (size_t frame_num = 0; frame_num < frames_key_points.size();
+       frame_num++)
+  {
+    for (size_t kp_num = 0; kp_num < frames_key_points[frame_num].size();
+         kp_num++)
+    {
+      points.push_back({frame_num, kp_num});
+    }
+  }
+
+  auto keyPointOf = [&frames_key_points](const PointRef &ref)
+                                                      -> const cv::KeyPoint&
+  {
+    return frames_key_points[ref.frame_num][ref.kp_num];
+  };
+  std::stable_sort(points.begin(), points.end(),
+                   [&keyPointOf](const PointRef &left, const PointRef &right)
+                   { return keyPointOf(left).response >
+                            keyPointOf(right).response; });
+
+  //representatives in hash grid with cell size radius, so duplicates
+  //are in the same or neighbour cells
+  const double cell_size = std::max(radius, 1e-6);
+  const double radius_sq = radius * radius;
+  std::unordered_map<uint64_t, std::vector<size_t>> grid;
+  std::vector<PointRef> representatives;
+  std::vector<int> counts;
+
+  for (const PointRef &ref: points)
+  {
+    const cv::Point2f &pt = keyPointOf(ref).pt;
+    const int col = static_cast<int>(std::floor(pt.x / cell_size));
+    const int row = static_cast<int>(std::floor(pt.y / cell_size));
+    const cv::Mat description =
+                          frames_descriptions[ref.frame_num].row(ref.kp_num);
+
+    size_t merged_to = representatives.size();
+    for (int r = row - 1; r <= row + 1 && merged_to == representatives.size();
+         r++)
+    for (int c = col - 1; c <= col + 1 && merged_to == representatives.size();
+         c++)
+    {
+      auto cell = grid.find(cellKey(c, r));
+      if (cell == grid.end())
+      {
+        continue;
+      }
+
+      for (size_t representative: cell->second)
+      {
+        const PointRef &other = representatives[representative];
+        if (other.frame_num == ref.frame_num)
+        {//points of one frame are different features
+          continue;
+        }
+        const cv::Point2f diff = keyPointOf(other).pt - pt;
+        if (diff.x*diff.x + diff.y*diff.y > radius_sq)
+        {
+          continue;
+        }
+        const cv::Mat other_description =
+                        frames_descriptions[other.frame_num].row(other.kp_num);
+        if (cv::norm(description, other_description, norm_type) <=
+            max_distance)
+        {
+          merged_to = representative;
+          break;
+        }
+      }
+    }
+
+    if (merged_to != representatives.size())
+    {
+      counts[merged_to]++;
+    }
+    else
+    {
+      grid[cellKey(col, row)].push_back(representatives.size());
+      representatives.push_back(ref);
+      counts.push_back(1);
+    }
+  }
+
+  //representatives are sorted back to the order of frames
+  std::vector<size_t> order(representatives.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&representatives](size_t left, size_t right)
+            {
+              const PointRef &a = representatives[left];
+              const PointRef &b = representatives[right];
+              return a.frame_num < b.frame_num ||
+                     (a.frame_num == b.frame_num && a.kp_num < b.kp_num);
+            });
+  for (size_t i: order)
+  {
+    const PointRef &ref = representatives[i];
+    kept[ref.frame_num].push_back(ref.kp_num);
+    observations[ref.frame_num].push_back(counts[i]);
+  }
+
+  return representatives.size();
+}
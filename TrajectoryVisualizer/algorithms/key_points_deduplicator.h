@@ -0,0 +1,53 @@
+#ifndef KEY_POINTS_DEDUPLICATOR_H
+#define KEY_POINTS_DEDUPLICATOR_H
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The KeyPointsDeduplicator class - merges observations of the same
+ * ground feature by overlapping frames. Key points (in map units) are
+ * visited from the strongest, a point is merged into the first
+ * representative closer than radius with close enough description,
+ * otherwise it becomes a representative itself.
+ */
+class KeyPointsDeduplicator
+{
+ public:
+  using KeyPointsList = std::vector<cv::KeyPoint>;
+
+  /**
+   * @brief KeyPointsDeduplicator
+   * @param radius - max distance between observations in map units
+   * @param max_distance - max distance between descriptions
+   * @param norm_type - norm of descriptions (e.g. defaultNorm of descriptor)
+   */
+  KeyPointsDeduplicator(double radius, double max_distance, int norm_type);
+
+  /**
+   * @brief deduplicate
+   * @param frames_key_points - key points of frames in map units
+   * @param frames_descriptions - descriptions of key points of frames
+   * @param kept - out indices of representatives in each frame (ascending)
+   * @param observations - out count of merged observations of each kept
+   *                       point (1 if point has no duplicates)
+   * @return count of kept points
+   */
+  size_t deduplicate(const std::vector<KeyPointsList> &frames_key_points,
+                     const std::vector<cv::Mat> &frames_descriptions,
+                     std::vector<std::vector<size_t>> &kept,
+                     std::vector<std::vector<int>> &observations) const;
+
+ private:
+  double radius;
+  double max_distance;
+  int norm_type;
+};
+
+}
+
+#endif // KEY_POINTS_DEDUPLICATOR_H
@@ -0,0 +1,255 @@
+#include "key_points_selector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace algorithmspkg;
+
+namespace
+{
+const int ANMS_ITERATIONS = 16;
+const double ANMS_TOLERANCE = 0.1; //allowed excess of selected points
+const int MAX_GRID_SIDE = 256;
+
+cv::Rect2f getBounds(const KeyPointsSelector::KeyPointsList &key_points)
+{
+  cv::Point2f tl = key_points.front().pt;
+  cv::Point2f br = key_points.front().pt;
+  for (const auto &kp: key_points)
+  {
+    tl.x = std::min(tl.x, kp.pt.x);
+    tl.y = std::min(tl.y, kp.pt.y);
+    br.x = std::max(br.x, kp.pt.x);
+    br.y = std::max(br.y, kp.pt.y);
+  }
+
+  return cv::Rect2f(tl, br);
+}
+}
+
+KeyPointsSelector::KeyPointsSelector(KeyPointsSelector::Method method,
+                                     size_t points_per_cell)
+  : method(method), points_per_cell(std::max<size_t>(points_per_cell, 1))
+{
+}
+
+std::vector<size_t> KeyPointsSelector::select(
+                              const KeyPointsSelector::KeyPointsList &key_points,
+                              size_t count) const
+{
+  if (count == 0 || count >= key_points.size())
+  {
+    std::vector<size_t> all(key_points.size());
+    std::iota(all.begin(), all.end(), 0);
+    return all;
+  }
+
+  switch (method)
+  {
+    case Method::GRID:
+      return selectByGrid(key_points, count);
+    case Method::ANMS:
+      return selectByAnms(key_points, count);
+    default:
+      std::vector<size_t> all(key_points.size());
+      std::iota(all.begin(), all.end(), 0);
+      return selectByResponse(key_points, all, count);
+  }
+}
+
+void KeyPointsSelector::apply(KeyPointsSelector::KeyPointsList &key_points,
+                              size_t count) const
+{
+  if (count == 0 || count >= key_points.size())
+  {
+    return;
+  }
+
+  KeyPointsList selected;
+  for (size_t i: select(key_points, count))
+  {
+    selected.push_back(key_points[i]);
+  }
+  key_points.swap(selected);
+}
+
+void KeyPointsSelector::apply(KeyPointsSelector::KeyPointsList &key_points,
+                              cv::Mat &descriptions, size_t count) const
+{
+  if (count == 0 || count >= key_points.size())
+  {
+    return;
+  }
+
+  KeyPointsList selected;
+  cv::Mat selected_descriptions;
+  for (size_t i: select(key_points, count))
+  {
+    selected.push_back(key_points[i]);
+    selected_descriptions.push_back(descriptions.row(i));
+  }
+  key_points.swap(selected);
+  descriptions = selected_descriptions;
+}
+
+KeyPointsSelector::Method KeyPointsSelector::getMethod() const
+{
+  return method;
+}
+
+std::vector<size_t> KeyPointsSelector::selectByResponse(
+                              const KeyPointsSelector::KeyPointsList &key_points,
+                              std::vector<size_t> indices, size_t count) const
+{
+  auto is_stronger = [&key_points](size_t left, size_t right) -> bool
+  {
+    return key_points[left].response > key_points[right].response;
+  };
+
+  if (count < indices.size())
+  {
+    std::nth_element(indices.begin(), indices.begin() + count, indices.end(),
+                     is_stronger);
+    indices.resize(count);
+  }
+  std::sort(indices.begin(), indices.end(), is_stronger);
+
+  return indices;
+}
+
+std::vector<size_t> KeyPointsSelector::selectByGrid(
+                              const KeyPointsSelector::KeyPointsList &key_points,
+                              size_t count) const
+{
+  const cv::Rect2f bounds = getBounds(key_points);
+  const double width = std::max(bounds.width, 1.f);
+  const double height = std::max(bounds.height, 1.f);
+
+  //cells are nearly square, each is expected to give points_per_cell points
+  const double cells_count = std::max<double>(count / points_per_cell, 1);
+  const int cols = std::min(MAX_GRID_SIDE, std::max(1,
+                       int(std::round(std::sqrt(cells_count*width/height)))));
+  const int rows = std::min(MAX_GRID_SIDE, std::max(1,
+                       int(std::ceil(cells_count / cols))));
+
+  std::vector<std::vector<size_t>> cells(cols * rows);
+  for (size_t i = 0; i < key_points.size(); i++)
+  {
+    const cv::Point2f &pt = key_points[i].pt;
+    int col = std::min(cols - 1, int((pt.x - bounds.x) / width * cols));
+    int row = std::min(rows - 1, int((pt.y - bounds.y) / height * rows));
+    cells[row*cols + col].push_back(i);
+  }
+
+  const size_t quota = (count + cells.size() - 1) / cells.size();
+  std::vector<size_t> chosen, rest;
+  for (auto &cell: cells)
+  {
+    if (cell.size() > quota)
+    {
+      std::nth_element(cell.begin(), cell.begin() + quota, cell.end(),
+                       [&key_points](size_t left, size_t right) -> bool
+                       { return key_points[left].response >
+                                key_points[right].response; });
+      rest.insert(rest.end(), cell.begin() + quota, cell.end());
+      cell.resize(quota);
+    }
+    chosen.insert(chosen.end(), cell.begin(), cell.end());
+  }
+
+  if (chosen.size() < count)
+  {//empty cells left their quota to the strongest of the rest
+    std::vector<size_t> extra = selectByResponse(key_points, rest,
+                                                 count - chosen.size());
+    chosen.insert(chosen.end(), extra.begin(), extra.end());
+  }
+
+  return selectByResponse(key_points, chosen, count);
+}
+
+std::vector<size_t> KeyPointsSelector::selectByAnms(
+                              const KeyPointsSelector::KeyPointsList &key_points,
+                              size_t count) const
+{
+  std::vector<size_t> sorted(key_points.size());
+  std::iota(sorted.begin(), sorted.end(), 0);
+  sorted = selectByResponse(key_points, sorted, sorted.size());
+
+  //binary search of suppression radius giving at least count points
+  const cv::Rect2f bounds = getBounds(key_points);
+  double low = 0;
+  double high = std::sqrt(bounds.width*bounds.width +
+                          bounds.height*bounds.height);
+  std::vector<size_t> best = sorted;
+  for (int iteration = 0; iteration < ANMS_ITERATIONS; iteration++)
+  {
+    const double radius = (low + high) / 2.;
+    std::vector<size_t> selected = suppress(key_points, sorted, bounds, radius);
+    if (selected.size() >= count)
+    {
+      low = radius;
+      best.swap(selected);
+      if (best.size() <= count * (1 + ANMS_TOLERANCE))
+      {
+        break;
+      }
+    }
+    else
+    {
+      high = radius;
+    }
+  }
+
+  //selected points are in order of response
+  best.resize(count);
+  return best;
+}
+
+std::vector<size_t> KeyPointsSelector::suppress(
+                              const KeyPointsSelector::KeyPointsList &key_points,
+                              const std::vector<size_t> &sorted,
+                              const cv::Rect2f &bounds, double radius) const
+{
+  //points closer than radius are in the same or neighbour cells
+  const double diagonal = std::sqrt(bounds.width*bounds.width +
+                                    bounds.height*bounds.height);
+  const double cell_size = std::max(radius, diagonal / MAX_GRID_SIDE + 1e-6);
+  const int cols = int(bounds.width / cell_size) + 1;
+  const int rows = int(bounds.height / cell_size) + 1;
+  const double radius_sq = radius * radius;
+
+  std::vector<std::vector<cv::Point2f>> cells(cols * rows);
+  std::vector<size_t> selected;
+  for (size_t i: sorted)
+  {
+    const cv::Point2f &pt = key_points[i].pt;
+    const int col = int((pt.x - bounds.x) / cell_size);
+    const int row = int((pt.y - bounds.y) / cell_size);
+
+    bool is_suppressed = false;
+    for (int r = std::max(row - 1, 0);
+         r <= std::min(row + 1, rows - 1) && !is_suppressed; r++)
+    for (int c = std::max(col - 1, 0);
+         c <= std::min(col + 1, cols - 1) && !is_suppressed; c++)
+    {
+      for (const auto &other: cells[r*cols + c])
+      {
+        const cv::Point2f diff = other - pt;
+        if (diff.x*diff.x + diff.y*diff.y < radius_sq)
+        {
+          is_suppressed = true;
+          break;
+        }
+      }
+    }
+
+    if (!is_suppressed)
+    {
+      cells[row*cols + col].push_back(pt);
+      selected.push_back(i);
+    }
+  }
+
+  return selected;
+}
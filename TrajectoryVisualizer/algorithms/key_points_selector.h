@@ -0,0 +1,75 @@
+#ifndef KEY_POINTS_SELECTOR_H
+#define KEY_POINTS_SELECTOR_H
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The KeyPointsSelector class - chooses at most count key points of
+ * frame. The strongest points are often clustered on a few textured objects,
+ * so GRID and ANMS keep points spread over the whole frame.
+ */
+class KeyPointsSelector
+{
+ public:
+  using KeyPointsList = std::vector<cv::KeyPoint>;
+
+  enum class Method
+  {
+    RESPONSE, //the strongest points
+    GRID,     //the strongest points of each cell of grid
+    ANMS      //adaptive non-maximal suppression
+  };
+
+  /**
+   * @brief KeyPointsSelector
+   * @param points_per_cell - for GRID, defines count of cells
+   */
+  explicit KeyPointsSelector(Method method = Method::RESPONSE,
+                             size_t points_per_cell = 4);
+
+  /**
+   * @brief select
+   * @param count - max count of points, 0 means all
+   * @return indices of selected points sorted by response descending,
+   *         all indices in original order if count isn't less than size
+   */
+  std::vector<size_t> select(const KeyPointsList &key_points,
+                             size_t count) const;
+
+  /**
+   * @brief apply - keeps only selected key points (and their descriptions)
+   */
+  void apply(KeyPointsList &key_points, size_t count) const;
+  void apply(KeyPointsList &key_points, cv::Mat &descriptions,
+             size_t count) const;
+
+  Method getMethod() const;
+
+ private:
+  std::vector<size_t> selectByResponse(const KeyPointsList &key_points,
+                                       std::vector<size_t> indices,
+                                       size_t count) const;
+  std::vector<size_t> selectByGrid(const KeyPointsList &key_points,
+                                   size_t count) const;
+  std::vector<size_t> selectByAnms(const KeyPointsList &key_points,
+                                   size_t count) const;
+  /**
+   * @brief suppress - greedy selection in order of response, point is
+   *                   rejected if selected point is closer than radius
+   */
+  std::vector<size_t> suppress(const KeyPointsList &key_points,
+                               const std::vector<size_t> &sorted,
+                               const cv::Rect2f &bounds, double radius) const;
+
+  Method method;
+  size_t points_per_cell;
+};
+
+}
+
+#endif // KEY_POINTS_SELECTOR_H
@@ -1,5 +1,7 @@
 #include "local_restorer_by_frame.h"
 
+#include <cmath>
+
 using namespace algorithmspkg;
 
 LocalRestorerByFrame::LocalRestorerByFrame(DetectorPtr detector,
@@ -7,7 +9,8 @@ LocalRestorerByFrame::LocalRestorerByFrame(DetectorPtr detector,
                                            MatcherPtr matcher,
                                            size_t max_key_points_per_frame)
   : RestorerByFrame(detector, descriptor, matcher,
-                         max_key_points_per_frame)
+                         max_key_points_per_frame),
+    max_frames(0), max_distance(0)
 {
   free_place_x = 0;
 }
@@ -16,17 +19,35 @@ void LocalRestorerByFrame::addFrame(const cv::Mat &frame,
                                     const cv::Point2f &pos,
                                     double angle, double scale)
 {
-  addFrame(frame);
+  WindowFrame window_frame;
+  window_frame.image_center = cv::Point2f(frame.cols / 2., frame.rows / 2.);
+  window_frame.local_pos = cv::Point2f(free_place_x + frame.cols / 2.,
+                                       frame.rows / 2.);
+  window_frame.has_pose = true;
+  window_frame.pos = pos;
+  window_frame.angle = angle;
+  window_frame.scale = scale;
+
+  RestorerByFrame::addFrame(frame, window_frame.local_pos, 0, 1);
+  free_place_x += frame.cols;
+
+  pushFrame(window_frame);
 }
 
 void LocalRestorerByFrame::addFrame(const cv::Mat &frame)
 {
-  cv::Point2f pos(free_place_x + frame.rows / 2.,
-                     frame.cols / 2.);
+  cv::Point2f pos(free_place_x + frame.cols / 2.,
+                     frame.rows / 2.);
 
-  RestorerByFrame::addFrame(frame, cv::Point2f(0, 0), 0, 1);
+  RestorerByFrame::addFrame(frame, pos, 0, 1);
 
-  free_place_x += frame.rows;
+  free_place_x += frame.cols;
+
+  WindowFrame window_frame;
+  window_frame.image_center = cv::Point2f(frame.cols / 2., frame.rows / 2.);
+  window_frame.local_pos = pos;
+  window_frame.has_pose = false;
+  pushFrame(window_frame);
 }
 
 void LocalRestorerByFrame::addFrame(const cv::Point2f &image_center,
@@ -35,7 +56,20 @@ void LocalRestorerByFrame::addFrame(const cv::Point2f &image_center,
                                     const cv::Point2f &pos,
                                     double angle, double scale)
 {
-  addFrame(image_center, key_points, descriptions);
+  WindowFrame window_frame;
+  window_frame.image_center = image_center;
+  window_frame.local_pos = cv::Point2f(free_place_x + image_center.x,
+                                       image_center.y);
+  window_frame.has_pose = true;
+  window_frame.pos = pos;
+  window_frame.angle = angle;
+  window_frame.scale = scale;
+
+  RestorerByFrame::addFrame(image_center, key_points, descriptions,
+                            window_frame.local_pos, 0, 1);
+  free_place_x += image_center.x*2;
+
+  pushFrame(window_frame);
 }
 
 void LocalRestorerByFrame::addFrame(const cv::Point2f &image_center,
@@ -45,7 +79,110 @@ void LocalRestorerByFrame::addFrame(const cv::Point2f &image_center,
   cv::Point2f pos(free_place_x + image_center.x,
                      image_center.y);
   RestorerByFrame::addFrame(image_center, key_points, descriptions,
-                            cv::Point2f(0, 0), 0, 1);
+                            pos, 0, 1);
 
   free_place_x += image_center.x*2;
+
+  WindowFrame window_frame;
+  window_frame.image_center = image_center;
+  window_frame.local_pos = pos;
+  window_frame.has_pose = false;
+  pushFrame(window_frame);
+}
+
+void LocalRestorerByFrame::load(std::string filename)
+{
+  RestorerByFrame::load(filename);
+
+  //placement of loaded frames is unknown, they can't go to global map
+  WindowFrame window_frame;
+  window_frame.has_pose = false;
+  window.assign(getFramesCount(), window_frame);
+
+  evictOutOfWindow();
+}
+
+void LocalRestorerByFrame::setWindow(size_t max_frames, double max_distance)
+{
+  this->max_frames = max_frames;
+  this->max_distance = max_distance;
+
+  evictOutOfWindow();
+}
+
+size_t LocalRestorerByFrame::getWindowFrames() const
+{
+  return max_frames;
+}
+
+double LocalRestorerByFrame::getWindowDistance() const
+{
+  return max_distance;
+}
+
+void LocalRestorerByFrame::setGlobalMap(
+                            std::shared_ptr<FeatureBasedRestorer> global_map)
+{
+  this->global_map = global_map;
+}
+
+const std::shared_ptr<FeatureBasedRestorer>&
+                                LocalRestorerByFrame::getGlobalMap() const
+{
+  return global_map;
+}
+
+void LocalRestorerByFrame::pushFrame(const WindowFrame &window_frame)
+{
+  window.push_back(window_frame);
+  evictOutOfWindow();
+}
+
+void LocalRestorerByFrame::evictOutOfWindow()
+{
+  //frames are evicted in order of adding, so the check of the oldest is enough
+  while (window.size() > 1 && isOutOfWindow(window.front()))
+  {
+    evictFirstFrame();
+  }
+}
+
+bool LocalRestorerByFrame::isOutOfWindow(
+                                      const WindowFrame &window_frame) const
+{
+  if (max_frames > 0 && window.size() > max_frames)
+  {
+    return true;
+  }
+
+  const WindowFrame &last = window.back();
+  if (max_distance > 0 && window_frame.has_pose && last.has_pose)
+  {
+    cv::Point2f diff = last.pos - window_frame.pos;
+    return std::hypot(diff.x, diff.y) > max_distance;
+  }
+
+  return false;
+}
+
+void LocalRestorerByFrame::evictFirstFrame()
+{
+  const WindowFrame &window_frame = window.front();
+  if (global_map && window_frame.has_pose)
+  {
+    //key points were only shifted to local_pos, shift them back
+    KeyPointsList key_points = getFrameKeyPoints(0);
+    cv::Point2f shift = window_frame.image_center - window_frame.local_pos;
+    for (cv::KeyPoint &key_point: key_points)
+    {
+      key_point.pt += shift;
+    }
+
+    global_map->addFrame(window_frame.image_center, key_points,
+                         getFrameDescriptions(0), window_frame.pos,
+                         window_frame.angle, window_frame.scale);
+  }
+
+  removeFirstFrame();
+  window.pop_front();
 }
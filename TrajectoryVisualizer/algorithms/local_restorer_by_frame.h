@@ -1,10 +1,19 @@
 #ifndef LOCALRESTORERBYFRAME_H
 #define LOCALRESTORERBYFRAME_H
 
+#include <deque>
+#include <memory>
+
 #include "algorithms/restorer_by_frame.h"
 
 namespace algorithmspkg {
 
+/**
+ * @brief The LocalRestorerByFrame class - frames are placed side by side in
+ * local coordinates instead of their poses. In sliding window mode (see
+ * setWindow) only the last frames are kept, so memory and cost of queries
+ * don't grow over long flights.
+ */
 class LocalRestorerByFrame : public RestorerByFrame
 {
 public:
@@ -25,8 +34,56 @@ public:
   void addFrame(const cv::Point2f &image_center,
                 const KeyPointsList &key_points, const cv::Mat &descriptions);
 
+  /**
+   * @brief load - replaces all frames, loaded frames have no pose
+   */
+  void load(std::string filename) override;
+
+  /**
+   * @brief setWindow - the oldest frames out of window are evicted in O(1)
+   * @param max_frames - max count of frames, 0 is unbounded
+   * @param max_distance - max distance of frame from the last one in
+   *                       preffered units, 0 is unbounded. Measured between
+   *                       poses passed to addFrame, frames without pose
+   *                       aren't evicted by distance
+   */
+  void setWindow(size_t max_frames, double max_distance = 0);
+  size_t getWindowFrames() const;
+  double getWindowDistance() const;
+
+  /**
+   * @brief setGlobalMap - evicted frames with pose are added to global_map,
+   *                       nullptr disables it
+   */
+  void setGlobalMap(std::shared_ptr<FeatureBasedRestorer> global_map);
+  const std::shared_ptr<FeatureBasedRestorer>& getGlobalMap() const;
+
 private:
+  /**
+   * @brief The WindowFrame struct - placement and pose of kept frame
+   */
+  struct WindowFrame
+  {
+    cv::Point2f image_center;
+    cv::Point2f local_pos;  //center of frame in local coordinates
+    bool        has_pose;
+    cv::Point2f pos;        //pose passed to addFrame
+    double      angle;
+    double      scale;
+  };
+
+  void pushFrame(const WindowFrame &window_frame);
+  void evictOutOfWindow();
+  bool isOutOfWindow(const WindowFrame &window_frame) const;
+  void evictFirstFrame();
+
   double free_place_x;
+
+  size_t max_frames;
+  double max_distance;
+  std::deque<WindowFrame> window; //for each frame
+
+  std::shared_ptr<FeatureBasedRestorer> global_map;
 };
 
 
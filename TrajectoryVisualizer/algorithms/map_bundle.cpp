@@ -0,0 +1,345 @@
+#include "map_bundle.h"
+
+#include <cstring>
+#include <fstream>
+
+using namespace algorithmspkg;
+
+namespace
+{
+const char MAGIC[8] = {'T', 'V', 'M', 'A', 'P', 'B', 'N', 'D'};
+
+void alignStream(std::ofstream &out, size_t alignment)
+{
+  static const char zeros[64] = {0};
+  size_t pos = out.tellp();
+  size_t padding = (alignment - pos % alignment) % alignment;
+  out.write(zeros, padding);
+}
+}
+
+void MapBundle::write(const std::string &filename, MapBundle::Kind kind,
+                      const std::vector<KeyPointsList> &frames_key_points,
+                      const std::vector<cv::Mat> &frames_descriptions,
+                      const std::vector<FramePolygon> &polygons,
+                      const std::vector<double> &areas,
+                      bool has_index, const Source &source)
+{
+  if (frames_key_points.size() != frames_descriptions.size())
+  {
+    throw Exception("key points and descriptions of different frames count");
+  }
+  const bool has_polygons = !polygons.empty();
+
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+  {
+    throw Exception("Cannot open file: " + filename);
+  }
+
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.kind = kind;
+  header.frames_count = frames_key_points.size();
+  header.key_point_size = sizeof(cv::KeyPoint);
+  header.byte_order = BYTE_ORDER_MARK;
+  header.source_frames_count = source.frames_count;
+  header.source_checksum = source.checksum;
+  header.flags = (has_polygons? uint32_t(HAS_POLYGONS): 0u) |
+                 (has_index? uint32_t(HAS_INDEX): 0u);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::vector<FrameRecord> table(frames_key_points.size());
+  for (size_t frame_num = 0; frame_num < table.size(); frame_num++)
+  {
+    FrameRecord &record = table[frame_num];
+    std::memset(&record, 0, sizeof(record));
+
+    const auto &key_points = frames_key_points[frame_num];
+    alignStream(out, ALIGNMENT);
+    record.key_points_offset = out.tellp();
+    record.key_points_count = key_points.size();
+    out.write(reinterpret_cast<const char*>(key_points.data()),
+              key_points.size() * sizeof(cv::KeyPoint));
+    record.key_points_checksum = calculateChecksum(
+                              reinterpret_cast<const char*>(key_points.data()),
+                              key_points.size() * sizeof(cv::KeyPoint));
+
+    //rows of submatrix aren't contiguous
+    const cv::Mat &frame_descriptions = frames_descriptions[frame_num];
+    const cv::Mat descriptions = frame_descriptions.isContinuous()?
+                                 frame_descriptions: frame_descriptions.clone();
+    const size_t descriptions_size = descriptions.total() *
+                                     descriptions.elemSize();
+    alignStream(out, ALIGNMENT);
+    record.descriptions_offset = out.tellp();
+    record.rows = descriptions.rows;
+    record.cols = descriptions.cols;
+    record.type = descriptions.type();
+    out.write(reinterpret_cast<const char*>(descriptions.data),
+              descriptions_size);
+    record.descriptions_checksum = calculateChecksum(
+                              reinterpret_cast<const char*>(descriptions.data),
+                              descriptions_size);
+
+    if (has_polygons)
+    {
+      for (size_t i = 0; i < 4; i++)
+      {
+        record.polygon[2*i] = polygons[frame_num][i].x;
+        record.polygon[2*i + 1] = polygons[frame_num][i].y;
+      }
+      record.area = areas[frame_num];
+    }
+  }
+
+  alignStream(out, ALIGNMENT);
+  header.table_offset = out.tellp();
+  out.write(reinterpret_cast<const char*>(table.data()),
+            table.size() * sizeof(FrameRecord));
+  header.table_checksum = calculateChecksum(
+                                  reinterpret_cast<const char*>(table.data()),
+                                  table.size() * sizeof(FrameRecord));
+
+  //arrays are read back, so failed writes are found now instead of reading
+  out.flush();
+  if (!out)
+  {
+    throw Exception("Cannot write file: " + filename);
+  }
+  {
+    utils::MappedFile written(filename);
+    for (const FrameRecord &record: table)
+    {
+      checkArray(written, record.key_points_offset,
+                 record.key_points_count * sizeof(cv::KeyPoint),
+                 record.key_points_checksum);
+      checkArray(written, record.descriptions_offset,
+                 uint64_t(record.rows) * record.cols *
+                 CV_ELEM_SIZE(record.type),
+                 record.descriptions_checksum);
+    }
+    header.data_checksum = calculateChecksum(written.data() + sizeof(Header),
+                                          header.table_offset - sizeof(Header));
+  }
+
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  if (!out)
+  {
+    throw Exception("Cannot write file: " + filename);
+  }
+}
+
+MapBundle::MapBundle(const std::string &filename)
+  : file(std::make_shared<utils::MappedFile>(filename)),
+    header(nullptr), table(nullptr)
+{
+  if (file->size() < sizeof(Header))
+  {
+    throw Exception("File is too small: " + filename);
+  }
+
+  header = reinterpret_cast<const Header*>(file->data());
+  if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0)
+  {
+    throw Exception("Not a map bundle: " + filename);
+  }
+  if (header->version != VERSION)
+  {
+    throw Exception("Unsupported version " + std::to_string(header->version) +
+                    " of " + filename);
+  }
+  if (header->byte_order != BYTE_ORDER_MARK)
+  {
+    throw Exception("Incompatible byte order of " + filename);
+  }
+  if (header->key_point_size != sizeof(cv::KeyPoint))
+  {
+    throw Exception("Incompatible key point layout in " + filename);
+  }
+
+  checkRange(header->table_offset, header->frames_count * sizeof(FrameRecord));
+  table = reinterpret_cast<const FrameRecord*>(file->data() +
+                                               header->table_offset);
+  if (calculateChecksum(reinterpret_cast<const char*>(table),
+                        header->frames_count * sizeof(FrameRecord)) !=
+      header->table_checksum)
+  {
+    throw Exception("Corrupted offset table of " + filename);
+  }
+}
+
+MapBundle::Kind MapBundle::getKind() const
+{
+  return static_cast<Kind>(header->kind);
+}
+
+size_t MapBundle::getFramesCount() const
+{
+  return header->frames_count;
+}
+
+bool MapBundle::hasPolygons() const
+{
+  return header->flags & HAS_POLYGONS;
+}
+
+bool MapBundle::hasIndex() const
+{
+  return header->flags & HAS_INDEX;
+}
+
+MapBundle::Source MapBundle::getSource() const
+{
+  Source source;
+  source.frames_count = header->source_frames_count;
+  source.checksum = header->source_checksum;
+
+  return source;
+}
+
+bool MapBundle::verifyChecksum() const
+{
+  if (header->table_offset < sizeof(Header))
+  {
+    return false;
+  }
+
+  return calculateChecksum(file->data() + sizeof(Header),
+                           header->table_offset - sizeof(Header)) ==
+         header->data_checksum;
+}
+
+MapBundle::KeyPointsList MapBundle::getKeyPoints(size_t frame_num) const
+{
+  const FrameRecord &record = getRecord(frame_num);
+  checkArray(*file, record.key_points_offset,
+             record.key_points_count * sizeof(cv::KeyPoint),
+             record.key_points_checksum);
+
+  const cv::KeyPoint *begin = reinterpret_cast<const cv::KeyPoint*>(
+                                   file->data() + record.key_points_offset);
+
+  return KeyPointsList(begin, begin + record.key_points_count);
+}
+
+cv::Mat MapBundle::getDescriptions(size_t frame_num) const
+{
+  const FrameRecord &record = getRecord(frame_num);
+  if (record.rows == 0)
+  {
+    return cv::Mat();
+  }
+
+  checkArray(*file, record.descriptions_offset,
+             uint64_t(record.rows) * record.cols * CV_ELEM_SIZE(record.type),
+             record.descriptions_checksum);
+  cv::Mat view(record.rows, record.cols, record.type,
+               const_cast<char*>(file->data() + record.descriptions_offset));
+
+  return view;
+}
+
+MapBundle::FramePolygon MapBundle::getPolygon(size_t frame_num) const
+{
+  const FrameRecord &record = getRecord(frame_num);
+
+  FramePolygon polygon(4);
+  for (size_t i = 0; i < 4; i++)
+  {
+    polygon[i] = cv::Point2f(record.polygon[2*i], record.polygon[2*i + 1]);
+  }
+
+  return polygon;
+}
+
+double MapBundle::getArea(size_t frame_num) const
+{
+  return getRecord(frame_num).area;
+}
+
+const MapBundle::FrameRecord& MapBundle::getRecord(size_t frame_num) const
+{
+  if (frame_num >= header->frames_count)
+  {
+    throw Exception("Frame number out of range");
+  }
+
+  return table[frame_num];
+}
+
+void MapBundle::checkRange(uint64_t offset, uint64_t size) const
+{
+  if (offset > file->size() || size > file->size() - offset)
+  {
+    throw Exception("Corrupted file, data out of range");
+  }
+}
+
+MapBundle::Source MapBundle::makeSource(
+                          const std::vector<KeyPointsList> &frames_key_points,
+                          const std::vector<cv::Mat> &frames_descriptions)
+{
+  //checksums of arrays of each frame are hashed together
+  std::vector<uint64_t> checksums;
+  for (const KeyPointsList &key_points: frames_key_points)
+  {
+    checksums.push_back(calculateChecksum(
+                            reinterpret_cast<const char*>(key_points.data()),
+                            key_points.size() * sizeof(cv::KeyPoint)));
+  }
+  for (const cv::Mat &frame_descriptions: frames_descriptions)
+  {
+    const cv::Mat descriptions = frame_descriptions.isContinuous()?
+                                 frame_descriptions: frame_descriptions.clone();
+    checksums.push_back(calculateChecksum(
+                            reinterpret_cast<const char*>(descriptions.data),
+                            descriptions.total() * descriptions.elemSize()));
+  }
+
+  Source source;
+  source.frames_count = frames_key_points.size();
+  source.checksum = calculateChecksum(
+                              reinterpret_cast<const char*>(checksums.data()),
+                              checksums.size() * sizeof(uint64_t));
+
+  return source;
+}
+
+void MapBundle::checkArray(const utils::MappedFile &file, uint64_t offset,
+                           uint64_t size, uint64_t checksum)
+{
+  if (offset > file.size() || size > file.size() - offset)
+  {
+    throw Exception("Corrupted file, data out of range");
+  }
+  if (calculateChecksum(file.data() + offset, size) != checksum)
+  {
+    throw Exception("Corrupted file, checksum mismatch of frame arrays");
+  }
+}
+
+uint64_t MapBundle::calculateChecksum(const char *data, size_t size)
+{
+  //FNV-1a over 8 bytes words, tail is hashed by bytes
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  size_t pos = 0;
+  for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t))
+  {
+    uint64_t word;
+    std::memcpy(&word, data + pos, sizeof(word));
+    hash = (hash ^ word) * prime;
+  }
+  for (; pos < size; pos++)
+  {
+    hash = (hash ^ static_cast<unsigned char>(data[pos])) * prime;
+  }
+
+  return hash;
+}
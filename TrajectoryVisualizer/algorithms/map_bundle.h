@@ -0,0 +1,169 @@
+#ifndef MAP_BUNDLE_H
+#define MAP_BUNDLE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <opencv2/features2d.hpp>
+
+#include "utils/mapped_file.h"
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The MapBundle class - versioned binary container of restorer's map
+ * or of features of trajectory. Holds key points, descriptions and optional
+ * footprints of each frame. Arrays are 64 bytes aligned, so the bundle is read
+ * through mmap and descriptions are returned without copying (views live while
+ * bundle lives). Data is written in native byte order, which is checked on
+ * reading. The offset table is verified by checksum on opening, arrays of
+ * each frame are verified by their checksums when the frame is read.
+ */
+class MapBundle
+{
+ public:
+  using KeyPointsList = std::vector<cv::KeyPoint>;
+  using FramePolygon = std::vector<cv::Point2f>;
+
+  enum Kind : uint32_t
+  {
+    BY_FRAME = 1,
+    BY_CLOUD = 2,
+    TRAJECTORY = 3 //key points in image coordinates
+  };
+
+  static const uint32_t VERSION = 4;
+
+  /**
+   * @brief The Source struct - identifies features which map was built of,
+   * so outdated map can be found
+   */
+  struct Source
+  {
+    Source(): frames_count(0), checksum(0) {}
+
+    uint64_t frames_count;
+    uint64_t checksum;
+
+    bool operator==(const Source &other) const
+    {
+      return frames_count == other.frames_count && checksum == other.checksum;
+    }
+    bool operator!=(const Source &other) const { return !(*this == other); }
+  };
+
+  /**
+   * @brief makeSource - reads all key points and descriptions
+   */
+  static Source makeSource(const std::vector<KeyPointsList> &frames_key_points,
+                           const std::vector<cv::Mat> &frames_descriptions);
+
+  /**
+   * @brief write - written arrays are read back and verified
+   * @param polygons - footprints of frames (4 points) or empty
+   * @param areas - areas of footprints or empty
+   * @param has_index - matcher index was saved beside the bundle
+   * @param source - features which map was built of
+   */
+  static void write(const std::string &filename, Kind kind,
+                    const std::vector<KeyPointsList> &frames_key_points,
+                    const std::vector<cv::Mat> &frames_descriptions,
+                    const std::vector<FramePolygon> &polygons,
+                    const std::vector<double> &areas,
+                    bool has_index = false,
+                    const Source &source = Source());
+
+  explicit MapBundle(const std::string &filename);
+
+  Kind   getKind() const;
+  size_t getFramesCount() const;
+  bool   hasPolygons() const;
+  bool   hasIndex() const;
+  Source getSource() const;
+
+  /**
+   * @brief verifyChecksum - reads all arrays, so it isn't done on opening
+   * @return false if arrays are corrupted
+   */
+  bool verifyChecksum() const;
+
+  /**
+   * @throw Exception if arrays of frame don't match their checksums
+   */
+  KeyPointsList getKeyPoints(size_t frame_num) const;
+  cv::Mat       getDescriptions(size_t frame_num) const; //view, no copy
+  FramePolygon  getPolygon(size_t frame_num) const;
+  double        getArea(size_t frame_num) const;
+
+  class Exception: public std::runtime_error
+  {
+  public:
+    Exception(const std::string &what):
+      std::runtime_error("MapBundle: " + what)
+    {}
+  };
+
+ private:
+  struct Header
+  {
+    char     magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t frames_count;
+    uint32_t key_point_size;
+    uint32_t flags;
+    uint64_t table_offset;
+    uint32_t byte_order;     //BYTE_ORDER_MARK in byte order of writer
+    uint32_t reserved;
+    uint64_t table_checksum;
+    uint64_t data_checksum;  //of bytes between header and table
+    uint64_t source_frames_count;
+    uint64_t source_checksum;
+  };
+
+  struct FrameRecord
+  {
+    uint64_t key_points_offset;
+    uint64_t key_points_count;
+    uint64_t descriptions_offset;
+    int32_t  rows;
+    int32_t  cols;
+    int32_t  type;
+    int32_t  reserved;
+    float    polygon[8];
+    double   area;
+    uint64_t key_points_checksum;
+    uint64_t descriptions_checksum;
+  };
+
+  enum Flags : uint32_t
+  {
+    HAS_POLYGONS = 1,
+    HAS_INDEX = 2
+  };
+
+  static const size_t ALIGNMENT = 64;
+  static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+  static uint64_t calculateChecksum(const char *data, size_t size);
+
+  const FrameRecord& getRecord(size_t frame_num) const;
+  void checkRange(uint64_t offset, uint64_t size) const;
+  /**
+   * @brief checkArray - range and checksum of array of frame
+   */
+  static void checkArray(const utils::MappedFile &file, uint64_t offset,
+                         uint64_t size, uint64_t checksum);
+
+  std::shared_ptr<utils::MappedFile> file;
+  const Header *header;
+  const FrameRecord *table;
+};
+
+}
+
+#endif // MAP_BUNDLE_H
@@ -0,0 +1,176 @@
+#include "matcher_self_check.h"
+
+#include <algorithm>
+
+using namespace algorithmspkg;
+
+namespace
+{
+bool isLess(const cv::DMatch &left, const cv::DMatch &right)
+{
+  if (left.distance != right.distance)
+  {
+    return left.distance < right.distance;
+  }
+  if (left.imgIdx != right.imgIdx)
+  {
+    return left.imgIdx < right.imgIdx;
+  }
+  return left.trainIdx < right.trainIdx;
+}
+
+bool isSameRow(const cv::DMatch &left, const cv::DMatch &right)
+{
+  return left.imgIdx == right.imgIdx && left.trainIdx == right.trainIdx;
+}
+}
+
+cv::Mat MatcherSelfCheck::makeRandom(cv::RNG &rng, int rows, int bytes)
+{
+  cv::Mat result(rows, bytes, CV_8U);
+  rng.fill(result, cv::RNG::UNIFORM, 0, 256);
+  return result;
+}
+
+cv::Mat MatcherSelfCheck::makeNear(cv::RNG &rng, const cv::Mat &base, int rows,
+                                   int max_bits)
+{
+  cv::Mat result(rows, base.cols, CV_8U);
+  for (int row = 0; row < rows; row++)
+  {
+    base.row(rng.uniform(0, base.rows)).copyTo(result.row(row));
+    const int flipped_bits = rng.uniform(0, max_bits + 1);
+    for (int i = 0; i < flipped_bits; i++)
+    {
+      flipBit(result, row, rng.uniform(0, base.cols * 8));
+    }
+  }
+  return result;
+}
+
+void MatcherSelfCheck::flipBit(cv::Mat &rows, int row, int bit)
+{
+  rows.ptr<uchar>(row)[bit / 8] ^= uchar(1 << (bit % 8));
+}
+
+void MatcherSelfCheck::compare(const std::string &name,
+                               cv::DescriptorMatcher &matcher,
+                               const cv::Mat &query,
+                               const std::vector<int> &ks,
+                               const std::vector<float> &radii)
+{
+  const std::vector<cv::Mat> train = matcher.getTrainDescriptors();
+
+  //brute force doesn't accept empty images, so they are skipped and
+  //numbers of images are restored in its matches
+  std::vector<cv::Mat> reference_train;
+  std::vector<int> reference_images;
+  for (size_t img_idx = 0; img_idx < train.size(); img_idx++)
+  {
+    if (!train[img_idx].empty())
+    {
+      reference_train.push_back(train[img_idx]);
+      reference_images.push_back(static_cast<int>(img_idx));
+    }
+  }
+  cv::BFMatcher reference(cv::NORM_HAMMING);
+  reference.add(reference_train);
+  auto restoreImages = [&reference_images](
+                              std::vector<std::vector<cv::DMatch>> &matches)
+  {
+    for (auto &query_matches: matches)
+    for (cv::DMatch &match: query_matches)
+    {
+      match.imgIdx = reference_images[match.imgIdx];
+    }
+  };
+
+  for (int k: ks)
+  {
+    std::vector<std::vector<cv::DMatch>> checked, expected;
+    matcher.knnMatch(query, checked, k);
+    reference.knnMatch(query, expected, k);
+    restoreImages(expected);
+    compareMatches(name + " knnMatch k=" + std::to_string(k), train, query,
+                   checked, expected);
+  }
+
+  for (float radius: radii)
+  {
+    std::vector<std::vector<cv::DMatch>> checked, expected;
+    matcher.radiusMatch(query, checked, radius);
+    reference.radiusMatch(query, expected, radius);
+    restoreImages(expected);
+    compareMatches(name + " radiusMatch " + std::to_string(radius), train,
+                   query, checked, expected);
+
+    //all rows within radius are found, so they are the same
+    for (size_t query_idx = 0; query_idx < checked.size(); query_idx++)
+    {
+      if (!std::equal(checked[query_idx].begin(), checked[query_idx].end(),
+                      expected[query_idx].begin(), isSameRow))
+      {
+        throw Exception(name + " radiusMatch " + std::to_string(radius) +
+                        ": rows of query " + std::to_string(query_idx) +
+                        " differ");
+      }
+    }
+  }
+}
+
+void MatcherSelfCheck::compareMatches(const std::string &name,
+                             const std::vector<cv::Mat> &train,
+                             const cv::Mat &query,
+                             std::vector<std::vector<cv::DMatch>> &checked,
+                             std::vector<std::vector<cv::DMatch>> &expected)
+{
+  if (checked.size() != expected.size())
+  {
+    throw Exception(name + ": count of queries differs");
+  }
+
+  for (size_t query_idx = 0; query_idx < checked.size(); query_idx++)
+  {
+    const std::string where = name + ", query " + std::to_string(query_idx);
+    auto &query_checked = checked[query_idx];
+    auto &query_expected = expected[query_idx];
+    if (query_checked.size() != query_expected.size())
+    {
+      throw Exception(where + ": " + std::to_string(query_checked.size()) +
+                      " matches instead of " +
+                      std::to_string(query_expected.size()));
+    }
+
+    //neighbours of equal distance may be chosen in other order
+    std::sort(query_checked.begin(), query_checked.end(), isLess);
+    std::sort(query_expected.begin(), query_expected.end(), isLess);
+    for (size_t rank = 0; rank < query_checked.size(); rank++)
+    {
+      const cv::DMatch &match = query_checked[rank];
+      if (match.distance != query_expected[rank].distance)
+      {
+        throw Exception(where + ": distance " +
+                        std::to_string(match.distance) + " instead of " +
+                        std::to_string(query_expected[rank].distance));
+      }
+      if (match.queryIdx != static_cast<int>(query_idx) ||
+          match.imgIdx < 0 || match.imgIdx >= static_cast<int>(train.size()) ||
+          match.trainIdx < 0 || match.trainIdx >= train[match.imgIdx].rows)
+      {
+        throw Exception(where + ": match out of range");
+      }
+      if (rank > 0 && isSameRow(match, query_checked[rank - 1]))
+      {
+        throw Exception(where + ": row is matched twice");
+      }
+      const double distance = cv::norm(query.row(query_idx),
+                                       train[match.imgIdx].row(match.trainIdx),
+                                       cv::NORM_HAMMING);
+      if (match.distance != static_cast<float>(distance))
+      {
+        throw Exception(where + ": distance of matched row is " +
+                        std::to_string(distance));
+      }
+    }
+  }
+}
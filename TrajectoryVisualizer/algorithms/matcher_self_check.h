@@ -0,0 +1,63 @@
+#ifndef MATCHER_SELF_CHECK_H
+#define MATCHER_SELF_CHECK_H
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The MatcherSelfCheck class - compares exact matchers of binary
+ * descriptors (HammingMatcher, MultiIndexHashingMatcher) with
+ * cv::BFMatcher(NORM_HAMMING) on random descriptors. Their SIMD kernels and
+ * search bounds are checked by `TrajectoryVisualizer --self-check`
+ */
+class MatcherSelfCheck
+{
+ public:
+  /**
+   * @brief makeRandom - rows of uniformly random bytes, CV_8U
+   */
+  static cv::Mat makeRandom(cv::RNG &rng, int rows, int bytes);
+  /**
+   * @brief makeNear - random rows of base with at most max_bits bits flipped
+   */
+  static cv::Mat makeNear(cv::RNG &rng, const cv::Mat &base, int rows,
+                          int max_bits);
+  static void flipBit(cv::Mat &rows, int row, int bit);
+
+  /**
+   * @brief compare - compares knnMatch for each of ks and radiusMatch for
+   * each of radii with brute force over the same train descriptors (images
+   * may be empty). Neighbours of equal distance may be reported in any order
+   * @param matcher - with added (or trained) train descriptors
+   * @throw Exception with the name and the first difference
+   */
+  static void compare(const std::string &name, cv::DescriptorMatcher &matcher,
+                      const cv::Mat &query, const std::vector<int> &ks,
+                      const std::vector<float> &radii);
+
+  class Exception: public std::runtime_error
+  {
+  public:
+    Exception(const std::string &what):
+      std::runtime_error("MatcherSelfCheck: " + what)
+    {}
+  };
+
+ private:
+  static void compareMatches(const std::string &name,
+                             const std::vector<cv::Mat> &train,
+                             const cv::Mat &query,
+                             std::vector<std::vector<cv::DMatch>> &checked,
+                             std::vector<std::vector<cv::DMatch>> &expected);
+};
+
+}
+
+#endif // MATCHER_SELF_CHECK_H
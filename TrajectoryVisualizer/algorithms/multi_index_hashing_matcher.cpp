@@ -0,0 +1,719 @@
+#include "multi_index_hashing_matcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "algorithms/matcher_self_check.h"
+#include "utils/parallel_for.h"
+
+using namespace algorithmspkg;
+
+namespace
+{
+const char MAGIC[8] = {'T', 'V', 'M', 'I', 'H', 'I', 'D', 'X'};
+const uint32_t VERSION = 1;
+const int ROW_ALIGNMENT = 32;
+const int SCAN_BLOCK = 2048;
+const int MAX_SUBSTRING_BITS = 24;
+//random accesses of probing are slower than sequential brute force scan,
+//costs are relative to distance to a row of the scan
+const double BUCKET_COST = 8;
+const double CANDIDATE_COST = 32;
+
+struct IndexHeader
+{
+  char      magic[8];
+  uint32_t  version;
+  int32_t   descriptor_size;
+  int32_t   substring_bits;
+  int32_t   substrings_count;
+  int32_t   rows;
+};
+
+template <class T>
+void writeVector(std::ofstream &out, const std::vector<T> &values)
+{
+  uint64_t size = values.size();
+  out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  out.write(reinterpret_cast<const char*>(values.data()),
+            size * sizeof(T));
+}
+
+template <class T>
+void readVector(std::ifstream &in, std::vector<T> &values)
+{
+  uint64_t size = 0;
+  in.read(reinterpret_cast<char*>(&size), sizeof(size));
+  values.resize(size);
+  in.read(reinterpret_cast<char*>(values.data()), size * sizeof(T));
+}
+
+double binomial(int n, int k)
+{
+  double result = 1;
+  for (int i = 1; i <= k; i++)
+  {
+    result = result * (n - k + i) / i;
+  }
+  return result;
+}
+
+/**
+ * @brief insertNeighbour - keeps k nearest sorted by distance
+ */
+inline void insertNeighbour(std::vector<std::pair<int, int>> &nearest, size_t k,
+                     const std::pair<int, int> &neighbour)
+{
+  if (nearest.size() == k && !(neighbour < nearest.back()))
+  {
+    return;
+  }
+  nearest.insert(std::upper_bound(nearest.begin(), nearest.end(), neighbour),
+                 neighbour);
+  if (nearest.size() > k)
+  {
+    nearest.pop_back();
+  }
+}
+}
+
+MultiIndexHashingMatcher::MultiIndexHashingMatcher(int substring_bits)
+  : substring_bits(std::min(std::max(substring_bits, 1), MAX_SUBSTRING_BITS)),
+    distances_kernel(HammingMatcher::getDistancesKernel()),
+    descriptor_size(0), stride(0), substrings_count(0)
+{
+}
+
+bool MultiIndexHashingMatcher::isMaskSupported() const
+{
+  return false;
+}
+
+cv::Ptr<cv::DescriptorMatcher> MultiIndexHashingMatcher::clone(
+                                                  bool emptyTrainData) const
+{
+  auto matcher = cv::makePtr<MultiIndexHashingMatcher>(substring_bits);
+  if (!emptyTrainData)
+  {
+    matcher->trainDescCollection = trainDescCollection;
+    matcher->descriptor_size = descriptor_size;
+    matcher->stride = stride;
+    matcher->substrings_count = substrings_count;
+    matcher->codes = codes.clone();
+    matcher->images_starts = images_starts;
+    matcher->tables = tables;
+  }
+
+  return matcher;
+}
+
+void MultiIndexHashingMatcher::clear()
+{
+  cv::DescriptorMatcher::clear();
+  descriptor_size = 0;
+  stride = 0;
+  substrings_count = 0;
+  codes.release();
+  images_starts.clear();
+  tables.clear();
+}
+
+void MultiIndexHashingMatcher::train()
+{
+  if (images_starts.size() == trainDescCollection.size())
+  {
+    return;
+  }
+
+  copyCodes();
+  buildTables();
+}
+
+int MultiIndexHashingMatcher::getSubstringBits() const
+{
+  return substring_bits;
+}
+
+int MultiIndexHashingMatcher::getSubstringsCount() const
+{
+  return substrings_count;
+}
+
+void MultiIndexHashingMatcher::writeIndex(const std::string &filename) const
+{
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+  {
+    throw Exception("Cannot open file: " + filename);
+  }
+
+  IndexHeader header;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.descriptor_size = descriptor_size;
+  header.substring_bits = substring_bits;
+  header.substrings_count = substrings_count;
+  header.rows = codes.rows;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  for (const Table &table: tables)
+  {
+    writeVector(out, table.offsets);
+    writeVector(out, table.ids);
+  }
+
+  if (!out)
+  {
+    throw Exception("Cannot write file: " + filename);
+  }
+}
+
+void MultiIndexHashingMatcher::readIndex(const std::string &filename)
+{
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+  {
+    throw Exception("Cannot open file: " + filename);
+  }
+
+  IndexHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!in || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION)
+  {
+    throw Exception("Not an index of supported version: " + filename);
+  }
+
+  copyCodes();
+  if (header.descriptor_size != descriptor_size ||
+      header.substring_bits != substring_bits ||
+      header.substrings_count != substrings_count ||
+      header.rows != codes.rows)
+  {
+    throw Exception("Index doesn't match descriptors: " + filename);
+  }
+
+  tables.assign(substrings_count, Table());
+  for (int substring = 0; substring < substrings_count; substring++)
+  {
+    Table &table = tables[substring];
+    readVector(in, table.offsets);
+    readVector(in, table.ids);
+    if (table.offsets.size() != (size_t(1) << substringLength(substring)) + 1 ||
+        table.ids.size() != static_cast<size_t>(codes.rows))
+    {
+      tables.clear();
+      throw Exception("Corrupted index: " + filename);
+    }
+  }
+  if (!in)
+  {
+    tables.clear();
+    throw Exception("Cannot read file: " + filename);
+  }
+}
+
+void MultiIndexHashingMatcher::selfCheck()
+{
+  cv::RNG rng(42);
+  for (int bytes: {32, 64})
+  for (int substring_bits: {8, 12, 16, 20})
+  {
+    //clustered train rows are found by probing with small radius, random
+    //queries make probing more expensive than brute force
+    std::vector<cv::Mat> train = {MatcherSelfCheck::makeRandom(rng, 64, bytes),
+                                  cv::Mat()};
+    train.push_back(MatcherSelfCheck::makeNear(rng, train[0], 3000, 6));
+    train.push_back(MatcherSelfCheck::makeRandom(rng, 500, bytes));
+
+    //a row differing from the query in one bit of each of the first
+    //substrings is found only by the last probe allowed by the bound,
+    //a farther row differing in the last bits is found first
+    cv::Mat bound_query = MatcherSelfCheck::makeRandom(rng, 16, bytes);
+    cv::Mat bound_rows;
+    for (int query_idx = 0; query_idx < bound_query.rows; query_idx++)
+    {
+      const int flipped_bits = 1 + query_idx % 8;
+      cv::Mat first = bound_query.row(query_idx).clone();
+      cv::Mat last = first.clone();
+      for (int substring = 0; substring < flipped_bits; substring++)
+      {
+        MatcherSelfCheck::flipBit(first, 0, substring * substring_bits +
+                                            rng.uniform(0, substring_bits));
+      }
+      for (int bit = bytes * 8 - flipped_bits - 1; bit < bytes * 8; bit++)
+      {
+        MatcherSelfCheck::flipBit(last, 0, bit);
+      }
+      bound_rows.push_back(first);
+      bound_rows.push_back(last);
+    }
+    train.push_back(bound_rows);
+
+    cv::Mat query;
+    cv::vconcat(MatcherSelfCheck::makeNear(rng, train[2], 120, 4),
+                MatcherSelfCheck::makeNear(rng, train[3], 40, 12), query);
+    cv::vconcat(query, MatcherSelfCheck::makeRandom(rng, 40, bytes), query);
+    cv::vconcat(query, bound_query, query);
+
+    MultiIndexHashingMatcher matcher(substring_bits);
+    matcher.add(train);
+    MatcherSelfCheck::compare("MultiIndexHashingMatcher (" +
+                              std::to_string(substring_bits) + " bits, " +
+                              std::to_string(bytes) + " bytes)",
+                              matcher, query, {1, 2, 5},
+                              {1, 8.5f, 30, bytes * 4.f});
+  }
+
+  //written index is read over the same descriptors instead of training
+  std::vector<cv::Mat> train = {MatcherSelfCheck::makeRandom(rng, 700, 32),
+                                cv::Mat(),
+                                MatcherSelfCheck::makeRandom(rng, 300, 32)};
+  cv::Mat query = MatcherSelfCheck::makeNear(rng, train[0], 100, 10);
+  MultiIndexHashingMatcher written(12);
+  written.add(train);
+  written.train();
+  const std::string filename = cv::tempfile(".mih");
+  written.writeIndex(filename);
+
+  MultiIndexHashingMatcher read(12);
+  read.add(train);
+  try
+  {
+    read.readIndex(filename);
+  }
+  catch (...)
+  {
+    std::remove(filename.c_str());
+    throw;
+  }
+  std::remove(filename.c_str());
+
+  for (int substring = 0; substring < written.substrings_count; substring++)
+  {
+    if (read.tables[substring].offsets != written.tables[substring].offsets ||
+        read.tables[substring].ids != written.tables[substring].ids)
+    {
+      throw Exception("read index differs from written one");
+    }
+  }
+  MatcherSelfCheck::compare("MultiIndexHashingMatcher (read index)", read,
+                            query, {1, 2, 5}, {1, 20, 128});
+}
+
+void MultiIndexHashingMatcher::knnMatchImpl(cv::InputArray queryDescriptors,
+                              std::vector<std::vector<cv::DMatch>> &matches,
+                              int k, cv::InputArrayOfArrays /*masks*/,
+                              bool compactResult)
+{
+  train();
+
+  cv::Mat query = queryDescriptors.getMat();
+  matches.assign(query.rows, std::vector<cv::DMatch>());
+  if (query.empty() || codes.empty() || k <= 0)
+  {
+    return;
+  }
+  checkQuery(query);
+
+  cv::Mat query_codes;
+  pad(query, query_codes);
+
+  utils::cv::parallelFor(query.rows,
+                         [this, &query_codes, &matches, k](size_t query_idx)
+  {
+    std::vector<Neighbour> nearest;
+    searchNearest(query_codes.ptr<uint8_t>(query_idx), k, nearest);
+    for (const Neighbour &neighbour: nearest)
+    {
+      int img_idx = 0, local_idx = 0;
+      locate(neighbour.second, img_idx, local_idx);
+      matches[query_idx].push_back(cv::DMatch(query_idx, local_idx, img_idx,
+                                              neighbour.first));
+    }
+  });
+
+  if (compactResult)
+  {
+    matches.erase(std::remove_if(matches.begin(), matches.end(),
+                                 [](const std::vector<cv::DMatch> &m)
+                                 { return m.empty(); }),
+                  matches.end());
+  }
+}
+
+void MultiIndexHashingMatcher::radiusMatchImpl(
+                              cv::InputArray queryDescriptors,
+                              std::vector<std::vector<cv::DMatch>> &matches,
+                              float maxDistance,
+                              cv::InputArrayOfArrays /*masks*/,
+                              bool compactResult)
+{
+  train();
+
+  cv::Mat query = queryDescriptors.getMat();
+  matches.assign(query.rows, std::vector<cv::DMatch>());
+  if (query.empty() || codes.empty())
+  {
+    return;
+  }
+  checkQuery(query);
+
+  cv::Mat query_codes;
+  pad(query, query_codes);
+
+  utils::cv::parallelFor(query.rows,
+                         [this, &query_codes, &matches, maxDistance]
+                         (size_t query_idx)
+  {
+    std::vector<Neighbour> found;
+    searchRadius(query_codes.ptr<uint8_t>(query_idx), maxDistance, found);
+    for (const Neighbour &neighbour: found)
+    {
+      int img_idx = 0, local_idx = 0;
+      locate(neighbour.second, img_idx, local_idx);
+      matches[query_idx].push_back(cv::DMatch(query_idx, local_idx, img_idx,
+                                              neighbour.first));
+    }
+  });
+
+  if (compactResult)
+  {
+    matches.erase(std::remove_if(matches.begin(), matches.end(),
+                                 [](const std::vector<cv::DMatch> &m)
+                                 { return m.empty(); }),
+                  matches.end());
+  }
+}
+
+void MultiIndexHashingMatcher::copyCodes()
+{
+  descriptor_size = 0;
+  codes.release();
+  images_starts.clear();
+
+  for (const auto &descriptors: trainDescCollection)
+  {
+    if (descriptors.empty())
+    {
+      continue;
+    }
+    if (descriptors.type() != CV_8U)
+    {
+      throw Exception("Only binary (CV_8U) descriptors are supported");
+    }
+    if (descriptor_size == 0)
+    {
+      descriptor_size = descriptors.cols;
+    }
+    else if (descriptors.cols != descriptor_size)
+    {
+      throw Exception("Descriptors of different sizes");
+    }
+  }
+  stride = (descriptor_size + ROW_ALIGNMENT - 1) /
+           ROW_ALIGNMENT * ROW_ALIGNMENT;
+  substrings_count = (descriptor_size * 8 + substring_bits - 1) /
+                     substring_bits;
+
+  for (const auto &descriptors: trainDescCollection)
+  {
+    images_starts.push_back(codes.rows);
+    if (!descriptors.empty())
+    {
+      cv::Mat padded;
+      pad(descriptors, padded);
+      codes.push_back(padded);
+    }
+  }
+}
+
+void MultiIndexHashingMatcher::buildTables()
+{
+  //counting sort of rows by substring, rows of bucket stay ascending
+  tables.assign(substrings_count, Table());
+  for (int substring = 0; substring < substrings_count; substring++)
+  {
+    Table &table = tables[substring];
+    table.offsets.assign((size_t(1) << substringLength(substring)) + 1, 0);
+    table.ids.resize(codes.rows);
+
+    for (int row = 0; row < codes.rows; row++)
+    {
+      table.offsets[substringKey(codes.ptr<uint8_t>(row), substring) + 1]++;
+    }
+    for (size_t key = 1; key < table.offsets.size(); key++)
+    {
+      table.offsets[key] += table.offsets[key - 1];
+    }
+
+    std::vector<uint32_t> positions(table.offsets.begin(),
+                                    table.offsets.end() - 1);
+    for (int row = 0; row < codes.rows; row++)
+    {
+      uint32_t key = substringKey(codes.ptr<uint8_t>(row), substring);
+      table.ids[positions[key]++] = row;
+    }
+  }
+}
+
+void MultiIndexHashingMatcher::pad(const cv::Mat &descriptors,
+                                   cv::Mat &padded) const
+{
+  padded = cv::Mat(descriptors.rows, stride, CV_8U, cv::Scalar(0));
+  for (int row = 0; row < descriptors.rows; row++)
+  {
+    std::memcpy(padded.ptr<uint8_t>(row), descriptors.ptr<uint8_t>(row),
+                descriptor_size);
+  }
+}
+
+void MultiIndexHashingMatcher::checkQuery(const cv::Mat &query) const
+{
+  if (query.type() != CV_8U || query.cols != descriptor_size)
+  {
+    throw Exception("Query descriptors don't match train descriptors");
+  }
+}
+
+void MultiIndexHashingMatcher::locate(int global_idx, int &img_idx,
+                                      int &local_idx) const
+{
+  //the last image starting not after global_idx (skipping empty images)
+  auto it = std::upper_bound(images_starts.begin(), images_starts.end(),
+                             global_idx) - 1;
+  img_idx = it - images_starts.begin();
+  local_idx = global_idx - *it;
+}
+
+uint32_t MultiIndexHashingMatcher::substringKey(const uint8_t *code,
+                                                int substring) const
+{
+  //substring is at most 24 bits, so it's within 4 bytes from its first byte
+  const int bit_offset = substring * substring_bits;
+  const int first_byte = bit_offset / 8;
+  uint32_t word = 0;
+  for (int byte = 0; byte < 4 && first_byte + byte < stride; byte++)
+  {
+    word |= uint32_t(code[first_byte + byte]) << (8 * byte);
+  }
+
+  return (word >> (bit_offset % 8)) &
+         ((uint32_t(1) << substringLength(substring)) - 1);
+}
+
+int MultiIndexHashingMatcher::substringLength(int substring) const
+{
+  return std::min(substring_bits,
+                  descriptor_size * 8 - substring * substring_bits);
+}
+
+void MultiIndexHashingMatcher::searchNearest(const uint8_t *query_code, int k,
+                                      std::vector<Neighbour> &nearest) const
+{
+  thread_local std::vector<uint32_t> visited;
+  thread_local uint32_t stamp = 0;
+  if (visited.size() < static_cast<size_t>(codes.rows) || ++stamp == 0)
+  {
+    visited.assign(std::max<size_t>(visited.size(), codes.rows), 0);
+    stamp = 1;
+  }
+
+  std::vector<uint32_t> query_keys(substrings_count);
+  for (int substring = 0; substring < substrings_count; substring++)
+  {
+    query_keys[substring] = substringKey(query_code, substring);
+  }
+
+  nearest.clear();
+  std::vector<int> candidates;
+  double cost = 0;
+  for (int radius = 0; radius <= substring_bits; radius++)
+  {
+    if (cost + probingCost(radius) > codes.rows)
+    {
+      break;
+    }
+
+    for (int substring = 0; substring < substrings_count; substring++)
+    {
+      candidates.clear();
+      cost += BUCKET_COST * probe(query_keys, substring, radius, visited,
+                                  stamp, candidates);
+      cost += CANDIDATE_COST * candidates.size();
+      for (int row: candidates)
+      {
+        insertNeighbour(nearest, k, Neighbour(distance(query_code, row), row));
+      }
+
+      //other substrings differ in at least radius bits and processed ones
+      //in at least radius + 1 bits, so all closer rows are found
+      if (nearest.size() == static_cast<size_t>(k) &&
+          nearest.back().first < substrings_count * radius + substring + 1)
+      {
+        return;
+      }
+    }
+  }
+
+  //probing is more expensive than brute force
+  nearest.clear();
+  int distances[SCAN_BLOCK];
+  for (int begin = 0; begin < codes.rows; begin += SCAN_BLOCK)
+  {
+    const int rows_count = std::min(SCAN_BLOCK, codes.rows - begin);
+    distances_kernel(query_code, codes.ptr<uint8_t>(begin), rows_count,
+                     stride, distances);
+    for (int row = 0; row < rows_count; row++)
+    {
+      insertNeighbour(nearest, k, Neighbour(distances[row], begin + row));
+    }
+  }
+}
+
+void MultiIndexHashingMatcher::searchRadius(const uint8_t *query_code,
+                                            float max_distance,
+                                            std::vector<Neighbour> &found) const
+{
+  found.clear();
+  if (max_distance <= 0)
+  {
+    return;
+  }
+
+  thread_local std::vector<uint32_t> visited;
+  thread_local uint32_t stamp = 0;
+  if (visited.size() < static_cast<size_t>(codes.rows) || ++stamp == 0)
+  {
+    visited.assign(std::max<size_t>(visited.size(), codes.rows), 0);
+    stamp = 1;
+  }
+
+  std::vector<uint32_t> query_keys(substrings_count);
+  for (int substring = 0; substring < substrings_count; substring++)
+  {
+    query_keys[substring] = substringKey(query_code, substring);
+  }
+
+  //rows closer than max_distance differ in some substring in at most
+  //max_radius bits
+  const int max_integer_distance = static_cast<int>(std::ceil(max_distance)) - 1;
+  const int max_radius = std::min(max_integer_distance / substrings_count,
+                                  substring_bits);
+  double cost = 0;
+  for (int radius = 0; radius <= max_radius; radius++)
+  {
+    cost += probingCost(radius);
+  }
+
+  if (cost <= codes.rows)
+  {
+    std::vector<int> candidates;
+    for (int radius = 0; radius <= max_radius; radius++)
+    for (int substring = 0; substring < substrings_count; substring++)
+    {
+      probe(query_keys, substring, radius, visited, stamp, candidates);
+    }
+    for (int row: candidates)
+    {
+      const int row_distance = distance(query_code, row);
+      if (row_distance < max_distance)
+      {
+        found.push_back(Neighbour(row_distance, row));
+      }
+    }
+  }
+  else
+  {//probing is more expensive than brute force
+    int distances[SCAN_BLOCK];
+    for (int begin = 0; begin < codes.rows; begin += SCAN_BLOCK)
+    {
+      const int rows_count = std::min(SCAN_BLOCK, codes.rows - begin);
+      distances_kernel(query_code, codes.ptr<uint8_t>(begin), rows_count,
+                       stride, distances);
+      for (int row = 0; row < rows_count; row++)
+      {
+        if (distances[row] < max_distance)
+        {
+          found.push_back(Neighbour(distances[row], begin + row));
+        }
+      }
+    }
+  }
+
+  std::sort(found.begin(), found.end());
+}
+
+size_t MultiIndexHashingMatcher::probe(
+                                  const std::vector<uint32_t> &query_keys,
+                                  int substring, int radius,
+                                  std::vector<uint32_t> &visited,
+                                  uint32_t stamp,
+                                  std::vector<int> &candidates) const
+{
+  const int length = substringLength(substring);
+  if (radius > length)
+  {
+    return 0;
+  }
+
+  const Table &table = tables[substring];
+  const uint32_t limit = uint32_t(1) << length;
+  size_t probes = 0;
+  //masks with radius bits set are enumerated in increasing order
+  uint32_t mask = (uint32_t(1) << radius) - 1;
+  while (mask < limit)
+  {
+    const uint32_t key = query_keys[substring] ^ mask;
+    for (uint32_t i = table.offsets[key]; i < table.offsets[key + 1]; i++)
+    {
+      const uint32_t row = table.ids[i];
+      if (visited[row] != stamp)
+      {
+        visited[row] = stamp;
+        candidates.push_back(row);
+      }
+    }
+    probes++;
+
+    if (mask == 0)
+    {
+      break;
+    }
+    //the next mask with the same count of bits (Gosper's hack)
+    const uint32_t lowest = mask & (~mask + 1);
+    const uint32_t ripple = mask + lowest;
+    mask = (((ripple ^ mask) >> 2) / lowest) | ripple;
+  }
+
+  return probes;
+}
+
+double MultiIndexHashingMatcher::probingCost(int radius) const
+{
+  //expected buckets and candidates in units of brute force distances
+  double cost = 0;
+  for (int substring = 0; substring < substrings_count; substring++)
+  {
+    const int length = substringLength(substring);
+    if (radius <= length)
+    {
+      cost += binomial(length, radius) *
+              (BUCKET_COST +
+               CANDIDATE_COST * codes.rows / std::ldexp(1., length));
+    }
+  }
+
+  return cost;
+}
+
+int MultiIndexHashingMatcher::distance(const uint8_t *query_code,
+                                       int row) const
+{
+  int result = 0;
+  distances_kernel(query_code, codes.ptr<uint8_t>(row), 1, stride, &result);
+  return result;
+}
@@ -0,0 +1,151 @@
+#ifndef MULTI_INDEX_HASHING_MATCHER_H
+#define MULTI_INDEX_HASHING_MATCHER_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+#include "hamming_matcher.h"
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The MultiIndexHashingMatcher class - exact k nearest neighbours of
+ * binary descriptors by multi-index hashing (Norouzi et al.). Descriptor is
+ * split into m substrings, each substring indexes a hash table. If distance
+ * of descriptors is less than m * (r + 1), some of their substrings differ
+ * in at most r bits, so tables are probed with growing radius r until the
+ * k-th found neighbour is closer than this bound. If probing becomes more
+ * expensive than brute force, all descriptors are scanned.
+ */
+class MultiIndexHashingMatcher : public cv::DescriptorMatcher
+{
+ public:
+  /**
+   * @brief MultiIndexHashingMatcher
+   * @param substring_bits - bits of substring, tables have 2^bits buckets
+   */
+  explicit MultiIndexHashingMatcher(int substring_bits = 16);
+
+  bool isMaskSupported() const override;
+  cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const
+                                                                      override;
+
+  void clear() override;
+
+  /**
+   * @brief train - builds tables over all added descriptors
+   */
+  void train() override;
+
+  int getSubstringBits() const;
+  int getSubstringsCount() const;
+
+  /**
+   * @brief writeIndex - writes tables of trained matcher
+   */
+  void writeIndex(const std::string &filename) const;
+  /**
+   * @brief readIndex - reads tables over already added descriptors
+   *                    instead of training
+   */
+  void readIndex(const std::string &filename);
+
+  /**
+   * @brief selfCheck - compares knnMatch (k = 1, 2, 5) and radiusMatch with
+   * cv::BFMatcher on random 32 and 64 bytes descriptors for substrings, which
+   * do and don't divide descriptor, both when probing finds neighbours and
+   * when it falls back to brute force. Then checks that index read by
+   * readIndex gives the same matches as the written one (see MatcherSelfCheck)
+   * @throw MatcherSelfCheck::Exception or Exception on the first difference
+   */
+  static void selfCheck();
+
+  class Exception: public std::runtime_error
+  {
+  public:
+    Exception(const std::string &what):
+      std::runtime_error("MultiIndexHashingMatcher: " + what)
+    {}
+  };
+
+ protected:
+  void knnMatchImpl(cv::InputArray queryDescriptors,
+                    std::vector<std::vector<cv::DMatch>> &matches, int k,
+                    cv::InputArrayOfArrays masks = cv::noArray(),
+                    bool compactResult = false) override;
+  void radiusMatchImpl(cv::InputArray queryDescriptors,
+                       std::vector<std::vector<cv::DMatch>> &matches,
+                       float maxDistance,
+                       cv::InputArrayOfArrays masks = cv::noArray(),
+                       bool compactResult = false) override;
+
+ private:
+  using Neighbour = std::pair<int, int>; //distance, row
+
+  /**
+   * @brief The Table struct - buckets of rows by value of substring,
+   * rows of bucket are ids[offsets[key], offsets[key + 1])
+   */
+  struct Table
+  {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> ids;
+  };
+
+  /**
+   * @brief copyCodes - copies added descriptors to padded rows
+   */
+  void copyCodes();
+  void buildTables();
+  void pad(const cv::Mat &descriptors, cv::Mat &padded) const;
+  void checkQuery(const cv::Mat &query) const;
+  void locate(int global_idx, int &img_idx, int &local_idx) const;
+
+  uint32_t substringKey(const uint8_t *code, int substring) const;
+  int substringLength(int substring) const;
+
+  /**
+   * @brief searchNearest - k nearest rows sorted by distance
+   */
+  void searchNearest(const uint8_t *query_code, int k,
+                     std::vector<Neighbour> &nearest) const;
+  /**
+   * @brief searchRadius - rows closer than max_distance
+   */
+  void searchRadius(const uint8_t *query_code, float max_distance,
+                    std::vector<Neighbour> &found) const;
+  /**
+   * @brief probe - appends not visited rows, the substring of which differs
+   *                from the query in exactly radius bits
+   * @return count of probed buckets
+   */
+  size_t probe(const std::vector<uint32_t> &query_keys, int substring,
+               int radius, std::vector<uint32_t> &visited, uint32_t stamp,
+               std::vector<int> &candidates) const;
+  /**
+   * @brief probingCost - expected cost of probing all substrings with
+   *                      radius relative to distance in brute force scan
+   */
+  double probingCost(int radius) const;
+  int distance(const uint8_t *query_code, int row) const;
+
+  const int substring_bits;
+  const HammingMatcher::DistancesKernel distances_kernel;
+
+  int                 descriptor_size; //bytes, 0 if nothing is trained
+  int                 stride;          //descriptor_size rounded up to 32
+  int                 substrings_count;
+  cv::Mat             codes;           //CV_8U, padded train descriptors
+  std::vector<int>    images_starts;   //first row of each train image
+  std::vector<Table>  tables;
+};
+
+}
+
+#endif // MULTI_INDEX_HASHING_MATCHER_H
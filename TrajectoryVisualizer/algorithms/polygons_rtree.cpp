@@ -0,0 +1,198 @@
+#include "polygons_rtree.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace algorithmspkg;
+
+PolygonsRTree::PolygonsRTree(size_t node_capacity)
+  : node_capacity(std::max<size_t>(node_capacity, 2)), packed_count(0)
+{
+}
+
+void PolygonsRTree::insert(const PolygonsRTree::Polygon &polygon)
+{
+  entries.push_back({getBoundingBox(polygon), entries.size()});
+
+  //repacking costs O(n log n), so it's done once per sqrt(n) inserts
+  const size_t unpacked_count = entries.size() - packed_count;
+  if (unpacked_count > node_capacity &&
+      unpacked_count * unpacked_count > packed_count)
+  {
+    build();
+  }
+}
+
+void PolygonsRTree::clear()
+{
+  entries.clear();
+  levels.clear();
+  packed_count = 0;
+}
+
+size_t PolygonsRTree::size() const
+{
+  return entries.size();
+}
+
+bool PolygonsRTree::isBuilt() const
+{
+  return packed_count == entries.size();
+}
+
+void PolygonsRTree::build()
+{
+  levels.clear();
+
+  //entries will be sorted, so restore the insertion order first
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &left, const Entry &right) -> bool
+            { return left.id < right.id; });
+
+  if (!entries.empty())
+  {
+    levels.push_back(pack(entries));
+    while (levels.back().size() > 1)
+    {
+      std::vector<Node> upper = pack(levels.back());
+      levels.push_back(std::move(upper));
+    }
+  }
+
+  packed_count = entries.size();
+}
+
+void PolygonsRTree::query(const cv::Rect2f &region, std::vector<size_t> &ids)
+{
+  if (!isBuilt())
+  {
+    build();
+  }
+
+  static_cast<const PolygonsRTree*>(this)->query(region, ids);
+}
+
+void PolygonsRTree::query(const cv::Rect2f &region,
+                          std::vector<size_t> &ids) const
+{
+  ids.clear();
+  for (size_t i = packed_count; i < entries.size(); i++)
+  {
+    if (isIntersected(entries[i].box, region))
+    {
+      ids.push_back(entries[i].id);
+    }
+  }
+
+  //stack of (level, node index)
+  std::vector<std::pair<size_t, size_t>> stack;
+  if (!levels.empty())
+  {
+    stack.emplace_back(levels.size() - 1, 0);
+  }
+  while (!stack.empty())
+  {
+    const size_t level = stack.back().first;
+    const Node &node = levels[level][stack.back().second];
+    stack.pop_back();
+
+    if (!isIntersected(node.box, region))
+    {
+      continue;
+    }
+
+    for (size_t i = node.first; i < node.first + node.count; i++)
+    {
+      if (level == 0)
+      {
+        if (isIntersected(entries[i].box, region))
+        {
+          ids.push_back(entries[i].id);
+        }
+      }
+      else
+      {
+        stack.emplace_back(level - 1, i);
+      }
+    }
+  }
+
+  std::sort(ids.begin(), ids.end());
+}
+
+cv::Rect2f PolygonsRTree::getBoundingBox(const PolygonsRTree::Polygon &polygon)
+{
+  if (polygon.empty())
+  {
+    return cv::Rect2f();
+  }
+
+  cv::Point2f tl = polygon.front();
+  cv::Point2f br = polygon.front();
+  for (const auto &pt: polygon)
+  {
+    tl.x = std::min(tl.x, pt.x);
+    tl.y = std::min(tl.y, pt.y);
+    br.x = std::max(br.x, pt.x);
+    br.y = std::max(br.y, pt.y);
+  }
+
+  return cv::Rect2f(tl, br);
+}
+
+bool PolygonsRTree::isIntersected(const cv::Rect2f &a, const cv::Rect2f &b)
+{
+  return a.x <= b.x + b.width  && b.x <= a.x + a.width &&
+         a.y <= b.y + b.height && b.y <= a.y + a.height;
+}
+
+template<typename Item>
+std::vector<PolygonsRTree::Node> PolygonsRTree::pack(
+                                                std::vector<Item> &items) const
+{
+  auto center_x = [](const Item &item) -> float
+  { return item.box.x + item.box.width / 2; };
+  auto center_y = [](const Item &item) -> float
+  { return item.box.y + item.box.height / 2; };
+
+  //Sort-Tile-Recursive: vertical slices by x, then runs of nodes by y
+  const size_t nodes_count = (items.size() + node_capacity - 1) / node_capacity;
+  const size_t slices_count = std::ceil(std::sqrt(double(nodes_count)));
+  const size_t slice_size = slices_count * node_capacity;
+
+  std::sort(items.begin(), items.end(),
+            [&](const Item &left, const Item &right) -> bool
+            { return center_x(left) < center_x(right); });
+
+  for (size_t slice = 0; slice < items.size(); slice += slice_size)
+  {
+    auto slice_end = items.begin() + std::min(slice + slice_size, items.size());
+    std::sort(items.begin() + slice, slice_end,
+              [&](const Item &left, const Item &right) -> bool
+              { return center_y(left) < center_y(right); });
+  }
+
+  std::vector<Node> nodes;
+  nodes.reserve(nodes_count);
+  for (size_t first = 0; first < items.size(); first += node_capacity)
+  {
+    Node node;
+    node.first = first;
+    node.count = std::min(node_capacity, items.size() - first);
+
+    cv::Point2f tl = items[first].box.tl();
+    cv::Point2f br = items[first].box.br();
+    for (size_t i = first; i < first + node.count; i++)
+    {
+      tl.x = std::min(tl.x, items[i].box.x);
+      tl.y = std::min(tl.y, items[i].box.y);
+      br.x = std::max(br.x, items[i].box.x + items[i].box.width);
+      br.y = std::max(br.y, items[i].box.y + items[i].box.height);
+    }
+    node.box = cv::Rect2f(tl, br);
+
+    nodes.push_back(node);
+  }
+
+  return nodes;
+}
@@ -0,0 +1,80 @@
+#ifndef POLYGONS_RTREE_H
+#define POLYGONS_RTREE_H
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The PolygonsRTree class - R-tree over bounding boxes of polygons,
+ * ids of polygons are the order of insertion. Tree is packed with
+ * Sort-Tile-Recursive algorithm. Boxes inserted after packing are scanned by
+ * queries until there are more than sqrt of packed ones, then the tree is
+ * repacked, so restorers adding frames between queries don't scan all boxes.
+ */
+class PolygonsRTree
+{
+ public:
+  using Polygon = std::vector<cv::Point2f>;
+
+  explicit PolygonsRTree(size_t node_capacity = 8);
+
+  void insert(const Polygon &polygon);
+  void clear();
+
+  size_t size() const;
+  /**
+   * @brief isBuilt - all inserted boxes are packed to the tree
+   */
+  bool isBuilt() const;
+
+  /**
+   * @brief build - packs all inserted boxes to the tree
+   */
+  void build();
+
+  /**
+   * @brief query - finds polygons which bounding boxes intersect the region
+   * @param region - search region in the same units as polygons
+   * @param ids - out ids of found polygons in ascending order
+   */
+  void query(const cv::Rect2f &region, std::vector<size_t> &ids);
+  /**
+   * @brief query - thread-safe version, scans boxes inserted after packing
+   */
+  void query(const cv::Rect2f &region, std::vector<size_t> &ids) const;
+
+  static cv::Rect2f getBoundingBox(const Polygon &polygon);
+  static bool isIntersected(const cv::Rect2f &a, const cv::Rect2f &b);
+
+ private:
+  struct Node
+  {
+    cv::Rect2f box;
+    size_t first; //index of first child in the lower level (or in entries)
+    size_t count;
+  };
+
+  struct Entry
+  {
+    cv::Rect2f box;
+    size_t id;
+  };
+
+  //packs items of lower level into nodes of upper level
+  template<typename Item>
+  std::vector<Node> pack(std::vector<Item> &items) const;
+
+  const size_t node_capacity;
+
+  std::vector<Entry> entries; //packed ones, then inserted after packing
+  std::vector<std::vector<Node>> levels; //levels[0] - leaves, back() - root
+  size_t packed_count;
+};
+
+}
+
+#endif // POLYGONS_RTREE_H
@@ -0,0 +1,309 @@
+#include "quantized_matcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace algorithmspkg;
+
+QuantizedMatcher::QuantizedMatcher(int dims, int rerank_count,
+                                   int max_training_rows)
+  : dims(dims), rerank_count(std::max(rerank_count, 1)),
+    max_training_rows(std::max(max_training_rows, 1)),
+    quant_scale(1), code_length(0)
+{
+}
+
+bool QuantizedMatcher::isMaskSupported() const
+{
+  return false;
+}
+
+cv::Ptr<cv::DescriptorMatcher> QuantizedMatcher::clone(
+                                                  bool emptyTrainData) const
+{
+  auto matcher = cv::makePtr<QuantizedMatcher>(dims, rerank_count,
+                                               max_training_rows);
+  matcher->pca = pca;
+  matcher->offsets = offsets;
+  matcher->quant_scale = quant_scale;
+  matcher->code_length = code_length;
+  if (!emptyTrainData)
+  {
+    matcher->trainDescCollection = trainDescCollection;
+    matcher->codes = codes.clone();
+    matcher->images_starts = images_starts;
+  }
+
+  return matcher;
+}
+
+void QuantizedMatcher::clear()
+{
+  cv::DescriptorMatcher::clear();
+  codes.release();
+  images_starts.clear();
+}
+
+void QuantizedMatcher::train()
+{
+  if (images_starts.size() == trainDescCollection.size())
+  {
+    return;
+  }
+  for (const auto &descriptors: trainDescCollection)
+  {
+    if (!descriptors.empty() && descriptors.type() != CV_32F)
+    {
+      throw Exception("Only float descriptors are supported");
+    }
+  }
+
+  if (pca.eigenvectors.empty())
+  {
+    computeQuantization();
+  }
+
+  for (size_t img_idx = images_starts.size();
+       img_idx < trainDescCollection.size(); img_idx++)
+  {
+    images_starts.push_back(codes.rows);
+    if (!trainDescCollection[img_idx].empty())
+    {
+      cv::Mat image_codes;
+      encode(trainDescCollection[img_idx], image_codes);
+      codes.push_back(image_codes);
+    }
+  }
+}
+
+int QuantizedMatcher::getDims() const
+{
+  return dims;
+}
+
+int QuantizedMatcher::getRerankCount() const
+{
+  return rerank_count;
+}
+
+size_t QuantizedMatcher::getCodesSize() const
+{
+  return codes.total() * codes.elemSize();
+}
+
+void QuantizedMatcher::knnMatchImpl(cv::InputArray queryDescriptors,
+                              std::vector<std::vector<cv::DMatch>> &matches,
+                              int k, cv::InputArrayOfArrays /*masks*/,
+                              bool /*compactResult*/)
+{
+  train();
+
+  cv::Mat query;
+  queryDescriptors.getMat().convertTo(query, CV_32F);
+  matches.assign(query.rows, std::vector<cv::DMatch>());
+  if (query.empty() || codes.empty() || k <= 0)
+  {
+    return;
+  }
+
+  cv::Mat query_codes;
+  encode(query, query_codes);
+
+  using Candidate = std::pair<uint32_t, int>; //approx distance, code row
+  const size_t candidates_count = std::max(k, rerank_count);
+  std::vector<Candidate> candidates;
+  for (int query_idx = 0; query_idx < query.rows; query_idx++)
+  {
+    //max heap keeps the nearest candidates
+    std::priority_queue<Candidate> nearest;
+    const uint8_t *query_code = query_codes.ptr<uint8_t>(query_idx);
+    for (int row = 0; row < codes.rows; row++)
+    {
+      uint32_t distance = squaredDistance(query_code, codes.ptr<uint8_t>(row),
+                                          code_length);
+      if (nearest.size() < candidates_count)
+      {
+        nearest.emplace(distance, row);
+      }
+      else if (distance < nearest.top().first)
+      {
+        nearest.pop();
+        nearest.emplace(distance, row);
+      }
+    }
+
+    candidates.clear();
+    while (!nearest.empty())
+    {
+      candidates.push_back(nearest.top());
+      nearest.pop();
+    }
+
+    auto &query_matches = matches[query_idx];
+    const cv::Mat query_row = query.row(query_idx);
+    for (const Candidate &candidate: candidates)
+    {
+      int img_idx = 0, local_idx = 0;
+      locate(candidate.second, img_idx, local_idx);
+      float distance = cv::norm(query_row,
+                                trainDescCollection[img_idx].row(local_idx),
+                                cv::NORM_L2);
+      query_matches.push_back(cv::DMatch(query_idx, local_idx, img_idx,
+                                         distance));
+    }
+
+    std::sort(query_matches.begin(), query_matches.end());
+    if (query_matches.size() > static_cast<size_t>(k))
+    {
+      query_matches.resize(k);
+    }
+  }
+}
+
+void QuantizedMatcher::radiusMatchImpl(cv::InputArray queryDescriptors,
+                              std::vector<std::vector<cv::DMatch>> &matches,
+                              float maxDistance,
+                              cv::InputArrayOfArrays /*masks*/,
+                              bool /*compactResult*/)
+{
+  cv::Mat query;
+  queryDescriptors.getMat().convertTo(query, CV_32F);
+  matches.assign(query.rows, std::vector<cv::DMatch>());
+
+  for (int query_idx = 0; query_idx < query.rows; query_idx++)
+  {
+    const cv::Mat query_row = query.row(query_idx);
+    for (size_t img_idx = 0; img_idx < trainDescCollection.size(); img_idx++)
+    {
+      const cv::Mat &train = trainDescCollection[img_idx];
+      for (int local_idx = 0; local_idx < train.rows; local_idx++)
+      {
+        float distance = cv::norm(query_row, train.row(local_idx),
+                                  cv::NORM_L2);
+        if (distance < maxDistance)
+        {
+          matches[query_idx].push_back(cv::DMatch(query_idx, local_idx,
+                                                  img_idx, distance));
+        }
+      }
+    }
+    std::sort(matches[query_idx].begin(), matches[query_idx].end());
+  }
+}
+
+void QuantizedMatcher::computeQuantization()
+{
+  size_t total_rows = 0;
+  for (const auto &descriptors: trainDescCollection)
+  {
+    total_rows += descriptors.rows;
+  }
+  if (total_rows == 0)
+  {
+    throw Exception("No descriptors to train");
+  }
+
+  //rows are sampled uniformly from all images
+  const size_t step = std::max<size_t>(1, total_rows / max_training_rows);
+  cv::Mat sample;
+  size_t global_row = 0;
+  for (const auto &descriptors: trainDescCollection)
+  {
+    for (int row = 0; row < descriptors.rows; row++, global_row++)
+    {
+      if (global_row % step == 0)
+      {
+        sample.push_back(descriptors.row(row));
+      }
+    }
+  }
+
+  pca = cv::PCA(sample, cv::noArray(), cv::PCA::DATA_AS_ROW, dims);
+  cv::Mat projected = pca.project(sample);
+  code_length = (projected.cols + 15) / 16 * 16;
+
+  //common scale for all components, so distances of codes are isotropic
+  offsets = cv::Mat(1, projected.cols, CV_32F);
+  float max_range = 0;
+  for (int col = 0; col < projected.cols; col++)
+  {
+    float min_value = std::numeric_limits<float>::max();
+    float max_value = -std::numeric_limits<float>::max();
+    for (int row = 0; row < projected.rows; row++)
+    {
+      min_value = std::min(min_value, projected.at<float>(row, col));
+      max_value = std::max(max_value, projected.at<float>(row, col));
+    }
+    offsets.at<float>(0, col) = min_value;
+    max_range = std::max(max_range, max_value - min_value);
+  }
+  quant_scale = max_range > 0? 255 / max_range: 1;
+}
+
+void QuantizedMatcher::encode(const cv::Mat &descriptors,
+                              cv::Mat &encoded) const
+{
+  cv::Mat projected = pca.project(descriptors);
+
+  encoded = cv::Mat(projected.rows, code_length, CV_8U, cv::Scalar(0));
+  for (int row = 0; row < projected.rows; row++)
+  {
+    const float *values = projected.ptr<float>(row);
+    uint8_t *code = encoded.ptr<uint8_t>(row);
+    for (int col = 0; col < projected.cols; col++)
+    {
+      float value = (values[col] - offsets.at<float>(0, col)) * quant_scale;
+      code[col] = static_cast<uint8_t>(
+                                  std::min(255.f, std::max(0.f, value)) + 0.5f);
+    }
+  }
+}
+
+void QuantizedMatcher::locate(int global_idx, int &img_idx,
+                              int &local_idx) const
+{
+  //the last image starting not after global_idx (skipping empty images)
+  auto it = std::upper_bound(images_starts.begin(), images_starts.end(),
+                             global_idx) - 1;
+  img_idx = it - images_starts.begin();
+  local_idx = global_idx - *it;
+}
+
+uint32_t QuantizedMatcher::squaredDistance(const uint8_t *left,
+                                           const uint8_t *right, int length)
+{
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < length; i += 16)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + i));
+
+    __m128i diff_low = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero),
+                                     _mm_unpacklo_epi8(b, zero));
+    __m128i diff_high = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero),
+                                      _mm_unpackhi_epi8(b, zero));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(diff_low, diff_low));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(diff_high, diff_high));
+  }
+
+  uint32_t lanes[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+  uint32_t sum = 0;
+  for (int i = 0; i < length; i++)
+  {
+    int diff = int(left[i]) - int(right[i]);
+    sum += diff * diff;
+  }
+  return sum;
+#endif
+}
@@ -0,0 +1,109 @@
+#ifndef QUANTIZED_MATCHER_H
+#define QUANTIZED_MATCHER_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The QuantizedMatcher class - brute force matcher of float
+ * descriptors (SIFT, SURF, KAZE) over compact codes. Train descriptors are
+ * reduced by PCA and quantized to 8 bits per component. Candidates are found
+ * by approximate distance between codes (SSE2 if available) and the best of
+ * them are re-ranked by exact L2 distance.
+ *
+ * Float descriptors are kept for re-ranking (shared, not copied), so codes
+ * take dims bytes per descriptor in addition to them and resident memory
+ * doesn't drop for descriptors in memory. It drops only if descriptors are
+ * views on a mapped MapBundle: the scan reads codes, so only re-ranked rows
+ * of the mapping are paged in and the rest may be evicted by the OS.
+ * The controller and main.cpp don't select this matcher, it's left for
+ * library users of mapped bundles.
+ */
+class QuantizedMatcher : public cv::DescriptorMatcher
+{
+ public:
+  /**
+   * @brief QuantizedMatcher
+   * @param dims - count of PCA components, 0 keeps all
+   * @param rerank_count - candidates re-ranked for each match
+   * @param max_training_rows - rows sampled to compute PCA
+   */
+  explicit QuantizedMatcher(int dims = 32, int rerank_count = 8,
+                            int max_training_rows = 20000);
+
+  bool isMaskSupported() const override;
+  cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const
+                                                                      override;
+
+  void clear() override;
+
+  /**
+   * @brief train - computes PCA on the first training (it stays for clones
+   *                and next trainings) and encodes not encoded descriptors
+   */
+  void train() override;
+
+  int getDims() const;
+  int getRerankCount() const;
+  /**
+   * @brief getCodesSize - bytes occupied by codes
+   */
+  size_t getCodesSize() const;
+
+  class Exception: public std::runtime_error
+  {
+  public:
+    Exception(const std::string &what):
+      std::runtime_error("QuantizedMatcher: " + what)
+    {}
+  };
+
+ protected:
+  void knnMatchImpl(cv::InputArray queryDescriptors,
+                    std::vector<std::vector<cv::DMatch>> &matches, int k,
+                    cv::InputArrayOfArrays masks = cv::noArray(),
+                    bool compactResult = false) override;
+  /**
+   * @brief radiusMatchImpl - exact brute force, codes aren't used
+   */
+  void radiusMatchImpl(cv::InputArray queryDescriptors,
+                       std::vector<std::vector<cv::DMatch>> &matches,
+                       float maxDistance,
+                       cv::InputArrayOfArrays masks = cv::noArray(),
+                       bool compactResult = false) override;
+
+ private:
+  void computeQuantization();
+  void encode(const cv::Mat &descriptors, cv::Mat &encoded) const;
+  void locate(int global_idx, int &img_idx, int &local_idx) const;
+
+  /**
+   * @brief squaredDistance - of codes of length multiple of 16
+   */
+  static uint32_t squaredDistance(const uint8_t *left, const uint8_t *right,
+                                  int length);
+
+  const int dims;
+  const int rerank_count;
+  const int max_training_rows;
+
+  cv::PCA     pca;          //shared with clones, empty if not computed
+  cv::Mat     offsets;      //1 x dims CV_32F, min of each component
+  float       quant_scale;  //code = (component - offset) * quant_scale
+  int         code_length;  //dims rounded up to 16
+
+  cv::Mat           codes;         //CV_8U, row for each train descriptor
+  std::vector<int>  images_starts; //first code row of each train image
+};
+
+}
+
+#endif // QUANTIZED_MATCHER_H
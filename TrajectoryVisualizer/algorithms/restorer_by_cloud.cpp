@@ -2,10 +2,13 @@
 
 #include <algorithm>
 #include <iostream>
-
-#include <opencv2/calib3d.hpp>
+#include <fstream>
 
 #include "transformator.h"
+#include "saveable_flann_matcher.h"
+#include "key_points_deduplicator.h"
+#include "multi_index_hashing_matcher.h"
+#include "utils/parallel_for.h"
 
 using namespace algorithmspkg;
 
@@ -14,7 +17,9 @@ RestorerByCloud::RestorerByCloud(FeatureBasedRestorer::DetectorPtr detector,
                                  FeatureBasedRestorer::MatcherPtr matcher,
                                  size_t max_key_points_per_frame)
   : FeatureBasedRestorer(detector, descriptor, matcher,
-                         max_key_points_per_frame)
+                         max_key_points_per_frame),
+    descriptor_index(std::make_shared<IncrementalDescriptorIndex>(
+                       matcher, descriptor->defaultNorm()))
 {
 }
 
@@ -25,30 +30,21 @@ void RestorerByCloud::addFrame(const cv::Mat &frame,
   frames_key_points.push_back(KeyPointsList());
   std::vector<cv::KeyPoint> &key_points = frames_key_points.back();
 
-  getDetector()->detect(frame, frames_key_points.back());
-
-  std::sort(key_points.begin(), key_points.end(),
-            []( const cv::KeyPoint &left, const cv::KeyPoint &right ) ->
-            bool { return left.response > right.response; });
-
-  if (getMaxKeyPointsPerFrame() != 0 &&
-      getMaxKeyPointsPerFrame() < key_points.size())
-  {
-    key_points.resize(getMaxKeyPointsPerFrame());
-  }
-  key_points.shrink_to_fit();
-
-
-
   cv::Mat descriptions;
-  getDescriptor()->compute(frame, frames_key_points.back(),
-                     descriptions);
+  extractFeatures(frame, key_points, descriptions, getMaxKeyPointsPerFrame());
+  key_points.shrink_to_fit();
 
-  getMatcher()->add(descriptions);
+  frames_descriptions.push_back(descriptions);
+  descriptor_index->add(descriptions);
+  addFrameSignature(descriptions);
 
   cv::Point2f image_center(frame.cols/2., frame.rows/2.);
   transformKeyPointsPosition(key_points, image_center,
                              pos, angle, scale);
+  if (scale_index)
+  {
+    scale_index->addFrame(key_points, frames_descriptions.back());
+  }
 }
 
 void RestorerByCloud::addFrame(const cv::Point2f &image_center,
@@ -58,78 +54,320 @@ void RestorerByCloud::addFrame(const cv::Point2f &image_center,
                                double angle, double scale)
 {
   frames_key_points.push_back(key_points);
-  getMatcher()->add(descriptions);
+  frames_descriptions.push_back(descriptions);
+  descriptor_index->add(descriptions);
+  addFrameSignature(descriptions);
 
   transformKeyPointsPosition(frames_key_points.back(), image_center,
                              pos, angle, scale);
+  if (scale_index)
+  {
+    scale_index->addFrame(frames_key_points.back(), descriptions);
+  }
 }
 
-double RestorerByCloud::recoverLocation(const cv::Rect2f &frame_rect,
-                                        cv::Point2f &pos,
-                                        double &angle, double &scale)
+FeatureBasedRestorer::QueryResult RestorerByCloud::query(
+                                      const KeyPointsList &key_points,
+                                      const cv::Mat &descriptions,
+                                      const cv::Rect2f &frame_rect) const
 {
-  //points for findHomography
-  static std::vector<cv::Point2f> query_pts;
-  static std::vector<cv::Point2f> train_pts;
+  thread_local MatchesList rough_matches;
 
   rough_matches.clear();
-  if (query_key_points.empty())
+  if (key_points.empty())
   {
-    pos = cv::Point2f(0, 0);
-    angle = scale = 0;
-    return 0;
+    return verifyMatches(key_points, rough_matches, frame_rect, 0);
+  }
+
+  const bool is_traced = static_cast<bool>(getTrace());
+  RestorerTrace::Clock::time_point start;
+  if (is_traced)
+  {
+    start = RestorerTrace::Clock::now();
+  }
+
+  matchCloud(descriptions, rough_matches);
+
+  float match_ms = is_traced? RestorerTrace::elapsedMs(start): 0;
+  return verifyMatches(key_points, rough_matches, frame_rect, match_ms);
+}
+
+FeatureBasedRestorer::QueryResult RestorerByCloud::queryAtScale(
+                                      const KeyPointsList &key_points,
+                                      const cv::Mat &descriptions,
+                                      const cv::Rect2f &frame_rect,
+                                      double m_per_px) const
+{
+  if (!scale_index)
+  {
+    return query(key_points, descriptions, frame_rect);
+  }
+
+  const bool is_traced = static_cast<bool>(getTrace());
+  RestorerTrace::Clock::time_point start;
+  if (is_traced)
+  {
+    start = RestorerTrace::Clock::now();
+  }
+
+  MatchesList rough_matches;
+  scale_index->match(key_points, descriptions, m_per_px, rough_matches);
+
+  float match_ms = is_traced? RestorerTrace::elapsedMs(start): 0;
+  return verifyMatches(key_points, rough_matches, frame_rect, match_ms);
+}
+
+void RestorerByCloud::enableScaleBuckets(double octaves_per_bucket,
+                                         int tolerance)
+{
+  scale_index = std::make_shared<ScaleBucketedIndex>(getMatcher(),
+                                              getDescriptor()->defaultNorm(),
+                                              octaves_per_bucket, tolerance);
+  rebuildScaleBuckets();
+}
+
+void RestorerByCloud::disableScaleBuckets()
+{
+  scale_index.reset();
+}
+
+bool RestorerByCloud::isScaleBucketsEnabled() const
+{
+  return static_cast<bool>(scale_index);
+}
+
+void RestorerByCloud::rebuildScaleBuckets()
+{
+  if (!scale_index)
+  {
+    return;
+  }
+
+  scale_index->clear();
+  for (size_t frame_num = 0; frame_num < frames_key_points.size();
+       frame_num++)
+  {
+    scale_index->addFrame(frames_key_points[frame_num],
+                          frames_descriptions[frame_num]);
+  }
+  scale_index->train();
+
+  std::clog << "RestorerByCloud: cloud is split into " <<
+               scale_index->getBucketsCount() << " scale buckets" << std::endl;
+}
+
+std::vector<FeatureBasedRestorer::QueryResult> RestorerByCloud::queryBatch(
+                          const std::vector<KeyPointsList> &frames_key_points,
+                          const std::vector<cv::Mat> &frames_descriptions,
+                          const std::vector<cv::Rect2f> &frames_rects) const
+{
+  if (isRetrieverEnabled())
+  {
+    return FeatureBasedRestorer::queryBatch(frames_key_points,
+                                            frames_descriptions,
+                                            frames_rects);
+  }
+
+  //rows of frame i are [first_rows[i], first_rows[i + 1])
+  std::vector<int> first_rows(1, 0);
+  std::vector<cv::Mat> non_empty_descriptions;
+  for (size_t frame_num = 0; frame_num < frames_descriptions.size();
+       frame_num++)
+  {
+    const cv::Mat &descriptions = frames_descriptions[frame_num];
+    int rows = frames_key_points[frame_num].empty()? 0: descriptions.rows;
+    if (rows != 0)
+    {
+      non_empty_descriptions.push_back(descriptions);
+    }
+    first_rows.push_back(first_rows.back() + rows);
+  }
+
+  const bool is_traced = static_cast<bool>(getTrace());
+  RestorerTrace::Clock::time_point start;
+  if (is_traced)
+  {
+    start = RestorerTrace::Clock::now();
+  }
+
+  MatchesList all_matches;
+  if (!non_empty_descriptions.empty())
+  {
+    cv::Mat all_descriptions;
+    cv::vconcat(non_empty_descriptions, all_descriptions);
+    descriptor_index->match(all_descriptions, all_matches);
+  }
+
+  //matches are sorted by queryIdx, so split them to frames
+  std::vector<MatchesList> frames_matches(frames_descriptions.size());
+  size_t frame_num = 0;
+  for (cv::DMatch match: all_matches)
+  {
+    while (match.queryIdx >= first_rows[frame_num + 1])
+    {
+      frame_num++;
+    }
+    match.queryIdx -= first_rows[frame_num];
+    frames_matches[frame_num].push_back(match);
+  }
+
+  //the batch is matched at once, so each query gets the average time
+  float match_ms = 0;
+  if (is_traced && !frames_matches.empty())
+  {
+    match_ms = RestorerTrace::elapsedMs(start) / frames_matches.size();
+  }
+
+  std::vector<QueryResult> results(frames_matches.size());
+  utils::cv::parallelFor(results.size(), [&](size_t frame_num)
+  {
+    results[frame_num] = verifyMatches(frames_key_points[frame_num],
+                                       frames_matches[frame_num],
+                                       frames_rects[frame_num], match_ms);
+  });
+
+  return results;
+}
+
+void RestorerByCloud::matchCloud(const cv::Mat &descriptions,
+                                 FeatureBasedRestorer::MatchesList &rough_matches) const
+{
+  rough_matches.clear();
+  if (isRetrieverEnabled())
+  {//match only with the most similar frames instead of the whole cloud
+    std::vector<size_t> frames = retrieveFrames(descriptions);
+    if (!frames.empty())
+    {
+      cv::BFMatcher frames_matcher(getDescriptor()->defaultNorm());
+      for (size_t frame_num: frames)
+      {
+        frames_matcher.add(getFrameDescriptions(frame_num));
+      }
+      frames_matcher.match(descriptions, rough_matches);
+
+      for (auto &match: rough_matches)
+      {
+        match.imgIdx = frames[match.imgIdx];
+      }
+    }
   }
+  else
+  {
+    descriptor_index->match(descriptions, rough_matches);
+  }
+}
 
-  getMatcher()->match(query_descriptions, rough_matches);
-  std::cout << getMatcher()->getTrainDescriptors().size() << std::endl;
+FeatureBasedRestorer::QueryResult RestorerByCloud::verifyMatches(
+                          const FeatureBasedRestorer::KeyPointsList &key_points,
+                          const FeatureBasedRestorer::MatchesList &rough_matches,
+                          const cv::Rect2f &frame_rect,
+                          float match_ms) const
+{
+  //points for estimateTransformation, reused by the calling thread
+  thread_local std::vector<cv::Point2f> query_pts;
+  thread_local std::vector<cv::Point2f> train_pts;
+  thread_local std::vector<char> mask;
+  thread_local std::vector<float> rotations;
+  thread_local std::vector<float> log_scales;
+
+  QueryResult result;
+  result.angle = result.scale = result.confidence = 0;
+  if (key_points.empty())
+  {
+    return result;
+  }
 
+  const bool is_traced = static_cast<bool>(getTrace());
+  RestorerTrace::Clock::time_point start;
+  if (is_traced)
+  {
+    start = RestorerTrace::Clock::now();
+  }
 
   train_pts.clear();
   query_pts.clear();
   for (const cv::DMatch &match: rough_matches)
   {
     train_pts.push_back(frames_key_points[match.imgIdx][match.trainIdx].pt);
-    query_pts.push_back(query_key_points[match.queryIdx].pt);
+    query_pts.push_back(key_points[match.queryIdx].pt);
+  }
+
+  rotations.clear();
+  log_scales.clear();
+  if (isHoughPreVotingEnabled())
+  {
+    for (const cv::DMatch &match: rough_matches)
+    {
+      rotations.push_back(0);
+      log_scales.push_back(0);
+      HoughPreVoter::relativePose(key_points[match.queryIdx],
+                                  frames_key_points[match.imgIdx][match.trainIdx],
+                                  rotations.back(), log_scales.back());
+    }
   }
 
-  homography_mask.clear();
-  homography = cv::findHomography(query_pts, train_pts,
-                                         cv::RANSAC, 3, homography_mask);
+  mask.clear();
+  result.homography = estimateTransformation(query_pts, train_pts,
+                                             rotations, log_scales,
+                                             rough_matches, mask);
 
-  if (!homography.empty())
+  if (!result.homography.empty())
   {
     cv::Point2f shift;
-    Transformator::getParams(homography, shift, angle, scale);
+    Transformator::getParams(result.homography, shift, result.angle,
+                             result.scale);
 
     cv::Point2f que_center = (frame_rect.tl() + frame_rect.br()) / 2.;
-    pos =  Transformator::transform(que_center, homography);
+    result.pos = Transformator::transform(que_center, result.homography);
 
-    matches.clear();
-    for (size_t i = 0; i < homography_mask.size(); i++)
+    for (size_t i = 0; i < mask.size(); i++)
     {
-      if (homography_mask[i])
+      if (mask[i])
       {
-        matches.push_back(rough_matches[i]);
+        result.matches.push_back(rough_matches[i]);
       }
     }
 
-    return calculateConfidence();
+    result.confidence = calculateConfidence(result.matches.size(),
+                                            rough_matches.size());
   }
-  else
-  {
-    pos = cv::Point2f(0, 0);
-    angle = scale = 0;
 
-    return 0;
+  if (is_traced)
+  {
+    TraceRecord record;
+    record.query_num = getTrace()->beginQuery();
+    record.group = 0;
+    record.frame_num = -1;
+    record.matches_count = rough_matches.size();
+    record.inliers_count = result.matches.size();
+    record.mask_confidence = result.confidence;
+    record.area_confidence = 0;
+    record.scale = result.scale;
+    record.match_ms = match_ms;
+    record.estimate_ms = RestorerTrace::elapsedMs(start);
+    record.reserved = 0;
+
+    getTrace()->record(record);
   }
+
+  return result;
 }
 
+void RestorerByCloud::train()
+{
+  descriptor_index->train();
+  if (scale_index)
+  {
+    scale_index->train();
+  }
+}
 
-double RestorerByCloud::calculateConfidence() const noexcept
+double RestorerByCloud::calculateConfidence(size_t inliers_count,
+                                            size_t matches_count) noexcept
 {
-  if (!rough_matches.empty())
+  if (matches_count != 0)
   {
-    return matches.size() / double(rough_matches.size());
+    return inliers_count / double(matches_count);
   }
   else
   {
@@ -137,6 +375,62 @@ double RestorerByCloud::calculateConfidence() const noexcept
   }
 }
 
+size_t RestorerByCloud::deduplicate(double radius, double max_distance)
+{
+  KeyPointsDeduplicator deduplicator(radius, max_distance,
+                                     getDescriptor()->defaultNorm());
+  std::vector<std::vector<size_t>> kept;
+  std::vector<std::vector<int>> observations;
+  size_t kept_count = deduplicator.deduplicate(frames_key_points,
+                                               frames_descriptions,
+                                               kept, observations);
+
+  size_t removed_count = 0;
+  for (size_t frame_num = 0; frame_num < frames_key_points.size();
+       frame_num++)
+  {
+    KeyPointsList key_points;
+    cv::Mat descriptions;
+    for (size_t kp_num: kept[frame_num])
+    {
+      key_points.push_back(frames_key_points[frame_num][kp_num]);
+      descriptions.push_back(frames_descriptions[frame_num].row(kp_num));
+    }
+    removed_count += frames_key_points[frame_num].size() - key_points.size();
+
+    frames_key_points[frame_num].swap(key_points);
+    frames_descriptions[frame_num] = descriptions;
+  }
+  frames_observations.swap(observations);
+
+  //descriptions are copied, so bundle isn't needed anymore
+  map_bundle.reset();
+  descriptor_index->clear();
+  for (const auto &descriptions: frames_descriptions)
+  {
+    descriptor_index->add(descriptions);
+  }
+  descriptor_index->train();
+  rebuildScaleBuckets();
+
+  std::clog << "RestorerByCloud: " << kept_count << " key points are kept, " <<
+               removed_count << " duplicates are removed" << std::endl;
+
+  return removed_count;
+}
+
+const std::vector<int>& RestorerByCloud::getFrameObservations(
+                                                      size_t frame_num) const
+{
+  static const std::vector<int> empty;
+  if (frame_num >= frames_observations.size())
+  {
+    return empty;
+  }
+
+  return frames_observations[frame_num];
+}
+
 size_t RestorerByCloud::getFramesCount() const
 {
   return frames_key_points.size();
@@ -151,15 +445,89 @@ const FeatureBasedRestorer::KeyPointsList&
 const cv::Mat&
             RestorerByCloud::getFrameDescriptions(size_t frame_num) const
 {
-  return getMatcher()->getTrainDescriptors()[frame_num];
+  return frames_descriptions[frame_num];
 }
 
 void RestorerByCloud::save(std::string filename)
 {
-  std::clog << "No implementation for saving restorerByCloud" << std::endl;
+  bool has_index = false;
+  descriptor_index->train();
+  MatcherPtr trained_matcher = descriptor_index->getTrainedMatcher();
+  auto flann_matcher = trained_matcher.dynamicCast<SaveableFlannMatcher>();
+  auto mih_matcher = trained_matcher.dynamicCast<MultiIndexHashingMatcher>();
+  if (flann_matcher && !flann_matcher->empty())
+  {
+    flann_matcher->writeIndex(filename + ".flann");
+    has_index = true;
+  }
+  else if (mih_matcher && !mih_matcher->empty())
+  {
+    mih_matcher->writeIndex(filename + ".mih");
+    has_index = true;
+  }
+
+  MapBundle::write(filename, MapBundle::BY_CLOUD,
+                   frames_key_points, frames_descriptions,
+                   std::vector<MapBundle::FramePolygon>(),
+                   std::vector<double>(), has_index, getMapSource());
 }
 
 void RestorerByCloud::load(std::string filename)
 {
-  std::clog << "No implementation for loading restorerByCloud" << std::endl;
+  auto bundle = std::make_shared<MapBundle>(filename);
+  if (bundle->getKind() != MapBundle::BY_CLOUD)
+  {
+    throw MapBundle::Exception("Not a RestorerByCloud bundle: " + filename);
+  }
+
+  //frames are read aside, so a corrupted bundle doesn't replace the map
+  std::vector<KeyPointsList> new_key_points;
+  std::vector<cv::Mat> new_descriptions;
+  for (size_t frame_num = 0; frame_num < bundle->getFramesCount(); frame_num++)
+  {
+    new_key_points.push_back(bundle->getKeyPoints(frame_num));
+    new_descriptions.push_back(bundle->getDescriptions(frame_num));
+  }
+  MatcherPtr matcher = getMatcher()->clone(true);
+  matcher->add(new_descriptions);
+
+  auto flann_matcher = matcher.dynamicCast<SaveableFlannMatcher>();
+  auto mih_matcher = matcher.dynamicCast<MultiIndexHashingMatcher>();
+  bool index_is_read = false;
+  if (bundle->hasIndex() && flann_matcher &&
+      std::ifstream(filename + ".flann"))
+  {
+    flann_matcher->readIndex(filename + ".flann");
+    index_is_read = true;
+  }
+  else if (bundle->hasIndex() && mih_matcher &&
+           std::ifstream(filename + ".mih"))
+  {
+    try
+    {
+      mih_matcher->readIndex(filename + ".mih");
+      index_is_read = true;
+    }
+    catch (MultiIndexHashingMatcher::Exception &e)
+    {
+      std::clog << e.what() << std::endl;
+    }
+  }
+
+  if (!index_is_read)
+  {
+    std::clog << "RestorerByCloud: saved index isn't used, "
+                 "matcher will be trained" << std::endl;
+    matcher->train();
+  }
+
+  frames_key_points.swap(new_key_points);
+  frames_descriptions.swap(new_descriptions);
+  frames_observations.clear();
+  disableRetriever();
+  setMapSource(bundle->getSource());
+  descriptor_index->reset(frames_descriptions, matcher);
+  rebuildScaleBuckets();
+
+  map_bundle = bundle;
 }
@@ -1,11 +1,21 @@
 #ifndef RESTORER_BY_CLOUD_H
 #define RESTORER_BY_CLOUD_H
 
+#include <memory>
+
 #include "feature_based_restorer.h"
+#include "map_bundle.h"
+#include "incremental_descriptor_index.h"
+#include "scale_bucketed_index.h"
 
 namespace algorithmspkg
 {
 
+/**
+ * @brief The RestorerByCloud class - matches query with the whole cloud of
+ * key points. Frames may be added between queries (during flight), the
+ * matcher index is updated incrementally (see IncrementalDescriptorIndex).
+ */
 class RestorerByCloud : public FeatureBasedRestorer
 {
 public:
@@ -23,22 +33,108 @@ public:
                 const cv::Mat &descriptions,
                 const cv::Point2f &pos, double angle, double scale) override;
 
-  double recoverLocation(const cv::Rect2f &frame_rect, cv::Point2f &pos,
-                                 double &angle, double &scale) override;
+  using FeatureBasedRestorer::query;
+  QueryResult query(const KeyPointsList &key_points,
+                    const cv::Mat &descriptions,
+                    const cv::Rect2f &frame_rect) const override;
+
+  /**
+   * @brief queryBatch - descriptions of all frames are matched with the cloud
+   * by one search, then matches are verified in parallel. Frames are queried
+   * independently if retriever is enabled.
+   */
+  std::vector<QueryResult> queryBatch(
+                          const std::vector<KeyPointsList> &frames_key_points,
+                          const std::vector<cv::Mat> &frames_descriptions,
+                          const std::vector<cv::Rect2f> &frames_rects) const override;
+
+  /**
+   * @brief queryAtScale - matches key points only with key points of the
+   *                       cloud of compatible metric size (see
+   *                       enableScaleBuckets), as query if not enabled
+   * @param m_per_px - known or estimated scale of query frame
+   */
+  QueryResult queryAtScale(const KeyPointsList &key_points,
+                           const cv::Mat &descriptions,
+                           const cv::Rect2f &frame_rect,
+                           double m_per_px) const;
+
+  /**
+   * @brief enableScaleBuckets - partitions the cloud by metric size of key
+   * points (see ScaleBucketedIndex), frames added later are partitioned too.
+   * Buckets keep own copies of descriptions and aren't saved to bundle.
+   * @param octaves_per_bucket - width of bucket, log2 of sizes ratio
+   * @param tolerance - count of neighbour buckets matched on each side
+   */
+  void enableScaleBuckets(double octaves_per_bucket = 1., int tolerance = 1);
+  void disableScaleBuckets();
+  bool isScaleBucketsEnabled() const;
+
+  /**
+   * @brief train - merges frames added since the last training into index
+   */
+  void train() override;
+
+  /**
+   * @brief deduplicate - keeps one representative of each ground feature
+   * observed by several frames (see KeyPointsDeduplicator) and rebuilds
+   * the index. Observations counts aren't saved to bundle.
+   * @param radius - max distance between observations in preffered units
+   * @param max_distance - max distance between descriptions
+   * @return count of removed key points
+   */
+  size_t deduplicate(double radius, double max_distance);
+  /**
+   * @brief getFrameObservations - count of observations of each key point
+   *                               of frame, empty if map isn't deduplicated
+   */
+  const std::vector<int>& getFrameObservations(size_t frame_num) const;
 
   size_t getFramesCount() const override;
   const KeyPointsList& getFrameKeyPoints(size_t frame_num) const override;
   const cv::Mat& getFrameDescriptions(size_t frame_num) const override;
 
+  /**
+   * @brief save - writes cloud to binary bundle (see MapBundle), trained
+   *               index of SaveableFlannMatcher is written to filename.flann,
+   *               of MultiIndexHashingMatcher to filename.mih
+   */
   void save(std::string filename) override;
+  /**
+   * @brief load - replaces cloud by cloud from bundle, descriptions stay
+   *               memory mapped, saved index is read instead of training.
+   *               The cloud isn't changed if the bundle can't be read
+   */
   void load(std::string filename) override;
 private:
-  double calculateConfidence() const noexcept;
-  std::vector<char> homography_mask;
+  /**
+   * @brief rebuildScaleBuckets - partitions all frames again if enabled
+   */
+  void rebuildScaleBuckets();
+  /**
+   * @brief matchCloud - matches descriptions with the cloud or with the most
+   *                     similar frames if retriever is enabled
+   */
+  void matchCloud(const cv::Mat &descriptions, MatchesList &rough_matches) const;
+  /**
+   * @brief verifyMatches - estimates transformation of query to the cloud
+   * @param match_ms - time of matching for trace
+   */
+  QueryResult verifyMatches(const KeyPointsList &key_points,
+                            const MatchesList &rough_matches,
+                            const cv::Rect2f &frame_rect,
+                            float match_ms) const;
+  static double calculateConfidence(size_t inliers_count,
+                                    size_t matches_count) noexcept;
 
   std::vector<KeyPointsList>  frames_key_points;
+  std::vector<cv::Mat>        frames_descriptions;
+  std::vector<std::vector<int>> frames_observations;
+
+  std::shared_ptr<IncrementalDescriptorIndex> descriptor_index;
+  std::shared_ptr<ScaleBucketedIndex>         scale_index; //null if disabled
 
-  MatchesList rough_matches;
+  std::shared_ptr<MapBundle>  map_bundle; //keeps loaded descriptions mapped
 };
 
 }
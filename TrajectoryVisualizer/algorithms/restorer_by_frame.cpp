@@ -1,16 +1,13 @@
 #include "restorer_by_frame.h"
 
 #include <algorithm>
-#include <iostream>
-#include <fstream>
+#include <numeric>
 
-#include <QPolygonF>
-
-#include <opencv2/calib3d.hpp>
 #include <opencv2/imgproc.hpp>
 
 #include "algorithms/transformator.h"
-#include "utils/gradient_density.h"
+#include "utils/convex_polygon.h"
+#include "utils/parallel_for.h"
 
 using namespace algorithmspkg;
 using namespace std;
@@ -20,7 +17,8 @@ RestorerByFrame::RestorerByFrame(DetectorPtr detector,
                                  MatcherPtr matcher,
                                  size_t max_key_points_per_frame)
   : FeatureBasedRestorer(detector, descriptor, matcher,
-                         max_key_points_per_frame)
+                         max_key_points_per_frame),
+    rtree_removed(0), has_pose_prior(false), prior_radius(0)
 {
 }
 
@@ -31,25 +29,13 @@ void RestorerByFrame::addFrame(const cv::Mat &frame,
   frames_key_points.push_back(KeyPointsList());
   std::vector<cv::KeyPoint> &key_points = frames_key_points.back();
 
-  getDetector()->detect(frame, frames_key_points.back());
-
-  std::sort(key_points.begin(), key_points.end(),
-            []( const cv::KeyPoint &left, const cv::KeyPoint &right ) ->
-            bool { return left.response > right.response; });
-
-  if (getMaxKeyPointsPerFrame() != 0 &&
-      getMaxKeyPointsPerFrame() < key_points.size())
-  {
-    key_points.resize(getMaxKeyPointsPerFrame());
-  }
-  key_points.shrink_to_fit();
-
   cv::Mat descriptions;
-  getDescriptor()->compute(frame, frames_key_points.back(),
-                     descriptions);
+  extractFeatures(frame, key_points, descriptions, getMaxKeyPointsPerFrame());
+  key_points.shrink_to_fit();
 
   matchers.push_back(getMatcher()->clone(true));
   matchers.back()->add(descriptions);
+  addFrameSignature(descriptions);
 
   cv::Point2f image_center(frame.cols/2., frame.rows/2.);
   transformKeyPointsPosition(key_points, image_center,
@@ -57,7 +43,8 @@ void RestorerByFrame::addFrame(const cv::Mat &frame,
 
   frames_polygons.push_back(calculateFramePolygon(image_center, pos, angle,
                                                   scale));
-  frames_area.push_back(cv::contourArea(frames_polygons.back()));
+  frames_area.push_back(utils::cv::polygonArea(frames_polygons.back()));
+  frames_rtree.insert(frames_polygons.back());
 }
 
 void RestorerByFrame::addFrame(const cv::Point2f &image_center,
@@ -69,115 +56,298 @@ void RestorerByFrame::addFrame(const cv::Point2f &image_center,
   frames_key_points.push_back(key_points);
   matchers.push_back(getMatcher()->clone(true));
   matchers.back()->add(descriptions);
+  addFrameSignature(descriptions);
 
   transformKeyPointsPosition(frames_key_points.back(), image_center,
                              pos, angle, scale);
 
   frames_polygons.push_back(calculateFramePolygon(image_center, pos, angle,
                                                   scale));
-  frames_area.push_back(cv::contourArea(frames_polygons.back()));
+  frames_area.push_back(utils::cv::polygonArea(frames_polygons.back()));
+  frames_rtree.insert(frames_polygons.back());
 }
 
-double RestorerByFrame::recoverLocation(const cv::Rect2f &que_frame_rect,
-                                        cv::Point2f &pos,
-                                        double &angle, double &scale)
+FeatureBasedRestorer::QueryResult RestorerByFrame::query(
+                                      const KeyPointsList &key_points,
+                                      const cv::Mat &descriptions,
+                                      const cv::Rect2f &que_frame_rect) const
 {
-  //points for findHomography
-  static std::vector<cv::Point2f> query_pts;
-  static std::vector<cv::Point2f> train_pts;
-  auto best_homography = cv::Mat();
+  QueryResult result;
+  result.angle = result.scale = result.confidence = 0;
 
-  pos = cv::Point2f(0, 0);
-  angle = scale = 0;
-  matches.clear();
-
-  if (query_key_points.empty())
+  if (key_points.empty())
   {
-    return 0;
+    return result;
   }
 
   double max_confidence = 0;
+  size_t best_num = 0;
+  const bool is_traced = static_cast<bool>(getTrace());
+
+  const std::vector<size_t> candidate_frames =
+                                           selectCandidateFrames(descriptions);
+  std::vector<FrameEstimate> estimates(candidate_frames.size());
+  thread_local MatchesList rough_matches;
+  for (size_t candidate_num = 0; candidate_num < candidate_frames.size();
+       candidate_num++)
+  {
+    const size_t frame_num = candidate_frames[candidate_num];
+    RestorerTrace::Clock::time_point match_start;
+    if (is_traced)
+    {
+      match_start = RestorerTrace::Clock::now();
+    }
+    matchFrame(frame_num, descriptions, rough_matches);
+    float match_ms = is_traced? RestorerTrace::elapsedMs(match_start): 0;
+
+    estimates[candidate_num] = verifyMatches(frame_num, key_points,
+                                             rough_matches, que_frame_rect);
+    estimates[candidate_num].match_ms = match_ms;
+
+    if (estimates[candidate_num].area_confidence > max_confidence)
+    {
+      best_num = candidate_num;
+      max_confidence = estimates[candidate_num].area_confidence;
+    }
+  }
 
-  std::ofstream maskConfidenceOut("_maskConfidence.csv", ios_base::app);
-  std::ofstream areaConfidenceOut("_areaConfidence.csv", ios_base::app);
-  std::ofstream scalesOut("_scales.csv", ios_base::app);
+  if (is_traced)
+  {
+    traceEstimates(getTrace()->beginQuery(), 0, estimates);
+  }
 
-  for (size_t frame_num = 0; frame_num < matchers.size(); frame_num++)
+  if (max_confidence > 0)
   {
-    rough_matches.clear();
-    matchers[frame_num]->match(query_descriptions, rough_matches);
+    result = resultFromEstimate(estimates[best_num], que_frame_rect);
+  }
 
+  return result;
+}
 
-    train_pts.clear();
-    query_pts.clear();
-    for (const cv::DMatch &match: rough_matches)
+void RestorerByFrame::train()
+{
+  frames_rtree.build();
+  //matchers are independent, so indices of frames are built in parallel
+  utils::cv::parallelFor(matchers.size(), [this](size_t frame_num)
+  {
+    matchers[frame_num]->train();
+  });
+}
+
+std::vector<size_t> RestorerByFrame::selectCandidateFrames(
+                                          const cv::Mat &descriptions) const
+{
+  std::vector<size_t> candidates;
+  if (!has_pose_prior)
+  {
+    if (isRetrieverEnabled())
     {
-      train_pts.push_back(frames_key_points[frame_num][match.trainIdx].pt);
-      query_pts.push_back(query_key_points[match.queryIdx].pt);
+      return retrieveFrames(descriptions);
     }
+    candidates.resize(matchers.size());
+    std::iota(candidates.begin(), candidates.end(), 0);
+    return candidates;
+  }
 
-    homography_mask.clear();
-    homography = cv::findHomography(query_pts, train_pts,
-                                           cv::RANSAC, 3, homography_mask);
+  const float radius = prior_radius;
+  cv::Rect2f prior_region(prior_pos - cv::Point2f(radius, radius),
+                          prior_pos + cv::Point2f(radius, radius));
+  frames_rtree.query(prior_region, candidates);
 
-    cv::Point2f shift;
-    double angle_temp;
-    double scale_temp;
-    Transformator::getParams(homography, shift, angle_temp, scale_temp);
+  //ids of the tree are shifted by frames removed after it was filled
+  candidates.erase(candidates.begin(),
+                   std::lower_bound(candidates.begin(), candidates.end(),
+                                    rtree_removed));
+  for (size_t &candidate: candidates)
+  {
+    candidate -= rtree_removed;
+  }
+
+  //boxes are only rough approximation of rotated footprints
+  auto is_far = [this](size_t frame_num) -> bool
+  {
+    double signed_dist = cv::pointPolygonTest(frames_polygons[frame_num],
+                                              prior_pos, true);
+    return signed_dist < -prior_radius;
+  };
+  candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                  is_far),
+                   candidates.end());
+
+  if (isRetrieverEnabled())
+  {
+    return retrieveFrames(descriptions, candidates);
+  }
 
-    double maskConfidence = calculateMaskConfidence();
-    double areaConfidence = calculateAreaConfidence(que_frame_rect, frame_num);
+  return candidates;
+}
 
-    maskConfidenceOut << maskConfidence;
-    areaConfidenceOut << areaConfidence;
-    scalesOut << scale_temp;
-    if (frame_num + 1 != matchers.size())
+void RestorerByFrame::removeFirstFrame()
+{
+  if (frames_key_points.empty())
+  {
+    return;
+  }
+
+  frames_key_points.pop_front();
+  matchers.pop_front();
+  frames_polygons.pop_front();
+  frames_area.pop_front();
+  removeFirstFrameSignature();
+
+  //the tree is refilled only when removed frames outnumber the remaining
+  rtree_removed++;
+  if (rtree_removed > frames_polygons.size())
+  {
+    frames_rtree.clear();
+    for (const FramePolygon &polygon: frames_polygons)
     {
-      maskConfidenceOut << ", ";
-      areaConfidenceOut << ", ";
-      scalesOut << ", ";
+      frames_rtree.insert(polygon);
     }
+    frames_rtree.build();
+    rtree_removed = 0;
+  }
+}
 
-    if (areaConfidence > max_confidence)
+void RestorerByFrame::matchFrame(size_t frame_num,
+                                 const cv::Mat &descriptions,
+                                 FeatureBasedRestorer::MatchesList &rough_matches) const
+{
+  rough_matches.clear();
+  matchers[frame_num]->match(descriptions, rough_matches);
+}
+
+RestorerByFrame::FrameEstimate RestorerByFrame::verifyMatches(
+                      size_t frame_num,
+                      const FeatureBasedRestorer::KeyPointsList &key_points,
+                      const FeatureBasedRestorer::MatchesList &rough_matches,
+                      const cv::Rect2f &que_frame_rect) const
+{
+  //points for estimateTransformation, reused by the calling thread
+  thread_local std::vector<cv::Point2f> query_pts;
+  thread_local std::vector<cv::Point2f> train_pts;
+  thread_local std::vector<char> mask;
+  thread_local std::vector<float> rotations;
+  thread_local std::vector<float> log_scales;
+  query_pts.clear();
+  train_pts.clear();
+  for (const cv::DMatch &match: rough_matches)
+  {
+    train_pts.push_back(frames_key_points[frame_num][match.trainIdx].pt);
+    query_pts.push_back(key_points[match.queryIdx].pt);
+  }
+
+  rotations.clear();
+  log_scales.clear();
+  if (isHoughPreVotingEnabled())
+  {
+    for (const cv::DMatch &match: rough_matches)
     {
-      cv::Point2f shift;
-      Transformator::getParams(homography, shift, angle, scale);
-      cv::Point2f que_center = (que_frame_rect.tl() + que_frame_rect.br()) / 2.;
-      pos =  Transformator::transform(que_center, homography);
-
-      homography.copyTo(best_homography);
-
-      matches.clear();
-      for (size_t i = 0; i < homography_mask.size(); i++)
-      {
-        if (homography_mask[i])
-        {
-          matches.push_back(rough_matches[i]);
-          matches.back().imgIdx = frame_num;
-        }
-      }
-
-      max_confidence = areaConfidence;
+      rotations.push_back(0);
+      log_scales.push_back(0);
+      HoughPreVoter::relativePose(key_points[match.queryIdx],
+                                  frames_key_points[frame_num][match.trainIdx],
+                                  rotations.back(), log_scales.back());
     }
   }
 
-  maskConfidenceOut << endl;
-  areaConfidenceOut << endl;
-  scalesOut << endl;
+  FrameEstimate estimate;
+  estimate.frame_num = frame_num;
+  estimate.matches_count = rough_matches.size();
+  estimate.match_ms = 0;
+  estimate.estimate_ms = 0;
 
-  best_homography.copyTo(homography);
+  const bool is_traced = static_cast<bool>(getTrace());
+  RestorerTrace::Clock::time_point estimate_start;
+  if (is_traced)
+  {
+    estimate_start = RestorerTrace::Clock::now();
+  }
+
+  estimate.homography = estimateTransformation(query_pts, train_pts,
+                                               rotations, log_scales,
+                                               rough_matches, mask);
+
+  cv::Point2f shift;
+  double angle = 0;
+  Transformator::getParams(estimate.homography, shift, angle, estimate.scale);
 
-  return max_confidence;
+  estimate.mask_confidence = calculateMaskConfidence(mask);
+  estimate.area_confidence = calculateAreaConfidence(que_frame_rect,
+                                                     frame_num,
+                                                     estimate.homography);
+
+  for (size_t i = 0; i < mask.size(); i++)
+  {
+    if (mask[i])
+    {
+      estimate.inliers.push_back(rough_matches[i]);
+      estimate.inliers.back().imgIdx = frame_num;
+    }
+  }
+
+  if (is_traced)
+  {
+    estimate.estimate_ms = RestorerTrace::elapsedMs(estimate_start);
+  }
+
+  return estimate;
+}
+
+FeatureBasedRestorer::QueryResult RestorerByFrame::resultFromEstimate(
+                                      const RestorerByFrame::FrameEstimate &estimate,
+                                      const cv::Rect2f &que_frame_rect)
+{
+  QueryResult result;
+  result.confidence = estimate.area_confidence;
+  result.homography = estimate.homography.clone();
+  result.matches = estimate.inliers;
+
+  cv::Point2f shift;
+  Transformator::getParams(result.homography, shift, result.angle,
+                           result.scale);
+  cv::Point2f que_center = (que_frame_rect.tl() + que_frame_rect.br()) / 2.;
+  result.pos = Transformator::transform(que_center, result.homography);
+
+  return result;
 }
 
-double RestorerByFrame::calculateMaskConfidence() const noexcept
+void RestorerByFrame::traceEstimates(uint64_t query_num, int group,
+                           const std::vector<FrameEstimate> &estimates) const
+{
+  RestorerTrace *trace = getTrace().get();
+  if (trace == nullptr)
+  {
+    return;
+  }
+
+  for (const FrameEstimate &estimate: estimates)
+  {
+    TraceRecord record;
+    record.query_num = query_num;
+    record.group = group;
+    record.frame_num = estimate.frame_num;
+    record.matches_count = estimate.matches_count;
+    record.inliers_count = estimate.inliers.size();
+    record.mask_confidence = estimate.mask_confidence;
+    record.area_confidence = estimate.area_confidence;
+    record.scale = estimate.scale;
+    record.match_ms = estimate.match_ms;
+    record.estimate_ms = estimate.estimate_ms;
+    record.reserved = 0;
+
+    trace->record(record);
+  }
+}
+
+double RestorerByFrame::calculateMaskConfidence(const std::vector<char> &mask)
 {
   // confidence based on homograhy_mask
-  if (!homography_mask.empty())
+  if (!mask.empty())
   {
-    size_t count = std::count_if(homography_mask.begin(), homography_mask.end(),
+    size_t count = std::count_if(mask.begin(), mask.end(),
                         [] (char x) -> bool { return static_cast<bool>(x); });
-    return count / double(homography_mask.size());
+    return count / double(mask.size());
   }
   else
   {
@@ -186,50 +356,18 @@ double RestorerByFrame::calculateMaskConfidence() const noexcept
 }
 
 double RestorerByFrame::calculateAreaConfidence(
-    const cv::Rect2f &query_frame_rect, int base_frame_num) const
+    const cv::Rect2f &query_frame_rect, int base_frame_num,
+    const cv::Mat &homography) const
 {
-  cv::Point2f shift(0, 0);
-  double angle = 0;
-  double scale = 0;
-  Transformator::getParams(homography, shift, angle, scale);
-
   if (!homography.empty())
   {
     FramePolygon query_frame_polygon = calculateFramePolygon(query_frame_rect,
                                                              homography);
     const auto &base_frame_polygon = frames_polygons[base_frame_num];
 
-    //calculate intersection with QPointF
-    QPolygonF query;
-    for (const auto &pt: query_frame_polygon)
-    {
-      query << utils::cv::toQPointF(pt);
-    }
-    //query << utils::cv::toQPointF(query_frame_polygon[0]);
-
-    QPolygonF base;
-    for (const auto &pt: base_frame_polygon)
-    {
-      base << utils::cv::toQPointF(pt);
-    }
-    //compared << utils::cv::toQPointF(compared_frame_polygon[0]);
-
-    QPolygonF intersection = base.intersected(query);
-
-    std::vector<cv::Point2f> inter_contour;
-    for (const auto &pt: intersection.toStdVector())
-    {
-      inter_contour.push_back(utils::cv::toPoint2f(pt));
-    }
-
-    if (inter_contour.size() == 0)
-    {
-      std::cout << "No intersection" << std::endl;
-      return 0;
-    }
-
-
-    double inter_area = cv::contourArea(inter_contour);
+    //footprints are convex quadrilaterals unless homography is degenerate
+    double inter_area = utils::cv::convexIntersectionArea(query_frame_polygon,
+                                                          base_frame_polygon);
     return inter_area / frames_area[base_frame_num];
   }
   else
@@ -296,15 +434,81 @@ const FeatureBasedRestorer::KeyPointsList&
 const cv::Mat&
             RestorerByFrame::getFrameDescriptions(size_t frame_num) const
 {
-  return getMatcher()->getTrainDescriptors()[frame_num];
+  return matchers[frame_num]->getTrainDescriptors().front();
+}
+
+void RestorerByFrame::setPosePrior(const cv::Point2f &pos, double radius)
+{
+  has_pose_prior = true;
+  prior_pos = pos;
+  prior_radius = radius;
+}
+
+void RestorerByFrame::resetPosePrior()
+{
+  has_pose_prior = false;
+}
+
+bool RestorerByFrame::hasPosePrior() const
+{
+  return has_pose_prior;
 }
 
 void RestorerByFrame::save(std::string filename)
 {
-  std::clog << "No implementation for saving RestorerByFrame" << std::endl;
+  std::vector<cv::Mat> frames_descriptions;
+  for (size_t frame_num = 0; frame_num < getFramesCount(); frame_num++)
+  {
+    frames_descriptions.push_back(getFrameDescriptions(frame_num));
+  }
+
+  MapBundle::write(filename, MapBundle::BY_FRAME,
+                   std::vector<KeyPointsList>(frames_key_points.begin(),
+                                              frames_key_points.end()),
+                   frames_descriptions,
+                   std::vector<FramePolygon>(frames_polygons.begin(),
+                                             frames_polygons.end()),
+                   std::vector<double>(frames_area.begin(),
+                                       frames_area.end()),
+                   false, getMapSource());
 }
 
 void RestorerByFrame::load(std::string filename)
 {
-  std::clog << "No implementation for loading RestorerByFrame" << std::endl;
+  auto bundle = std::make_shared<MapBundle>(filename);
+  if (bundle->getKind() != MapBundle::BY_FRAME || !bundle->hasPolygons())
+  {
+    throw MapBundle::Exception("Not a RestorerByFrame bundle: " + filename);
+  }
+
+  //frames are read aside, so a corrupted bundle doesn't replace the map
+  std::deque<KeyPointsList> new_key_points;
+  std::deque<MatcherPtr> new_matchers;
+  std::deque<FramePolygon> new_polygons;
+  std::deque<double> new_area;
+  for (size_t frame_num = 0; frame_num < bundle->getFramesCount(); frame_num++)
+  {
+    new_key_points.push_back(bundle->getKeyPoints(frame_num));
+    new_matchers.push_back(getMatcher()->clone(true));
+    new_matchers.back()->add(bundle->getDescriptions(frame_num));
+
+    new_polygons.push_back(bundle->getPolygon(frame_num));
+    new_area.push_back(bundle->getArea(frame_num));
+  }
+
+  frames_key_points.swap(new_key_points);
+  matchers.swap(new_matchers);
+  frames_polygons.swap(new_polygons);
+  frames_area.swap(new_area);
+  frames_rtree.clear();
+  for (const FramePolygon &polygon: frames_polygons)
+  {
+    frames_rtree.insert(polygon);
+  }
+  frames_rtree.build();
+  rtree_removed = 0;
+  disableRetriever();
+  setMapSource(bundle->getSource());
+
+  map_bundle = bundle;
 }
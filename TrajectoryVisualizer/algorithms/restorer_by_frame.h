@@ -1,7 +1,12 @@
 #ifndef RESTORER_BY_FRAME_H
 #define RESTORER_BY_FRAME_H
 
+#include <deque>
+#include <memory>
+
 #include "feature_based_restorer.h"
+#include "polygons_rtree.h"
+#include "map_bundle.h"
 
 namespace algorithmspkg
 {
@@ -27,20 +32,113 @@ public:
                 const cv::Mat &descriptions,
                 const cv::Point2f &pos, double angle, double scale) override;
 
-  double recoverLocation(const cv::Rect2f &que_frame_rect,
-                         cv::Point2f &pos, double &angle, double &scale) override;
+  using FeatureBasedRestorer::query;
+  QueryResult query(const KeyPointsList &key_points,
+                    const cv::Mat &descriptions,
+                    const cv::Rect2f &que_frame_rect) const override;
+
+  /**
+   * @brief train - trains matchers of all frames in parallel
+   */
+  void train() override;
 
   size_t getFramesCount() const override;
   const KeyPointsList &getFrameKeyPoints(size_t frame_num) const override;
   const cv::Mat &getFrameDescriptions(size_t frame_num) const override;
 
+  /**
+   * @brief save - writes frames to binary bundle (see MapBundle). Indices
+   *               of matchers aren't saved: cv::flann::Index is written only
+   *               to a named file, so thousands of small per-frame indices
+   *               would cost a file round trip each, which is not cheaper
+   *               than building them by train()
+   */
   void save(std::string filename) override;
+  /**
+   * @brief load - replaces all frames by frames from bundle, descriptions
+   *               stay memory mapped. Frames aren't changed if the bundle
+   *               can't be read
+   */
   void load(std::string filename) override;
 
+  /**
+   * @brief setPosePrior - restricts queries to the frames which footprints
+   *                       intersect the circle around the expected position
+   * @param pos - expected position in preffered units (e.g. previous fix)
+   * @param radius - uncertainty of the position in preffered units
+   */
+  void setPosePrior(const cv::Point2f &pos, double radius);
+  void resetPosePrior();
+  bool hasPosePrior() const;
+
+protected:
+  /**
+   * @brief removeFirstFrame - removes the oldest frame with its matcher,
+   *                           numbers of other frames decrease by one.
+   *                           Amortized O(1), used by sliding windows
+   */
+  void removeFirstFrame();
+
+  /**
+   * @brief The FrameEstimate struct - result of verification of matches
+   *                                   with one frame
+   */
+  struct FrameEstimate
+  {
+    size_t      frame_num;
+    cv::Mat     homography;       //empty if estimation failed
+    MatchesList inliers;          //imgIdx is frame_num
+    double      mask_confidence;  //inliers part of matches
+    double      area_confidence;  //see calculateAreaConfidence
+    double      scale;
+    size_t      matches_count;
+    float       match_ms;         //measured only with trace
+    float       estimate_ms;
+  };
+
+  /**
+   * @brief selectCandidateFrames - frames which will be matched with query
+   * @return all frames or only frames intersected with pose prior,
+   *         if retriever is enabled, then only the most similar of them
+   */
+  std::vector<size_t> selectCandidateFrames(const cv::Mat &descriptions) const;
+
+  /**
+   * @brief matchFrame - matches query descriptions with the frame
+   */
+  void matchFrame(size_t frame_num, const cv::Mat &descriptions,
+                  MatchesList &rough_matches) const;
+
+  /**
+   * @brief verifyMatches - estimates transformation of query to the frame,
+   *                        thread-safe
+   * @param key_points - key points of query
+   * @param rough_matches - matches of query key points with the frame
+   * @param que_frame_rect - part of query which key points were matched
+   */
+  FrameEstimate verifyMatches(size_t frame_num,
+                              const KeyPointsList &key_points,
+                              const MatchesList &rough_matches,
+                              const cv::Rect2f &que_frame_rect) const;
+
+  /**
+   * @brief resultFromEstimate - location of que_frame_rect by the estimate
+   */
+  static QueryResult resultFromEstimate(const FrameEstimate &estimate,
+                                        const cv::Rect2f &que_frame_rect);
+
+  /**
+   * @brief traceEstimates - records estimates to trace if it's enabled
+   * @param group - e.g. part of query which key points were matched
+   */
+  void traceEstimates(uint64_t query_num, int group,
+                      const std::vector<FrameEstimate> &estimates) const;
+
 private:
-  double calculateMaskConfidence() const noexcept;
+  static double calculateMaskConfidence(const std::vector<char> &mask);
   double calculateAreaConfidence(const cv::Rect2f &query_frame_rect,
-                                 int base_frame_num) const;
+                                 int base_frame_num,
+                                 const cv::Mat &homography) const;
   FramePolygon calculateFramePolygon(const cv::Point2f &frame_center,
                                      const cv::Point2f &pos, double angle,
                                      double scale) const;
@@ -52,15 +150,19 @@ private:
   FramePolygon calculateFramePolygon(const cv::Rect2f &frame_rect,
                                      const cv::Mat &homography) const;
 
-  std::vector<char>           homography_mask;
+  std::deque<FramePolygon>    frames_polygons; //in pixels_size*scale
+  std::deque<double>          frames_area;
+  PolygonsRTree               frames_rtree; //over frames_polygons
+  size_t                      rtree_removed; //removed frames still in rtree
 
-  std::vector<FramePolygon>   frames_polygons; //in pixels_size*scale
-  std::vector<double>         frames_area;
+  bool                        has_pose_prior;
+  cv::Point2f                 prior_pos;
+  double                      prior_radius;
 
-  std::vector<KeyPointsList>  frames_key_points;
-  std::vector<MatcherPtr>     matchers; //for each frame
+  std::deque<KeyPointsList>   frames_key_points;
+  std::deque<MatcherPtr>      matchers; //for each frame
 
-  MatchesList rough_matches;
+  std::shared_ptr<MapBundle>  map_bundle; //keeps loaded descriptions mapped
 };
 
 }
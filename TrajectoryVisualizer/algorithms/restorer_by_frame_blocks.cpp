@@ -1,10 +1,6 @@
 #include "restorer_by_frame_blocks.h"
-#include "transformator.h"
 
-#include <iostream>
-
-#include <QFile>
-#include <QTextStream>
+#include "utils/parallel_for.h"
 
 using namespace algorithmspkg;
 
@@ -18,117 +14,140 @@ RestorerByFrameBlocks::RestorerByFrameBlocks(
 
 }
 
-double RestorerByFrameBlocks::recoverLocation(const cv::Point2f &frame_center,
-                                                    cv::Point2f &pos,
-                                                    double      &angle,
-                                                    double      &scale)
+FeatureBasedRestorer::QueryResult RestorerByFrameBlocks::query(
+                                      const KeyPointsList &key_points,
+                                      const cv::Mat &descriptions,
+                                      const cv::Rect2f &que_frame_rect) const
 {
-  auto query_kps_store = query_key_points;
-  auto query_descrs_store = query_descriptions;
-  std::vector<int> local_to_full_idx(query_kps_store.size(), 0);
-  std::iota(local_to_full_idx.begin(), local_to_full_idx.end(), 0);
-  MatchesList matches_store;
-  auto best_homography = cv::Mat();
-
-  std::vector<cv::Rect2f> rects = {cv::Rect2f(cv::Point2f(0, 0), //full rect
-                                              2*frame_center)};
+  QueryResult result;
+  result.angle = result.scale = result.confidence = 0;
+
+  const cv::Point2f half(que_frame_rect.width / 2., que_frame_rect.height / 2.);
+  const cv::Point2f frame_center = que_frame_rect.tl() + half;
+
+  std::vector<cv::Rect2f> rects = {que_frame_rect}; //full rect
   for (int i = 0; i < 2; i++)
   for (int j = 0; j < 2; j++)
   {
-    rects.push_back(cv::Rect2f(
-                          cv::Point2f(j*frame_center.x, i*frame_center.y),
-                          cv::Point2f((j+1)*frame_center.x, (i+1)*frame_center.y)
-                          )
-                    );
+    cv::Point2f tl = que_frame_rect.tl() + cv::Point2f(j*half.x, i*half.y);
+    rects.push_back(cv::Rect2f(tl, tl + half));
   }
 
-  const auto center_half = frame_center / 2.;
+  const auto center_half = half / 2.;
   rects.push_back(cv::Rect2f( //center rect
                         frame_center - center_half,
                         frame_center + center_half
                         )
                   );
 
-  double max_confidence = 0;
-  for (size_t rect_num = 0; rect_num < rects.size(); rect_num++)
+  if (key_points.empty())
   {
-    const cv::Rect2f &rect = rects[rect_num];
-    if (rect_num != 0) //because initially all key points in full rect
-    {
-      query_key_points.clear();
-      query_descriptions = cv::Mat();
-      local_to_full_idx.clear();
+    return result;
+  }
 
-      //settings contained points
-      for (size_t kp_num = 0; kp_num < query_kps_store.size(); kp_num++)
+  //bit i is set if key point is contained in rect i
+  thread_local std::vector<unsigned char> kp_rects;
+  kp_rects.assign(key_points.size(), 1);
+  for (size_t kp_num = 0; kp_num < key_points.size(); kp_num++)
+  {
+    const auto &pt = key_points[kp_num].pt;
+    for (size_t rect_num = 1; rect_num < rects.size(); rect_num++)
+    {
+      if (rects[rect_num].contains(pt))
       {
-        const auto &pt = query_kps_store[kp_num].pt;
-        if (rect.contains(pt))
-        {
-          local_to_full_idx.push_back(kp_num);
-          query_key_points.push_back(query_kps_store[kp_num]);
-          query_descriptions.push_back(query_descrs_store.row(kp_num));
-        }
+        kp_rects[kp_num] |= 1 << rect_num;
       }
     }
+  }
 
-    cv::Point2f t_pos(0, 0);
-    double t_angle = 0;
-    double t_scale = 0;
-    double confidence = RestorerByFrame::recoverLocation(rect,
-                                                         t_pos, t_angle,
-                                                         t_scale);
+  //each frame is matched once, matches are partitioned by rects,
+  //(rect_num, candidate_num) partitions are verified in parallel
+  const std::vector<size_t> candidate_frames =
+                                           selectCandidateFrames(descriptions);
+  const size_t candidates_count = candidate_frames.size();
+  std::vector<MatchesList> partitions(rects.size() * candidates_count);
 
-    std::cout << "Rect " << rect_num << " confidence: " << confidence <<
-                                                                      std::endl;
+  const bool is_traced = static_cast<bool>(getTrace());
+  std::vector<float> match_ms(candidates_count, 0);
 
-    if (confidence > max_confidence)
+  thread_local MatchesList rough_matches;
+  for (size_t candidate_num = 0; candidate_num < candidates_count;
+       candidate_num++)
+  {
+    RestorerTrace::Clock::time_point match_start;
+    if (is_traced)
     {
-      pos = Transformator::transform(frame_center, homography);
-      angle = t_angle;
-      scale = t_scale;
-      max_confidence = confidence;
-      matches_store = matches;
+      match_start = RestorerTrace::Clock::now();
+    }
+    matchFrame(candidate_frames[candidate_num], descriptions,
+               rough_matches);
+    if (is_traced)
+    {
+      match_ms[candidate_num] = RestorerTrace::elapsedMs(match_start);
+    }
 
-      //matches local idx recover to full image idx
-      //fast rely on assumptation that matches ordered
-      //queryIdx as 0, 1, 2, 3, 4...
-      for (auto &match: matches_store)
+    for (const cv::DMatch &match: rough_matches)
+    {
+      for (size_t rect_num = 0; rect_num < rects.size(); rect_num++)
       {
-        match.queryIdx = local_to_full_idx[match.queryIdx];
+        if (kp_rects[match.queryIdx] & (1 << rect_num))
+        {
+          partitions[rect_num*candidates_count + candidate_num].push_back(
+                                                                        match);
+        }
       }
+    }
+  }
+
+  std::vector<FrameEstimate> estimates(partitions.size());
+  utils::cv::parallelFor(partitions.size(), [&](size_t task_num)
+  {
+    const size_t rect_num = task_num / candidates_count;
+    const size_t candidate_num = task_num % candidates_count;
+    estimates[task_num] = verifyMatches(candidate_frames[candidate_num],
+                                        key_points, partitions[task_num],
+                                        rects[rect_num]);
+  });
+
+  const uint64_t query_num = is_traced? getTrace()->beginQuery(): 0;
+
+  double max_confidence = 0;
+  for (size_t rect_num = 0; rect_num < rects.size(); rect_num++)
+  {
+    const auto rect_begin = estimates.begin() + rect_num*candidates_count;
+    const auto rect_end = rect_begin + candidates_count;
 
-      homography.copyTo(best_homography);
+    if (is_traced)
+    {
+      std::vector<FrameEstimate> rect_estimates(rect_begin, rect_end);
+      if (rect_num == 0)
+      {//frames are matched once, so matching time belongs to the full rect
+        for (size_t candidate_num = 0; candidate_num < candidates_count;
+             candidate_num++)
+        {
+          rect_estimates[candidate_num].match_ms = match_ms[candidate_num];
+        }
+      }
+      traceEstimates(query_num, rect_num, rect_estimates);
     }
 
-    //rename files
-    std::vector<QString> file_names = {"_maskConfidence.csv",
-                                       "_areaConfidence.csv",
-                                       "_scales.csv"};
-    for (auto f_name: file_names)
+    double confidence = 0;
+    auto best = rect_end;
+    for (auto it = rect_begin; it != rect_end; it++)
     {
-      QString new_name = QString::number(rect_num) + f_name;
-      QFile f(f_name);
-      if (!f.rename(new_name))
+      if (it->area_confidence > confidence)
       {
-        QFile new_f(new_name);
-        new_f.open(QIODevice::WriteOnly | QIODevice::Append);
-        f.open(QIODevice::ReadOnly);
-
-        QTextStream in(&f);
-        QString line = in.readLine() + "\n";
-        new_f.write(line.toStdString().c_str(), line.size());
-        new_f.close();
-        f.close();
-
-        f.remove();
+        confidence = it->area_confidence;
+        best = it;
       }
     }
+
+    if (confidence > max_confidence)
+    {//position is always of the full frame center
+      result = resultFromEstimate(*best, que_frame_rect);
+      max_confidence = confidence;
+    }
   }
 
-  matches = matches_store;
-  query_key_points = query_kps_store;
-  query_descriptions = query_descrs_store;
-  best_homography.copyTo(homography);
-  return max_confidence;
+  return result;
 }
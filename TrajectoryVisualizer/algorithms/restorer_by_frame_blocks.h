@@ -16,9 +16,14 @@ class RestorerByFrameBlocks : public RestorerByFrame
             MatcherPtr    matcher = cv::DescriptorMatcher::create("FlannBased"),
             size_t max_key_points_per_frame = 0);
 
-  double recoverLocation(const cv::Point2f &frame_center,
-                         cv::Point2f &pos, double &angle,
-                         double &scale) override;
+  /**
+   * @brief query - verifies matches of the full frame, its quarters and its
+   *                center separately and chooses the most confident result
+   */
+  using RestorerByFrame::query;
+  QueryResult query(const KeyPointsList &key_points,
+                    const cv::Mat &descriptions,
+                    const cv::Rect2f &que_frame_rect) const override;
 
 };
 
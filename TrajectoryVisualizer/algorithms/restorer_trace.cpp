@@ -0,0 +1,253 @@
+#include "restorer_trace.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace algorithmspkg;
+
+namespace
+{
+const char MAGIC[8] = {'T', 'V', 'T', 'R', 'A', 'C', 'E', '1'};
+
+std::atomic<uint64_t> traces_count(0);
+
+size_t roundUpToPowerOfTwo(size_t value)
+{
+  size_t result = 1;
+  while (result < value)
+  {
+    result <<= 1;
+  }
+
+  return result;
+}
+
+bool endsWith(const std::string &str, const std::string &suffix)
+{
+  return str.size() >= suffix.size() &&
+         std::equal(suffix.rbegin(), suffix.rend(), str.rbegin());
+}
+}
+
+CsvTraceSink::CsvTraceSink(const std::string &filename)
+  : out(filename)
+{
+  if (!out)
+  {
+    throw RestorerTrace::Exception("Cannot open file: " + filename);
+  }
+
+  out << "query,group,frame,matches,inliers,mask_confidence,"
+         "area_confidence,scale,match_ms,estimate_ms\n";
+}
+
+void CsvTraceSink::write(const TraceRecord *records, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    const TraceRecord &record = records[i];
+    out << record.query_num << ',' << record.group << ',' <<
+           record.frame_num << ',' << record.matches_count << ',' <<
+           record.inliers_count << ',' << record.mask_confidence << ',' <<
+           record.area_confidence << ',' << record.scale << ',' <<
+           record.match_ms << ',' << record.estimate_ms << '\n';
+  }
+}
+
+void CsvTraceSink::flush()
+{
+  out.flush();
+}
+
+BinaryTraceSink::BinaryTraceSink(const std::string &filename)
+  : out(filename, std::ios::binary)
+{
+  if (!out)
+  {
+    throw RestorerTrace::Exception("Cannot open file: " + filename);
+  }
+
+  uint32_t record_size = sizeof(TraceRecord);
+  out.write(MAGIC, sizeof(MAGIC));
+  out.write(reinterpret_cast<const char*>(&record_size), sizeof(record_size));
+}
+
+void BinaryTraceSink::write(const TraceRecord *records, size_t count)
+{
+  out.write(reinterpret_cast<const char*>(records),
+            count * sizeof(TraceRecord));
+}
+
+void BinaryTraceSink::flush()
+{
+  out.flush();
+}
+
+/**
+ * @brief The RestorerTrace::Ring struct - single producer single consumer
+ * ring, head is moved only by owner thread, tail only by draining
+ */
+struct RestorerTrace::Ring
+{
+  explicit Ring(size_t capacity)
+    : records(capacity), head(0), tail(0)
+  {
+  }
+
+  std::vector<TraceRecord> records;
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+};
+
+RestorerTrace::RestorerTrace(std::shared_ptr<ITraceSink> sink,
+                             size_t ring_capacity, int drain_period_ms)
+  : id(traces_count++), sink(sink),
+    ring_capacity(roundUpToPowerOfTwo(std::max<size_t>(ring_capacity, 2))),
+    drain_period(drain_period_ms),
+    queries_count(0), dropped_count(0),
+    is_stopping(false)
+{
+  drain_thread = std::thread(&RestorerTrace::drainLoop, this);
+}
+
+RestorerTrace::~RestorerTrace()
+{
+  {
+    std::lock_guard<std::mutex> lock(stop_mutex);
+    is_stopping = true;
+  }
+  stop_condition.notify_all();
+  drain_thread.join();
+
+  drain();
+  if (dropped_count != 0)
+  {
+    std::clog << "RestorerTrace: " << dropped_count <<
+                 " records were dropped" << std::endl;
+  }
+}
+
+std::shared_ptr<RestorerTrace> RestorerTrace::create(const std::string &filename)
+{
+  std::shared_ptr<ITraceSink> sink;
+  if (endsWith(filename, ".csv"))
+  {
+    sink = std::make_shared<CsvTraceSink>(filename);
+  }
+  else
+  {
+    sink = std::make_shared<BinaryTraceSink>(filename);
+  }
+
+  return std::make_shared<RestorerTrace>(sink);
+}
+
+uint64_t RestorerTrace::beginQuery()
+{
+  return queries_count++;
+}
+
+void RestorerTrace::record(const TraceRecord &record)
+{
+  Ring *ring = getThreadRing();
+
+  const size_t head = ring->head.load(std::memory_order_relaxed);
+  const size_t tail = ring->tail.load(std::memory_order_acquire);
+  if (head - tail >= ring_capacity)
+  {
+    dropped_count++;
+    return;
+  }
+
+  ring->records[head & (ring_capacity - 1)] = record;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void RestorerTrace::flush()
+{
+  drain();
+}
+
+uint64_t RestorerTrace::getDroppedCount() const
+{
+  return dropped_count;
+}
+
+float RestorerTrace::elapsedMs(const RestorerTrace::Clock::time_point &start)
+{
+  return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+RestorerTrace::Ring* RestorerTrace::getThreadRing()
+{
+  struct ThreadRing
+  {
+    uint64_t trace_id;
+    std::shared_ptr<Ring> ring;
+  };
+  thread_local std::vector<ThreadRing> thread_rings;
+
+  for (const auto &thread_ring: thread_rings)
+  {
+    if (thread_ring.trace_id == id)
+    {
+      return thread_ring.ring.get();
+    }
+  }
+
+  //rings of destroyed traces are owned only by this thread
+  auto is_orphan = [](const ThreadRing &thread_ring) -> bool
+  {
+    return thread_ring.ring.use_count() == 1;
+  };
+  thread_rings.erase(std::remove_if(thread_rings.begin(), thread_rings.end(),
+                                    is_orphan),
+                     thread_rings.end());
+
+  auto ring = std::make_shared<Ring>(ring_capacity);
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    rings.push_back(ring);
+  }
+  thread_rings.push_back(ThreadRing{id, ring});
+
+  return ring.get();
+}
+
+void RestorerTrace::drain()
+{
+  std::vector<std::shared_ptr<Ring>> current_rings;
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    current_rings = rings;
+  }
+
+  std::lock_guard<std::mutex> lock(drain_mutex);
+  for (const auto &ring: current_rings)
+  {
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    const size_t head = ring->head.load(std::memory_order_acquire);
+    while (tail != head)
+    {
+      const size_t begin = tail & (ring_capacity - 1);
+      const size_t count = std::min(head - tail, ring_capacity - begin);
+      sink->write(&ring->records[begin], count);
+      tail += count;
+    }
+    ring->tail.store(tail, std::memory_order_release);
+  }
+  sink->flush();
+}
+
+void RestorerTrace::drainLoop()
+{
+  std::unique_lock<std::mutex> lock(stop_mutex);
+  while (!is_stopping)
+  {
+    stop_condition.wait_for(lock, drain_period);
+
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+}
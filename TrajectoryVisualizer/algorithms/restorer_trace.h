@@ -0,0 +1,161 @@
+#ifndef RESTORER_TRACE_H
+#define RESTORER_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The TraceRecord struct - one hypothesis of the query location,
+ * i.e. verification of matches with one frame (or with the whole cloud)
+ */
+struct TraceRecord
+{
+  uint64_t query_num;
+  int32_t  group;            //e.g. rect of RestorerByFrameBlocks, else 0
+  int32_t  frame_num;        //-1 if query is matched with the whole cloud
+  uint32_t matches_count;
+  uint32_t inliers_count;
+  float    mask_confidence;
+  float    area_confidence;
+  float    scale;
+  float    match_ms;
+  float    estimate_ms;
+  uint32_t reserved;
+};
+
+/**
+ * @brief The ITraceSink class - destination of drained trace records,
+ *                               called only from one thread at a time
+ */
+class ITraceSink
+{
+ public:
+  virtual ~ITraceSink() {}
+
+  virtual void write(const TraceRecord *records, size_t count) = 0;
+  virtual void flush() = 0;
+};
+
+class CsvTraceSink : public ITraceSink
+{
+ public:
+  explicit CsvTraceSink(const std::string &filename);
+
+  void write(const TraceRecord *records, size_t count) override;
+  void flush() override;
+
+ private:
+  std::ofstream out;
+};
+
+/**
+ * @brief The BinaryTraceSink class - magic "TVTRACE1", uint32 record size,
+ *                                     then raw TraceRecord array
+ */
+class BinaryTraceSink : public ITraceSink
+{
+ public:
+  explicit BinaryTraceSink(const std::string &filename);
+
+  void write(const TraceRecord *records, size_t count) override;
+  void flush() override;
+
+ private:
+  std::ofstream out;
+};
+
+/**
+ * @brief The RestorerTrace class - diagnostics of restorers.
+ * Each thread records to its own lock-free ring buffer, background thread
+ * periodically drains buffers to the sink. Records are dropped (and counted)
+ * if ring is full, so queries are never blocked by I/O.
+ * Restorers without trace don't measure or record anything.
+ */
+class RestorerTrace
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * @brief RestorerTrace
+   * @param ring_capacity - records per thread, rounded up to power of 2
+   * @param drain_period_ms - period of draining to sink
+   */
+  explicit RestorerTrace(std::shared_ptr<ITraceSink> sink,
+                         size_t ring_capacity = 4096,
+                         int drain_period_ms = 100);
+  ~RestorerTrace();
+
+  RestorerTrace(const RestorerTrace&) = delete;
+  RestorerTrace& operator=(const RestorerTrace&) = delete;
+
+  /**
+   * @brief create - trace to csv sink if filename ends with .csv,
+   *                 otherwise to binary sink
+   */
+  static std::shared_ptr<RestorerTrace> create(const std::string &filename);
+
+  /**
+   * @brief beginQuery - number of the next query for records
+   */
+  uint64_t beginQuery();
+
+  void record(const TraceRecord &record);
+
+  /**
+   * @brief flush - synchronously drains all records to the sink
+   */
+  void flush();
+
+  uint64_t getDroppedCount() const;
+
+  static float elapsedMs(const Clock::time_point &start);
+
+  class Exception: public std::runtime_error
+  {
+  public:
+    Exception(const std::string &what):
+      std::runtime_error("RestorerTrace: " + what)
+    {}
+  };
+
+ private:
+  struct Ring;
+
+  Ring* getThreadRing();
+  void drain();
+  void drainLoop();
+
+  const uint64_t id;
+  const std::shared_ptr<ITraceSink> sink;
+  const size_t ring_capacity;
+  const std::chrono::milliseconds drain_period;
+
+  std::mutex rings_mutex;
+  std::vector<std::shared_ptr<Ring>> rings;
+
+  std::mutex drain_mutex; //sink is written by one thread
+  std::atomic<uint64_t> queries_count;
+  std::atomic<uint64_t> dropped_count;
+
+  std::mutex stop_mutex;
+  std::condition_variable stop_condition;
+  bool is_stopping;
+  std::thread drain_thread;
+};
+
+}
+
+#endif // RESTORER_TRACE_H
@@ -2,6 +2,7 @@
 #define SAVEABLE_FLANN_MATCHER_H
 
 #include <string>
+#include <stdexcept>
 
 #include <opencv2/xfeatures2d.hpp>
 
@@ -26,13 +27,36 @@ class SaveableFlannMatcher : public cv::FlannBasedMatcher
   {
   }
 
-  void readIndex(std::string filename)
+  /**
+   * @brief clone - keeps type of matcher, so clones are saveable too
+   */
+  cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const
+                                                                      override
   {
-    indexParams->setAlgorithm(cvflann::FLANN_INDEX_SAVED);
-    indexParams->setString("filename", filename);
+    auto matcher = cv::makePtr<SaveableFlannMatcher>(indexParams,
+                                                     searchParams);
+    if (!emptyTrainData)
+    {
+      matcher->add(trainDescCollection);
+    }
+
+    return matcher;
+  }
 
-    // construct flannIndex now, so printParams works
-    train();
+  /**
+   * @brief readIndex - loads index over already added descriptors.
+   * indexParams are shared with clones, so they aren't changed here
+   */
+  void readIndex(std::string filename)
+  {
+    mergedDescriptors.set(trainDescCollection);
+    flannIndex = cv::makePtr<cv::flann::Index>();
+    if (!flannIndex->load(mergedDescriptors.getDescriptors(), filename))
+    {
+      flannIndex.release();
+      throw std::runtime_error("SaveableFlannMatcher: Cannot load index: " +
+                               filename);
+    }
   }
 
   void writeIndex(std::string filename)
@@ -0,0 +1,140 @@
+#include "scale_bucketed_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace algorithmspkg;
+
+ScaleBucketedIndex::ScaleBucketedIndex(MatcherPtr prototype, int norm_type,
+                                       double octaves_per_bucket,
+                                       int tolerance)
+  : prototype(prototype), norm_type(norm_type),
+    octaves_per_bucket(std::max(octaves_per_bucket, 1e-3)),
+    tolerance(std::max(tolerance, 0)), frames_count(0)
+{
+}
+
+void ScaleBucketedIndex::addFrame(const KeyPointsList &key_points,
+                                  const cv::Mat &descriptions)
+{
+  const size_t frame_num = frames_count++;
+
+  std::map<int, std::vector<int>> parts;
+  for (size_t kp_num = 0; kp_num < key_points.size(); kp_num++)
+  {
+    parts[getBucket(key_points[kp_num].size)].push_back(kp_num);
+  }
+
+  for (auto &part: parts)
+  {
+    Bucket &bucket = buckets[part.first];
+    if (!bucket.index)
+    {
+      bucket.index = std::make_shared<IncrementalDescriptorIndex>(prototype,
+                                                                  norm_type);
+    }
+
+    cv::Mat part_descriptions;
+    for (int kp_num: part.second)
+    {
+      part_descriptions.push_back(descriptions.row(kp_num));
+    }
+
+    bucket.frames.push_back(frame_num);
+    bucket.key_points.push_back(std::move(part.second));
+    bucket.descriptions.push_back(part_descriptions);
+    bucket.index->add(bucket.descriptions.back());
+  }
+}
+
+void ScaleBucketedIndex::match(const KeyPointsList &query_key_points,
+                               const cv::Mat &query_descriptions,
+                               double m_per_px, MatchesList &matches) const
+{
+  matches.clear();
+  if (query_key_points.empty() || buckets.empty())
+  {
+    return;
+  }
+
+  std::vector<int> query_buckets(query_key_points.size());
+  for (size_t kp_num = 0; kp_num < query_key_points.size(); kp_num++)
+  {
+    query_buckets[kp_num] = getBucket(query_key_points[kp_num].size *
+                                      m_per_px);
+  }
+
+  std::vector<cv::DMatch> best(query_key_points.size());
+  for (const auto &bucket_item: buckets)
+  {
+    const int bucket_num = bucket_item.first;
+    const Bucket &bucket = bucket_item.second;
+
+    std::vector<int> rows;
+    cv::Mat descriptions;
+    for (size_t kp_num = 0; kp_num < query_buckets.size(); kp_num++)
+    {
+      if (std::abs(query_buckets[kp_num] - bucket_num) <= tolerance)
+      {
+        rows.push_back(kp_num);
+        descriptions.push_back(query_descriptions.row(kp_num));
+      }
+    }
+    if (rows.empty())
+    {
+      continue;
+    }
+
+    MatchesList bucket_matches;
+    bucket.index->match(descriptions, bucket_matches);
+    for (const cv::DMatch &match: bucket_matches)
+    {
+      cv::DMatch &query_best = best[rows[match.queryIdx]];
+      if (query_best.imgIdx < 0 || match.distance < query_best.distance)
+      {
+        query_best = cv::DMatch(rows[match.queryIdx],
+                         bucket.key_points[match.imgIdx][match.trainIdx],
+                         bucket.frames[match.imgIdx], match.distance);
+      }
+    }
+  }
+
+  for (const cv::DMatch &match: best)
+  {
+    if (match.imgIdx >= 0)
+    {
+      matches.push_back(match);
+    }
+  }
+}
+
+void ScaleBucketedIndex::train()
+{
+  for (auto &bucket: buckets)
+  {
+    bucket.second.index->train();
+  }
+}
+
+void ScaleBucketedIndex::clear()
+{
+  buckets.clear();
+  frames_count = 0;
+}
+
+size_t ScaleBucketedIndex::getBucketsCount() const
+{
+  return buckets.size();
+}
+
+int ScaleBucketedIndex::getBucket(double size) const
+{
+  //sizes are positive, degenerate ones get the smallest bucket
+  if (!(size > 0))
+  {
+    return std::numeric_limits<int>::min() / 2;
+  }
+
+  return static_cast<int>(std::floor(std::log2(size) / octaves_per_bucket));
+}
@@ -0,0 +1,91 @@
+#ifndef SCALE_BUCKETED_INDEX_H
+#define SCALE_BUCKETED_INDEX_H
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+#include "incremental_descriptor_index.h"
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The ScaleBucketedIndex class - descriptor index partitioned by
+ * metric size of key points. Key points of the map (sizes in preffered
+ * units) are put into buckets of octaves_per_bucket octaves of size, each
+ * bucket has own IncrementalDescriptorIndex. Query key point of known
+ * m_per_px is matched only with buckets of compatible size, so lookups are
+ * smaller and matches of features of different scales are excluded.
+ * Modifying methods aren't called concurrently with match.
+ */
+class ScaleBucketedIndex
+{
+ public:
+  using KeyPointsList = std::vector<cv::KeyPoint>;
+  using MatcherPtr = cv::Ptr<cv::DescriptorMatcher>;
+  using MatchesList = std::vector<cv::DMatch>;
+
+  /**
+   * @brief ScaleBucketedIndex
+   * @param prototype - matcher of buckets (see IncrementalDescriptorIndex)
+   * @param norm_type - norm of descriptions
+   * @param octaves_per_bucket - width of bucket, log2 of sizes ratio
+   * @param tolerance - count of neighbour buckets matched on each side
+   */
+  ScaleBucketedIndex(MatcherPtr prototype, int norm_type,
+                     double octaves_per_bucket = 1., int tolerance = 1);
+
+  /**
+   * @brief addFrame - splits frame by buckets, the frame gets the next number
+   * @param key_points - key points with sizes in preffered units
+   */
+  void addFrame(const KeyPointsList &key_points, const cv::Mat &descriptions);
+
+  /**
+   * @brief match - the best match of each query description among
+   *                compatible buckets
+   * @param m_per_px - scale of query frame from pixels to preffered units
+   * @param matches - imgIdx is frame number, trainIdx is index of key point
+   *                  in the frame
+   */
+  void match(const KeyPointsList &query_key_points,
+             const cv::Mat &query_descriptions, double m_per_px,
+             MatchesList &matches) const;
+
+  void train();
+  void clear();
+
+  size_t getBucketsCount() const;
+  /**
+   * @brief getBucket - bucket of key point of metric size
+   */
+  int getBucket(double size) const;
+
+ private:
+  /**
+   * @brief The Bucket struct - parts of frames, part i is key points
+   * key_points[i] of frame frames[i]
+   */
+  struct Bucket
+  {
+    std::shared_ptr<IncrementalDescriptorIndex> index;
+    std::vector<size_t>                         frames;
+    std::vector<std::vector<int>>               key_points;
+    std::vector<cv::Mat>                        descriptions;
+  };
+
+  const MatcherPtr prototype;
+  const int norm_type;
+  const double octaves_per_bucket;
+  const int tolerance;
+
+  size_t frames_count;
+  std::map<int, Bucket> buckets;
+};
+
+}
+
+#endif // SCALE_BUCKETED_INDEX_H
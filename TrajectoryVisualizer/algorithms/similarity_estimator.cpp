@@ -0,0 +1,311 @@
+#include "similarity_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace algorithmspkg;
+
+SimilarityEstimator::SimilarityEstimator(double reprojection_threshold,
+                                         double confidence,
+                                         int max_iterations)
+  : reprojection_threshold(reprojection_threshold),
+    confidence(confidence),
+    max_iterations(max_iterations)
+{
+}
+
+cv::Mat SimilarityEstimator::estimate(const std::vector<cv::Point2f> &query_pts,
+                                      const std::vector<cv::Point2f> &train_pts,
+                                      const std::vector<size_t> &order,
+                                      std::vector<char> &mask) const
+{
+  return estimate(query_pts, train_pts, order, mask, nullptr);
+}
+
+cv::Mat SimilarityEstimator::estimate(const std::vector<cv::Point2f> &query_pts,
+                                      const std::vector<cv::Point2f> &train_pts,
+                                      const std::vector<size_t> &order,
+                                      std::vector<char> &mask,
+                                      const Prior &prior) const
+{
+  return estimate(query_pts, train_pts, order, mask, &prior);
+}
+
+cv::Mat SimilarityEstimator::estimate(const std::vector<cv::Point2f> &query_pts,
+                                      const std::vector<cv::Point2f> &train_pts,
+                                      const std::vector<size_t> &order,
+                                      std::vector<char> &mask,
+                                      const Prior *prior) const
+{
+  const size_t points_count = std::min(query_pts.size(), train_pts.size());
+  mask.assign(points_count, 0);
+  if (points_count < 2)
+  {
+    return cv::Mat();
+  }
+
+  std::vector<size_t> sorted(order);
+  if (sorted.size() != points_count)
+  {
+    sorted.resize(points_count);
+    std::iota(sorted.begin(), sorted.end(), 0);
+  }
+
+  //PROSAC: sampling from the best n correspondences, n grows so that after
+  //max_iterations samples are drawn uniformly from all points as in RANSAC
+  const size_t sample_size = 2;
+  double samples_count = max_iterations;        //T_n
+  for (size_t i = 0; i < sample_size; i++)
+  {
+    samples_count *= double(sample_size - i) / (points_count - i);
+  }
+  size_t subset_size = sample_size;             //n
+  size_t subset_limit = 1;                      //T'_n
+
+  cv::RNG rng(-1);
+  Model best_model = {1, 0, 0, 0};
+  size_t best_inliers = 0;
+  size_t iterations_limit = max_iterations;
+  std::vector<char> current_mask;
+
+  for (size_t iteration = 1; iteration <= iterations_limit; iteration++)
+  {
+    while (iteration > subset_limit && subset_size < points_count)
+    {
+      double next_samples_count = samples_count * (subset_size + 1) /
+                                  (subset_size + 1 - sample_size);
+      subset_limit += std::max(1., std::ceil(next_samples_count -
+                                             samples_count));
+      samples_count = next_samples_count;
+      subset_size++;
+    }
+
+    size_t first = 0, second = 0;
+    if (iteration <= subset_limit)
+    {//the newest point of subset is always in sample
+      first = subset_size - 1;
+      second = rng.uniform(0, int(subset_size - 1));
+    }
+    else
+    {//subset reached all points, sampling is uniform as in RANSAC
+      first = rng.uniform(0, int(subset_size));
+      second = rng.uniform(0, int(subset_size - 1));
+      if (second >= first)
+      {
+        second++;
+      }
+    }
+    first = sorted[first];
+    second = sorted[second];
+
+    Model model;
+    if (!fitMinimal(query_pts[first], query_pts[second],
+                    train_pts[first], train_pts[second], model))
+    {
+      continue;
+    }
+    if (prior && !agreesWith(model, *prior))
+    {
+      continue;
+    }
+
+    size_t inliers = countInliers(query_pts, train_pts, model, current_mask);
+    if (inliers > best_inliers)
+    {
+      best_inliers = inliers;
+      best_model = model;
+      mask.swap(current_mask);
+
+      iterations_limit = std::min(iterations_limit,
+                                  requiredIterations(inliers, points_count));
+    }
+  }
+
+  if (best_inliers < sample_size)
+  {
+    mask.assign(points_count, 0);
+    return cv::Mat();
+  }
+
+  Model refined;
+  if (fitLeastSquares(query_pts, train_pts, mask, refined) &&
+      countInliers(query_pts, train_pts, refined, current_mask) >= best_inliers)
+  {
+    best_model = refined;
+    mask.swap(current_mask);
+  }
+
+  return (cv::Mat_<double>(3, 3) << best_model.a, -best_model.b, best_model.tx,
+                                    best_model.b,  best_model.a, best_model.ty,
+                                    0,             0,            1);
+}
+
+std::vector<size_t> SimilarityEstimator::orderByDistance(
+                                      const std::vector<cv::DMatch> &matches)
+{
+  std::vector<size_t> order(matches.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&matches](size_t left, size_t right) -> bool
+                   { return matches[left].distance < matches[right].distance; });
+
+  return order;
+}
+
+double SimilarityEstimator::getReprojectionThreshold() const
+{
+  return reprojection_threshold;
+}
+
+double SimilarityEstimator::getConfidence() const
+{
+  return confidence;
+}
+
+int SimilarityEstimator::getMaxIterations() const
+{
+  return max_iterations;
+}
+
+bool SimilarityEstimator::agreesWith(const SimilarityEstimator::Model &model,
+                                     const SimilarityEstimator::Prior &prior)
+{
+  if (!std::isnan(prior.angle))
+  {
+    double diff = std::atan2(model.b, model.a) * 180 / CV_PI - prior.angle;
+    diff = std::fabs(std::remainder(diff, 360.));
+    if (diff > prior.angle_tolerance)
+    {
+      return false;
+    }
+  }
+  if (!std::isnan(prior.scale))
+  {
+    double scale = std::sqrt(model.a*model.a + model.b*model.b);
+    if (std::fabs(std::log2(scale / prior.scale)) > prior.scale_tolerance)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SimilarityEstimator::fitMinimal(const cv::Point2f &query1,
+                                     const cv::Point2f &query2,
+                                     const cv::Point2f &train1,
+                                     const cv::Point2f &train2,
+                                     SimilarityEstimator::Model &model)
+{
+  //as complex numbers: train = (a + ib) * query + t
+  double qx = query2.x - query1.x;
+  double qy = query2.y - query1.y;
+  double tx = train2.x - train1.x;
+  double ty = train2.y - train1.y;
+
+  double norm = qx*qx + qy*qy;
+  if (norm < 1e-6 || tx*tx + ty*ty < 1e-6)
+  {
+    return false;
+  }
+
+  model.a = (tx*qx + ty*qy) / norm;
+  model.b = (ty*qx - tx*qy) / norm;
+  model.tx = train1.x - (model.a*query1.x - model.b*query1.y);
+  model.ty = train1.y - (model.b*query1.x + model.a*query1.y);
+
+  return true;
+}
+
+bool SimilarityEstimator::fitLeastSquares(
+                                     const std::vector<cv::Point2f> &query_pts,
+                                     const std::vector<cv::Point2f> &train_pts,
+                                     const std::vector<char> &mask,
+                                     SimilarityEstimator::Model &model)
+{
+  double count = 0;
+  cv::Point2d query_mean, train_mean;
+  for (size_t i = 0; i < mask.size(); i++)
+  {
+    if (mask[i])
+    {
+      query_mean += cv::Point2d(query_pts[i]);
+      train_mean += cv::Point2d(train_pts[i]);
+      count++;
+    }
+  }
+  if (count < 2)
+  {
+    return false;
+  }
+  query_mean *= 1. / count;
+  train_mean *= 1. / count;
+
+  double dot = 0, cross = 0, norm = 0;
+  for (size_t i = 0; i < mask.size(); i++)
+  {
+    if (mask[i])
+    {
+      cv::Point2d query = cv::Point2d(query_pts[i]) - query_mean;
+      cv::Point2d train = cv::Point2d(train_pts[i]) - train_mean;
+      dot += query.x*train.x + query.y*train.y;
+      cross += query.x*train.y - query.y*train.x;
+      norm += query.x*query.x + query.y*query.y;
+    }
+  }
+  if (norm < 1e-6)
+  {
+    return false;
+  }
+
+  model.a = dot / norm;
+  model.b = cross / norm;
+  model.tx = train_mean.x - (model.a*query_mean.x - model.b*query_mean.y);
+  model.ty = train_mean.y - (model.b*query_mean.x + model.a*query_mean.y);
+
+  return true;
+}
+
+size_t SimilarityEstimator::countInliers(
+                                     const std::vector<cv::Point2f> &query_pts,
+                                     const std::vector<cv::Point2f> &train_pts,
+                                     const SimilarityEstimator::Model &model,
+                                     std::vector<char> &mask) const
+{
+  const double threshold = reprojection_threshold * reprojection_threshold;
+  const size_t points_count = std::min(query_pts.size(), train_pts.size());
+  mask.resize(points_count);
+
+  size_t inliers = 0;
+  for (size_t i = 0; i < points_count; i++)
+  {
+    const cv::Point2f &query = query_pts[i];
+    double dx = model.a*query.x - model.b*query.y + model.tx - train_pts[i].x;
+    double dy = model.b*query.x + model.a*query.y + model.ty - train_pts[i].y;
+
+    mask[i] = dx*dx + dy*dy < threshold;
+    inliers += mask[i];
+  }
+
+  return inliers;
+}
+
+size_t SimilarityEstimator::requiredIterations(size_t inliers_count,
+                                               size_t points_count) const
+{
+  double inliers_ratio = double(inliers_count) / points_count;
+  double good_sample = inliers_ratio * inliers_ratio;
+  if (good_sample >= 1)
+  {
+    return 0;
+  }
+
+  double iterations = std::log(1 - confidence) / std::log(1 - good_sample);
+  if (!(iterations < max_iterations))
+  {
+    return max_iterations;
+  }
+
+  return std::ceil(iterations);
+}
@@ -0,0 +1,110 @@
+#ifndef SIMILARITY_ESTIMATOR_H
+#define SIMILARITY_ESTIMATOR_H
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The SimilarityEstimator class - robust estimation of similarity
+ * transformation (shift, angle, uniform scale) between point sets.
+ * Minimal sample is 2 correspondences, samples are drawn PROSAC-like from
+ * progressively growing set of the best correspondences (e.g. by match
+ * distance) and iterations stop as soon as the confidence is reached.
+ * The best model is refined by least squares over its inliers.
+ */
+class SimilarityEstimator
+{
+ public:
+  /**
+   * @brief SimilarityEstimator
+   * @param reprojection_threshold - max distance to inlier in train units
+   * @param confidence - probability to sample at least one inlier sample
+   * @param max_iterations - upper bound of sampled hypotheses
+   */
+  explicit SimilarityEstimator(double reprojection_threshold = 3,
+                               double confidence = 0.995,
+                               int max_iterations = 2000);
+
+  /**
+   * @brief The Prior struct - expected rotation and scale of the model (e.g.
+   * from HoughPreVoter), hypotheses far from them are rejected before
+   * counting inliers. NaN angle or scale isn't checked.
+   */
+  struct Prior
+  {
+    double angle;           //degrees
+    double scale;
+    double angle_tolerance; //degrees
+    double scale_tolerance; //octaves
+  };
+
+  /**
+   * @brief estimate
+   * @param query_pts - source points
+   * @param train_pts - destination points
+   * @param order - correspondences sorted by quality (the best first),
+   *                if empty then points are assumed sorted
+   * @param mask - out inliers mask
+   * @return 3x3 CV_64F matrix or empty if estimation failed
+   */
+  cv::Mat estimate(const std::vector<cv::Point2f> &query_pts,
+                   const std::vector<cv::Point2f> &train_pts,
+                   const std::vector<size_t> &order,
+                   std::vector<char> &mask) const;
+  /**
+   * @brief estimate - the same, but sampled hypotheses must agree with prior
+   */
+  cv::Mat estimate(const std::vector<cv::Point2f> &query_pts,
+                   const std::vector<cv::Point2f> &train_pts,
+                   const std::vector<size_t> &order,
+                   std::vector<char> &mask, const Prior &prior) const;
+
+  /**
+   * @brief orderByDistance - indices of matches sorted by distance ascending
+   */
+  static std::vector<size_t> orderByDistance(
+                                     const std::vector<cv::DMatch> &matches);
+
+  double getReprojectionThreshold() const;
+  double getConfidence() const;
+  int    getMaxIterations() const;
+
+ private:
+  struct Model
+  {
+    double a; //scale*cos
+    double b; //scale*sin
+    double tx;
+    double ty;
+  };
+
+  cv::Mat estimate(const std::vector<cv::Point2f> &query_pts,
+                   const std::vector<cv::Point2f> &train_pts,
+                   const std::vector<size_t> &order,
+                   std::vector<char> &mask, const Prior *prior) const;
+  static bool agreesWith(const Model &model, const Prior &prior);
+  static bool fitMinimal(const cv::Point2f &query1, const cv::Point2f &query2,
+                         const cv::Point2f &train1, const cv::Point2f &train2,
+                         Model &model);
+  static bool fitLeastSquares(const std::vector<cv::Point2f> &query_pts,
+                              const std::vector<cv::Point2f> &train_pts,
+                              const std::vector<char> &mask,
+                              Model &model);
+  size_t countInliers(const std::vector<cv::Point2f> &query_pts,
+                      const std::vector<cv::Point2f> &train_pts,
+                      const Model &model, std::vector<char> &mask) const;
+  size_t requiredIterations(size_t inliers_count, size_t points_count) const;
+
+  double reprojection_threshold;
+  double confidence;
+  int max_iterations;
+};
+
+}
+
+#endif // SIMILARITY_ESTIMATOR_H
@@ -0,0 +1,347 @@
+#include "tracking_localizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <opencv2/core/hal/hal.hpp>
+
+#include "transformator.h"
+
+using namespace algorithmspkg;
+
+namespace
+{
+const double POINTS_PER_CELL = 16;
+const double MAX_SECOND_RATIO = 0.8; //ratio test of guided matches
+
+/**
+ * @brief rowsDistance - distance of descriptions rows by raw pointers,
+ *                       cv::norm on row headers costs more than the distance
+ */
+float rowsDistance(const uchar *left, const uchar *right, int cols, int type,
+                   int norm_type)
+{
+  if (type == CV_8U && norm_type == cv::NORM_HAMMING)
+  {
+    return cv::hal::normHamming(left, right, cols);
+  }
+  if (type == CV_8U && norm_type == cv::NORM_HAMMING2)
+  {
+    return cv::hal::normHamming(left, right, cols, 2);
+  }
+  if (type == CV_32F && norm_type == cv::NORM_L2)
+  {
+    return std::sqrt(cv::hal::normL2Sqr_(reinterpret_cast<const float*>(left),
+                                        reinterpret_cast<const float*>(right),
+                                        cols));
+  }
+  if (type == CV_32F && norm_type == cv::NORM_L1)
+  {
+    return cv::hal::normL1_(reinterpret_cast<const float*>(left),
+                            reinterpret_cast<const float*>(right), cols);
+  }
+
+  return cv::norm(cv::Mat(1, cols, type, const_cast<uchar*>(left)),
+                  cv::Mat(1, cols, type, const_cast<uchar*>(right)),
+                  norm_type);
+}
+}
+
+TrackingLocalizer::TrackingLocalizer(
+                            std::shared_ptr<FeatureBasedRestorer> restorer,
+                            double search_radius, size_t min_inliers,
+                            double cell_size)
+  : restorer(restorer), search_radius(search_radius),
+    min_inliers(min_inliers), cell_size_hint(cell_size),
+    cell_size(1), grid_cols(0), grid_rows(0),
+    was_last_tracked(false)
+{
+  rebuildGrid();
+}
+
+TrackingLocalizer::QueryResult TrackingLocalizer::localize(
+                                          const KeyPointsList &key_points,
+                                          const cv::Mat &descriptions,
+                                          const cv::Rect2f &frame_rect)
+{
+  if (isTracking() && !grid_points.empty())
+  {
+    thread_local MatchesList rough_matches;
+    matchGuided(key_points, descriptions, predictHomography(), rough_matches);
+
+    QueryResult result = verifyMatches(key_points, rough_matches, frame_rect);
+    if (result.matches.size() >= min_inliers)
+    {
+      update(result, true);
+      return result;
+    }
+  }
+
+  QueryResult result = restorer->query(key_points, descriptions, frame_rect);
+  update(result, false);
+
+  return result;
+}
+
+void TrackingLocalizer::reset()
+{
+  last_homography = cv::Mat();
+  previous_homography = cv::Mat();
+  was_last_tracked = false;
+}
+
+void TrackingLocalizer::rebuildGrid()
+{
+  cells_begin.clear();
+  grid_points.clear();
+  grid_cols = grid_rows = 0;
+
+  size_t points_count = 0;
+  cv::Point2f tl(std::numeric_limits<float>::max(),
+                 std::numeric_limits<float>::max());
+  cv::Point2f br(-std::numeric_limits<float>::max(),
+                 -std::numeric_limits<float>::max());
+  for (size_t frame_num = 0; frame_num < restorer->getFramesCount();
+       frame_num++)
+  {
+    for (const auto &kp: restorer->getFrameKeyPoints(frame_num))
+    {
+      tl.x = std::min(tl.x, kp.pt.x);
+      tl.y = std::min(tl.y, kp.pt.y);
+      br.x = std::max(br.x, kp.pt.x);
+      br.y = std::max(br.y, kp.pt.y);
+    }
+    points_count += restorer->getFrameKeyPoints(frame_num).size();
+  }
+  if (points_count == 0)
+  {
+    return;
+  }
+
+  const double area = std::max<double>((br.x - tl.x) * (br.y - tl.y), 1);
+  cell_size = cell_size_hint > 0? cell_size_hint:
+                          std::sqrt(area * POINTS_PER_CELL / points_count);
+  cell_size = std::max(cell_size, 1e-6);
+  grid_origin = tl;
+  grid_cols = static_cast<int>((br.x - tl.x) / cell_size) + 1;
+  grid_rows = static_cast<int>((br.y - tl.y) / cell_size) + 1;
+
+  auto cellOf = [this](const cv::Point2f &pt) -> size_t
+  {
+    int col = static_cast<int>((pt.x - grid_origin.x) / cell_size);
+    int row = static_cast<int>((pt.y - grid_origin.y) / cell_size);
+    return size_t(row) * grid_cols + col;
+  };
+
+  //counting sort of points by cells
+  cells_begin.assign(size_t(grid_cols) * grid_rows + 1, 0);
+  for (size_t frame_num = 0; frame_num < restorer->getFramesCount();
+       frame_num++)
+  {
+    for (const auto &kp: restorer->getFrameKeyPoints(frame_num))
+    {
+      cells_begin[cellOf(kp.pt) + 1]++;
+    }
+  }
+  for (size_t cell = 1; cell < cells_begin.size(); cell++)
+  {
+    cells_begin[cell] += cells_begin[cell - 1];
+  }
+
+  grid_points.resize(points_count);
+  std::vector<size_t> cells_end(cells_begin.begin(), cells_begin.end() - 1);
+  for (size_t frame_num = 0; frame_num < restorer->getFramesCount();
+       frame_num++)
+  {
+    const auto &key_points = restorer->getFrameKeyPoints(frame_num);
+    for (size_t kp_num = 0; kp_num < key_points.size(); kp_num++)
+    {
+      const size_t cell = cellOf(key_points[kp_num].pt);
+      GridPoint &point = grid_points[cells_end[cell]++];
+      point.frame_num = frame_num;
+      point.kp_num = kp_num;
+    }
+  }
+}
+
+bool TrackingLocalizer::isTracking() const
+{
+  return !last_homography.empty();
+}
+
+bool TrackingLocalizer::wasLastTracked() const
+{
+  return was_last_tracked;
+}
+
+std::shared_ptr<FeatureBasedRestorer> TrackingLocalizer::getRestorer() const
+{
+  return restorer;
+}
+
+cv::Mat TrackingLocalizer::predictHomography() const
+{
+  if (previous_homography.empty())
+  {
+    return last_homography;
+  }
+
+  //motion between last fixes in map coordinates is repeated
+  cv::Mat motion = last_homography * previous_homography.inv();
+  return motion * last_homography;
+}
+
+void TrackingLocalizer::matchGuided(const KeyPointsList &key_points,
+                                    const cv::Mat &descriptions,
+                                    const cv::Mat &predicted,
+                                    MatchesList &rough_matches) const
+{
+  rough_matches.clear();
+  if (key_points.empty() || descriptions.rows != int(key_points.size()))
+  {
+    return;
+  }
+
+  cv::Point2f shift;
+  double angle = 0, scale = 0;
+  Transformator::getParams(predicted, shift, angle, scale);
+  const double radius = search_radius * scale;
+  const double radius_sq = radius * radius;
+  const int norm_type = restorer->getDescriptor()->defaultNorm();
+  const int descriptions_type = descriptions.type();
+
+  std::vector<cv::Point2f> query_pts(key_points.size());
+  for (size_t i = 0; i < key_points.size(); i++)
+  {
+    query_pts[i] = key_points[i].pt;
+  }
+  std::vector<cv::Point2f> projected = Transformator::transform(query_pts,
+                                                                predicted);
+
+  for (size_t query_num = 0; query_num < projected.size(); query_num++)
+  {
+    const cv::Point2f &pt = projected[query_num];
+    //cells are clamped before the cast, a diverged prediction may project
+    //points out of int range (or to NaN)
+    const double col_min = (pt.x - radius - grid_origin.x) / cell_size;
+    const double col_max = (pt.x + radius - grid_origin.x) / cell_size;
+    const double row_min = (pt.y - radius - grid_origin.y) / cell_size;
+    const double row_max = (pt.y + radius - grid_origin.y) / cell_size;
+    if (!(col_max >= 0 && col_min < grid_cols &&
+          row_max >= 0 && row_min < grid_rows))
+    {
+      continue;
+    }
+    const int col_begin = int(std::max(col_min, 0.));
+    const int col_end = int(std::min(col_max, grid_cols - 1.));
+    const int row_begin = int(std::max(row_min, 0.));
+    const int row_end = int(std::min(row_max, grid_rows - 1.));
+
+    cv::DMatch best(query_num, -1, -1, std::numeric_limits<float>::max());
+    float second_distance = std::numeric_limits<float>::max();
+    const uchar *query_row = descriptions.ptr(query_num);
+    for (int row = row_begin; row <= row_end; row++)
+    for (int col = col_begin; col <= col_end; col++)
+    {
+      const size_t cell = size_t(row) * grid_cols + col;
+      for (size_t i = cells_begin[cell]; i < cells_begin[cell + 1]; i++)
+      {
+        const GridPoint &point = grid_points[i];
+        const cv::Point2f &map_pt =
+            restorer->getFrameKeyPoints(point.frame_num)[point.kp_num].pt;
+        const cv::Point2f diff = map_pt - pt;
+        if (diff.x*diff.x + diff.y*diff.y > radius_sq)
+        {
+          continue;
+        }
+
+        const cv::Mat &frame_descriptions =
+                               restorer->getFrameDescriptions(point.frame_num);
+        float distance = rowsDistance(query_row,
+                                      frame_descriptions.ptr(point.kp_num),
+                                      descriptions.cols, descriptions_type,
+                                      norm_type);
+        if (distance < best.distance)
+        {
+          second_distance = best.distance;
+          best.distance = distance;
+          best.trainIdx = point.kp_num;
+          best.imgIdx = point.frame_num;
+        }
+        else if (distance < second_distance)
+        {
+          second_distance = distance;
+        }
+      }
+    }
+
+    if (best.trainIdx >= 0 &&
+        best.distance < MAX_SECOND_RATIO * second_distance)
+    {
+      rough_matches.push_back(best);
+    }
+  }
+}
+
+TrackingLocalizer::QueryResult TrackingLocalizer::verifyMatches(
+                                          const KeyPointsList &key_points,
+                                          const MatchesList &rough_matches,
+                                          const cv::Rect2f &frame_rect) const
+{
+  thread_local std::vector<cv::Point2f> query_pts;
+  thread_local std::vector<cv::Point2f> train_pts;
+  thread_local std::vector<char> mask;
+
+  QueryResult result;
+  result.angle = result.scale = result.confidence = 0;
+
+  query_pts.clear();
+  train_pts.clear();
+  for (const cv::DMatch &match: rough_matches)
+  {
+    query_pts.push_back(key_points[match.queryIdx].pt);
+    train_pts.push_back(
+        restorer->getFrameKeyPoints(match.imgIdx)[match.trainIdx].pt);
+  }
+
+  result.homography = estimator.estimate(query_pts, train_pts,
+                          SimilarityEstimator::orderByDistance(rough_matches),
+                          mask);
+  if (result.homography.empty())
+  {
+    return result;
+  }
+
+  for (size_t i = 0; i < mask.size(); i++)
+  {
+    if (mask[i])
+    {
+      result.matches.push_back(rough_matches[i]);
+    }
+  }
+
+  cv::Point2f shift;
+  Transformator::getParams(result.homography, shift, result.angle,
+                           result.scale);
+  cv::Point2f center = (frame_rect.tl() + frame_rect.br()) / 2.;
+  result.pos = Transformator::transform(center, result.homography);
+  result.confidence = result.matches.size() / double(rough_matches.size());
+
+  return result;
+}
+
+void TrackingLocalizer::update(const TrackingLocalizer::QueryResult &result,
+                               bool is_tracked)
+{
+  was_last_tracked = is_tracked;
+  if (result.homography.empty() || result.matches.size() < min_inliers)
+  {
+    reset();
+    return;
+  }
+
+  //velocity is known only between two tracked (consistent) fixes
+  previous_homography = is_tracked? last_homography: cv::Mat();
+  last_homography = result.homography.clone();
+}
@@ -0,0 +1,109 @@
+#ifndef TRACKING_LOCALIZER_H
+#define TRACKING_LOCALIZER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "feature_based_restorer.h"
+#include "similarity_estimator.h"
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The TrackingLocalizer class - localization of successive frames of
+ * continuous flight. The pose of the next frame is predicted by constant
+ * velocity model from the last two fixes, query key points are projected
+ * to the map with the predicted pose and matched only with map key points
+ * in small radius around projections (spatial grid over the map).
+ * Falls back to the global search of the restorer if tracking is lost.
+ */
+class TrackingLocalizer
+{
+ public:
+  using QueryResult = FeatureBasedRestorer::QueryResult;
+  using KeyPointsList = FeatureBasedRestorer::KeyPointsList;
+  using MatchesList = FeatureBasedRestorer::MatchesList;
+
+  /**
+   * @brief TrackingLocalizer
+   * @param restorer - map and global search, frames mustn't be added while
+   *                   localizer is used (call rebuildGrid after adding)
+   * @param search_radius - radius of guided matching in query pixels
+   * @param min_inliers - less inliers means that tracking is lost
+   * @param cell_size - size of grid cell in map units, 0 is auto
+   */
+  explicit TrackingLocalizer(std::shared_ptr<FeatureBasedRestorer> restorer,
+                             double search_radius = 20,
+                             size_t min_inliers = 15,
+                             double cell_size = 0);
+
+  /**
+   * @brief localize - guided matching around predicted pose if tracking,
+   *                   global search of restorer otherwise
+   * @param frame_rect - need for pos return
+   */
+  QueryResult localize(const KeyPointsList &key_points,
+                       const cv::Mat &descriptions,
+                       const cv::Rect2f &frame_rect);
+
+  /**
+   * @brief reset - forgets previous fixes, next frame is searched globally
+   */
+  void reset();
+
+  /**
+   * @brief rebuildGrid - indexes key points of all frames of restorer
+   */
+  void rebuildGrid();
+
+  bool isTracking() const;
+  /**
+   * @brief wasLastTracked - false if last result is of global search
+   */
+  bool wasLastTracked() const;
+
+  std::shared_ptr<FeatureBasedRestorer> getRestorer() const;
+
+ private:
+  struct GridPoint
+  {
+    uint32_t frame_num;
+    uint32_t kp_num;
+  };
+
+  cv::Mat predictHomography() const;
+  void matchGuided(const KeyPointsList &key_points,
+                   const cv::Mat &descriptions,
+                   const cv::Mat &predicted,
+                   MatchesList &rough_matches) const;
+  QueryResult verifyMatches(const KeyPointsList &key_points,
+                            const MatchesList &rough_matches,
+                            const cv::Rect2f &frame_rect) const;
+  void update(const QueryResult &result, bool is_tracked);
+
+  std::shared_ptr<FeatureBasedRestorer> restorer;
+  const double search_radius;
+  const size_t min_inliers;
+  const double cell_size_hint;
+
+  SimilarityEstimator estimator;
+
+  //grid in compressed form: points of cell i are
+  //[cells_begin[i], cells_begin[i + 1]) of grid_points
+  cv::Point2f grid_origin;
+  double      cell_size;
+  int         grid_cols;
+  int         grid_rows;
+  std::vector<size_t>     cells_begin;
+  std::vector<GridPoint>  grid_points;
+
+  cv::Mat last_homography;      //empty if tracking is lost
+  cv::Mat previous_homography;  //empty if there is only one fix
+  bool    was_last_tracked;
+};
+
+}
+
+#endif // TRACKING_LOCALIZER_H
@@ -1,8 +1,17 @@
 #include "trajectory_loader.h"
 
 #include <fstream>
-
+#include <iostream>
+#include <atomic>
+#include <clocale>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+#include "algorithms/map_bundle.h"
 #include "utils/csv.h"
+#include "utils/feature_extraction.h"
 
 using namespace algorithmspkg;
 using namespace modelpkg;
@@ -13,7 +22,8 @@ TrajectoryLoader::TrajectoryLoader()
 {
 }
 
-Trajectory TrajectoryLoader::loadTrajectory(string trj_idx_path)
+Trajectory TrajectoryLoader::loadTrajectory(string trj_idx_path,
+                                            bool prefetch_images)
 {
   setProgressBarTitle("Loading trajectory", true);
   Trajectory trj;
@@ -23,7 +33,8 @@ Trajectory TrajectoryLoader::loadTrajectory(string trj_idx_path)
   size_t found = trj_idx_path.find_last_of("/\\");
   string folder = trj_idx_path.substr(0,found);
 
-  int count = 0;
+  vector<vector<string>> rows;
+  rows.reserve(parsed_csv.size());
   for (auto &row : parsed_csv)
   {
     if (row[0] == "Path")
@@ -31,10 +42,42 @@ Trajectory TrajectoryLoader::loadTrajectory(string trj_idx_path)
       continue;
     }
     row[0] = folder + "/" + row[0];
-    Map frame = loadMapFromRow(row);
+    rows.push_back(std::move(row));
+  }
+
+  //need for atof, because '.' is not delimeter of float part. Locale is
+  //global, so it's set once for all rows instead of each row
+  string saved_locale = setlocale(LC_NUMERIC, nullptr);
+  setlocale(LC_NUMERIC, "C");
+
+  //frames are constructed in parallel into own slots, it reads headers
+  //of images (or decodes images of unknown format)
+  vector<Map> frames(rows.size());
+  try
+  {
+    processFrames(rows.size(), [&]() -> std::function<void(size_t)>
+    {
+      return [&](size_t row_num)
+      {
+        frames[row_num] = loadMapFromRow(rows[row_num]);
+      };
+    });
+  }
+  catch (...)
+  {
+    setlocale(LC_NUMERIC, saved_locale.c_str());
+    throw;
+  }
+  setlocale(LC_NUMERIC, saved_locale.c_str());
+
+  for (const Map &frame: frames)
+  {
     trj.pushBackFrame(frame);
+  }
 
-    notifyProgressBar(++count + 1, parsed_csv.size());
+  if (prefetch_images)
+  {
+    prefetchImages(frames);
   }
 
   return trj;
@@ -59,25 +102,53 @@ void TrajectoryLoader::loadOrCalculateKeyPoints(Trajectory &trj,
   }
 }
 
-Map TrajectoryLoader::loadMapFromRow(vector<string> params)
+void TrajectoryLoader::loadOrCalculateKeyPoints(Trajectory &trj,
+                                                string filename,
+                                      const Feature2DFactory &create_detector,
+                                                bool save)
 {
-  //need for atof, because '.' is not delimeter of float part
-  char *saved_locale;
-  saved_locale = setlocale(LC_NUMERIC, "C");
-
+  try
+  {
+    loadKeyPoints(trj, filename);
+  }
+  catch (TrajectoryLoader::NoFileExist &e)
+  {
+    calculateKeyPoints(trj, create_detector);
+    if (save)
+    {
+      saveKeyPoints(trj, filename);
+    }
+  }
+}
 
+Map TrajectoryLoader::loadMapFromRow(const vector<string> &params)
+{
+  //LC_NUMERIC is "C" here, see loadTrajectory
   double x_m = atof(params[1].c_str());
   double y_m = atof(params[2].c_str());
 
   double angle = atof(params[3].c_str());
   double m_per_px = atof(params[4].c_str());
 
-
-  setlocale(LC_NUMERIC, saved_locale);
-
   return Map(params[0], x_m, y_m, angle, m_per_px);
 }
 
+void TrajectoryLoader::prefetchImages(const vector<Map> &frames)
+{
+  //the leading frames which fit in the cache, the next ones would evict them
+  size_t capacity = utils::ImageCache::getInstance().getCapacity();
+  size_t prefetched_size = 0;
+  for (const Map &frame: frames)
+  {
+    prefetched_size += frame.image_size.area();
+    if (prefetched_size > capacity)
+    {
+      break;
+    }
+    frame.prefetchImage();
+  }
+}
+
 /*
  * KeyPoints loader
  */
@@ -121,30 +192,93 @@ void TrajectoryLoader::calculateKeyPoints(Trajectory &trj,
   {
     const auto &frame = trj.getFrame(frame_num);
     auto &mutable_frame_kps = trj.getFrameAllKeyPoints(frame_num);
+    if (frame_num + 1 < trj.getFramesCount())
+    {
+      trj.getFrame(frame_num + 1).prefetchImage();
+    }
 
-    detector->detect(frame.image, mutable_frame_kps);
+    detector->detect(frame.getImage(), mutable_frame_kps);
 
     notifyProgressBar(frame_num + 1, trj.getFramesCount());
   }
 }
 
-void TrajectoryLoader::sortKeyPointsByResponse(Trajectory &trj,
-                                               size_t max_key_points_per_frame)
+void TrajectoryLoader::calculateKeyPoints(Trajectory &trj,
+                                      const Feature2DFactory &create_detector)
+{
+  setProgressBarTitle("Calculating key points");
+  processFrames(trj.getFramesCount(), create_detector,
+                [&trj](size_t frame_num, Feature2D &detector)
+  {
+    detector.detect(trj.getFrame(frame_num).getImage(),
+                    trj.getFrameAllKeyPoints(frame_num));
+  });
+}
+
+void TrajectoryLoader::sortKeyPointsByResponse(Trajectory &trj)
 {
   for (size_t frame_num = 0; frame_num < trj.getFramesCount(); frame_num++)
   {
     auto &mutable_frame_kps = trj.getFrameAllKeyPoints(frame_num);
-    //sort by response
-    std::sort(mutable_frame_kps.begin(), mutable_frame_kps.end(),
-              []( const cv::KeyPoint &left, const cv::KeyPoint &right ) ->
-              bool { return left.response > right.response; });
+    auto &mutable_frame_descrs = trj.getFrameDescription(frame_num);
+
+    //sort by response, indices get the same order as key points sorted alone
+    //would get, so cached descriptions of sorted key points stay valid
+    vector<size_t> order(mutable_frame_kps.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&mutable_frame_kps]( size_t left, size_t right ) -> bool
+              {
+                return mutable_frame_kps[left].response >
+                       mutable_frame_kps[right].response;
+              });
+
+    vector<KeyPoint> sorted_kps;
+    sorted_kps.reserve(order.size());
+    for (size_t kp_num: order)
+    {
+      sorted_kps.push_back(mutable_frame_kps[kp_num]);
+    }
+    if (mutable_frame_descrs.rows == static_cast<int>(order.size()))
+    {
+      Mat sorted_descrs(mutable_frame_descrs.size(),
+                        mutable_frame_descrs.type());
+      for (size_t row_num = 0; row_num < order.size(); row_num++)
+      {
+        Mat sorted_row = sorted_descrs.row(row_num);
+        mutable_frame_descrs.row(order[row_num]).copyTo(sorted_row);
+      }
+      mutable_frame_descrs = sorted_descrs;
+    }
+    mutable_frame_kps.swap(sorted_kps);
+  }
+}
 
-    if (max_key_points_per_frame != 0 &&
-        max_key_points_per_frame < mutable_frame_kps.size())
+void TrajectoryLoader::selectKeyPoints(Trajectory &trj,
+                                       size_t max_key_points_per_frame,
+                                       const KeyPointsSelector &selector)
+{
+  for (size_t frame_num = 0; frame_num < trj.getFramesCount(); frame_num++)
+  {
+    auto &mutable_frame_kps = trj.getFrameAllKeyPoints(frame_num);
+    auto &mutable_frame_descrs = trj.getFrameDescription(frame_num);
+    if (mutable_frame_descrs.empty())
     {
-      mutable_frame_kps.resize(max_key_points_per_frame);
-      mutable_frame_kps.shrink_to_fit();
+      selector.apply(mutable_frame_kps, max_key_points_per_frame);
+    }
+    else if (mutable_frame_descrs.rows ==
+             static_cast<int>(mutable_frame_kps.size()))
+    {
+      selector.apply(mutable_frame_kps, mutable_frame_descrs,
+                     max_key_points_per_frame);
+    }
+    else
+    {//selected rows wouldn't belong to selected key points
+      throw TrajectoryLoader::Exception("Descriptions of frame " +
+                                        std::to_string(frame_num) +
+                                        " don't match its key points");
     }
+    mutable_frame_kps.shrink_to_fit();
   }
 }
 
@@ -191,6 +325,25 @@ void TrajectoryLoader::loadOrCalculateDescriptions(Trajectory &trj,
   }
 }
 
+void TrajectoryLoader::loadOrCalculateDescriptions(Trajectory &trj,
+                                                   string filename,
+                                    const Feature2DFactory &create_descriptor,
+                                                   bool save)
+{
+  try
+  {
+    loadDescriptions(trj, filename);
+  }
+  catch (TrajectoryLoader::NoFileExist &e)
+  {
+    calculateDescriptions(trj, create_descriptor);
+    if (save)
+    {
+      saveDescriptions(trj, filename);
+    }
+  }
+}
+
 /*
  * Descriptions loader
  */
@@ -238,8 +391,13 @@ void TrajectoryLoader::calculateDescriptions(Trajectory &trj,
 
   for (size_t frame_num = 0; frame_num < trj.getFramesCount(); frame_num++)
   {
+    if (frame_num + 1 < trj.getFramesCount())
+    {
+      trj.getFrame(frame_num + 1).prefetchImage();
+    }
+
     Mat descr;
-    descriptor->compute(trj.getFrame(frame_num).image,
+    descriptor->compute(trj.getFrame(frame_num).getImage(),
                         trj.getFrameAllKeyPoints(frame_num), descr);
 
     trj.setFrameDescription(frame_num, descr);
@@ -248,6 +406,326 @@ void TrajectoryLoader::calculateDescriptions(Trajectory &trj,
   }
 }
 
+void TrajectoryLoader::calculateDescriptions(Trajectory &trj,
+                                    const Feature2DFactory &create_descriptor)
+{
+  setProgressBarTitle("Calculating descriptions");
+  processFrames(trj.getFramesCount(), create_descriptor,
+                [&trj](size_t frame_num, Feature2D &descriptor)
+  {
+    Mat descr;
+    descriptor.compute(trj.getFrame(frame_num).getImage(),
+                       trj.getFrameAllKeyPoints(frame_num), descr);
+
+    trj.setFrameDescription(frame_num, descr);
+  });
+}
+
+/*
+ * Features loader
+ */
+
+void TrajectoryLoader::loadOrCalculateFeatures(Trajectory &trj,
+                                         string key_points_filename,
+                                         string descriptions_filename,
+                                         const Feature2DFactory &create_detector,
+                                         const Feature2DFactory &create_descriptor,
+                                         bool save)
+{
+  bool has_key_points = true;
+  try
+  {
+    loadKeyPoints(trj, key_points_filename);
+  }
+  catch (TrajectoryLoader::NoFileExist &e)
+  {
+    has_key_points = false;
+  }
+
+  if (has_key_points)
+  {
+    sortKeyPointsByResponse(trj);
+    try
+    {
+      loadDescriptions(trj, descriptions_filename);
+      if (hasAlignedDescriptions(trj))
+      {
+        return;
+      }
+      clog << "TrajectoryLoader: descriptions of " << descriptions_filename
+           << " don't match key points, recalculating" << endl;
+    }
+    catch (TrajectoryLoader::NoFileExist &e)
+    {
+    }
+
+    //key points are reloaded in order of the file, so they are sorted below
+    //the same way as on later loads
+    loadKeyPoints(trj, key_points_filename);
+    //images are needed only for calculation
+    prefetchImages(trj.getAllFrames());
+    calculateDescriptions(trj, create_descriptor);
+  }
+  else
+  {
+    //images are needed only for calculation
+    prefetchImages(trj.getAllFrames());
+    if (utils::cv::isSameAlgorithm(create_detector(), create_descriptor()))
+    {//scale space is built once for key points and descriptions
+      calculateFeatures(trj, create_descriptor);
+    }
+    else
+    {
+      calculateKeyPoints(trj, create_detector);
+      calculateDescriptions(trj, create_descriptor);
+    }
+  }
+
+  //descriptor may drop key points (e.g. near borders), so key points are
+  //saved after it and both files stay aligned
+  if (save)
+  {
+    saveKeyPoints(trj, key_points_filename);
+  }
+  sortKeyPointsByResponse(trj);
+  if (save)
+  {
+    saveDescriptions(trj, descriptions_filename);
+  }
+}
+
+bool TrajectoryLoader::hasAlignedDescriptions(const Trajectory &trj)
+{
+  for (size_t frame_num = 0; frame_num < trj.getFramesCount(); frame_num++)
+  {
+    if (trj.getFrameDescription(frame_num).rows !=
+        static_cast<int>(trj.getFrameAllKeyPoints(frame_num).size()))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void TrajectoryLoader::loadOrCalculateFeatures(Trajectory &trj,
+                                         string features_filename,
+                                         const Feature2DFactory &create_detector,
+                                         const Feature2DFactory &create_descriptor,
+                                         bool save)
+{
+  try
+  {
+    loadFeatures(trj, features_filename);
+    return;
+  }
+  catch (TrajectoryLoader::NoFileExist &e)
+  {
+  }
+  catch (MapBundle::Exception &e)
+  {
+    clog << e.what() << endl;
+  }
+  catch (TrajectoryLoader::Exception &e)
+  {
+    clog << e.what() << endl;
+  }
+
+  calculateSortedFeatures(trj, create_detector, create_descriptor);
+  if (save)
+  {
+    saveFeatures(trj, features_filename);
+  }
+}
+
+void TrajectoryLoader::loadFeatures(Trajectory &trj, string filename)
+{
+  std::shared_ptr<MapBundle> bundle;
+  try
+  {
+    bundle = std::make_shared<MapBundle>(filename);
+  }
+  catch (utils::MappedFile::NoFileExist &e)
+  {
+    throw TrajectoryLoader::NoFileExist(filename);
+  }
+
+  if (bundle->getKind() != MapBundle::TRAJECTORY)
+  {
+    throw MapBundle::Exception("Not a trajectory features: " + filename);
+  }
+  if (bundle->getFramesCount() != trj.getFramesCount())
+  {
+    throw TrajectoryLoader::Exception("Frames count of " + filename +
+                                      " differs from trajectory");
+  }
+  //all frames are verified before trajectory is changed
+  setProgressBarTitle("Loading features");
+  const size_t frames_count = bundle->getFramesCount();
+  vector<vector<KeyPoint>> frames_key_points(frames_count);
+  vector<Mat> frames_descriptions(frames_count);
+  for (size_t frame_num = 0; frame_num < frames_count; frame_num++)
+  {
+    frames_key_points[frame_num] = bundle->getKeyPoints(frame_num);
+    frames_descriptions[frame_num] = bundle->getDescriptions(frame_num);
+
+    notifyProgressBar(frame_num + 1, frames_count);
+  }
+
+  for (size_t frame_num = 0; frame_num < frames_count; frame_num++)
+  {
+    trj.getFrameAllKeyPoints(frame_num).swap(frames_key_points[frame_num]);
+    trj.setFrameDescription(frame_num, frames_descriptions[frame_num]);
+  }
+  trj.setFeaturesStorage(bundle);
+}
+
+void TrajectoryLoader::saveFeatures(const Trajectory &trj, string filename)
+{
+  setProgressBarTitle("Saving features");
+  MapBundle::write(filename, MapBundle::TRAJECTORY, trj.getAllKeyPoints(),
+                   trj.getAllDescriptions(), {}, {});
+  notifyProgressBar(1, 1);
+}
+
+void TrajectoryLoader::calculateSortedFeatures(Trajectory &trj,
+                                         const Feature2DFactory &create_detector,
+                                         const Feature2DFactory &create_descriptor)
+{
+  //images are needed only for calculation
+  prefetchImages(trj.getAllFrames());
+
+  if (utils::cv::isSameAlgorithm(create_detector(), create_descriptor()))
+  {//scale space is built once for key points and descriptions
+    calculateFeatures(trj, create_descriptor);
+    sortKeyPointsByResponse(trj);
+    return;
+  }
+
+  calculateKeyPoints(trj, create_detector);
+  sortKeyPointsByResponse(trj);
+  calculateDescriptions(trj, create_descriptor);
+}
+
+void TrajectoryLoader::calculateFeatures(Trajectory &trj,
+                                     const Feature2DFactory &create_feature2d)
+{
+  setProgressBarTitle("Calculating features");
+  processFrames(trj.getFramesCount(), create_feature2d,
+                [&trj](size_t frame_num, Feature2D &feature2d)
+  {
+    Mat descr;
+    feature2d.detectAndCompute(trj.getFrame(frame_num).getImage(), noArray(),
+                               trj.getFrameAllKeyPoints(frame_num), descr);
+
+    trj.setFrameDescription(frame_num, descr);
+  });
+}
+
+void TrajectoryLoader::processFrames(size_t frames_count,
+                                     const Feature2DFactory &create_feature2d,
+                      const std::function<void(size_t, Feature2D&)> &process)
+{
+  processFrames(frames_count, [&]() -> std::function<void(size_t)>
+  {
+    Ptr<Feature2D> feature2d = create_feature2d();
+    return [feature2d, &process](size_t frame_num)
+    {
+      process(frame_num, *feature2d);
+    };
+  });
+}
+
+void TrajectoryLoader::processFrames(size_t frames_count,
+              const std::function<std::function<void(size_t)>()> &create_worker)
+{
+  if (frames_count == 0)
+  {
+    return;
+  }
+
+  const size_t workers_count = std::min<size_t>(
+                    std::max(std::thread::hardware_concurrency(), 1u),
+                    frames_count);
+
+  std::atomic<size_t> next_frame(0);
+  std::mutex progress_mutex;
+  std::condition_variable progress_changed;
+  size_t processed_count = 0;
+  size_t finished_count = 0;
+  std::exception_ptr error;
+
+  auto work = [&]()
+  {
+    try
+    {
+      std::function<void(size_t)> process = create_worker();
+      for (size_t frame_num = next_frame++; frame_num < frames_count;
+           frame_num = next_frame++)
+      {
+        process(frame_num);
+
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        processed_count++;
+        progress_changed.notify_one();
+      }
+    }
+    catch (...)
+    {
+      //other workers stop after their current frames
+      next_frame = frames_count;
+      std::lock_guard<std::mutex> lock(progress_mutex);
+      if (!error)
+      {
+        error = std::current_exception();
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    finished_count++;
+    progress_changed.notify_one();
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t worker_num = 0; worker_num < workers_count; worker_num++)
+  {
+    workers.emplace_back(work);
+  }
+
+  //callbacks of progress bar may touch GUI, so only this thread calls them
+  {
+    std::unique_lock<std::mutex> lock(progress_mutex);
+    size_t notified_count = 0;
+    while (true)
+    {
+      progress_changed.wait(lock, [&]() -> bool
+      {
+        return processed_count != notified_count ||
+               finished_count == workers_count;
+      });
+      if (processed_count == notified_count)
+      {//all workers are finished
+        break;
+      }
+
+      notified_count = processed_count;
+      lock.unlock();
+      notifyProgressBar(notified_count, frames_count);
+      lock.lock();
+    }
+  }
+
+  for (auto &worker: workers)
+  {
+    worker.join();
+  }
+
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+}
+
 void TrajectoryLoader::saveDescriptions(const Trajectory &trj, string filename)
 {
   ofstream out(filename, ios::binary);
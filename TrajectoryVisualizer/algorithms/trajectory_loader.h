@@ -3,9 +3,11 @@
 
 #include <string>
 #include <exception>
+#include <functional>
 
 #include "model/entities/trajectory.h"
 #include "progress_bar_notifier.h"
+#include "key_points_selector.h"
 
 namespace algorithmspkg
 {
@@ -13,9 +15,24 @@ namespace algorithmspkg
 class TrajectoryLoader: public ProgressBarNotifier
 {
 public:
+  /**
+   * @brief Feature2DFactory - creates new instance of detector or descriptor,
+   * parallel calculation creates one instance for each thread
+   */
+  using Feature2DFactory = std::function<cv::Ptr<cv::Feature2D>()>;
+
   TrajectoryLoader();
 
-  modelpkg::Trajectory loadTrajectory(std::string trj_idx_path);
+  /**
+   * @brief loadTrajectory - frames are constructed in parallel, only headers
+   * of images are read
+   * @param trj_idx_path
+   * @param prefetch_images - decode images of the leading frames (as many as
+   *                          the image cache holds) in background, use it
+   *                          only if images will be needed soon
+   */
+  modelpkg::Trajectory loadTrajectory(std::string trj_idx_path,
+                                      bool prefetch_images = false);
 
   /*
    * KeyPoints loader
@@ -33,16 +50,37 @@ public:
                                 std::string filename,
                                 cv::Ptr<cv::Feature2D> detector,
                                 bool save = false);
+  void loadOrCalculateKeyPoints(modelpkg::Trajectory &trj,
+                                std::string filename,
+                                const Feature2DFactory &create_detector,
+                                bool save = false);
   void loadKeyPoints(modelpkg::Trajectory &trj, std::string filename);
   void calculateKeyPoints(modelpkg::Trajectory &trj,
                           cv::Ptr<cv::Feature2D> detector);
+  /**
+   * @brief calculateKeyPoints - frames are processed in parallel, each thread
+   * takes the next frame when it's free, so frames of different texture are
+   * balanced. Progress is notified from the calling thread
+   * @param create_detector - called once for each thread
+   */
+  void calculateKeyPoints(modelpkg::Trajectory &trj,
+                          const Feature2DFactory &create_detector);
   /**
    * @brief TrajectoryLoader::sortKeyPointsByResponse
-   * This method isn't sort descriptions
+   * Descriptions are sorted too if they are calculated for all key points,
+   * the order of sorted key points is the order of rows of descriptions files
    * @param trj
    */
-  void sortKeyPointsByResponse(modelpkg::Trajectory &trj,
-                               size_t max_key_points_per_frame = 0);
+  void sortKeyPointsByResponse(modelpkg::Trajectory &trj);
+  /**
+   * @brief selectKeyPoints - keeps at most max_key_points_per_frame key
+   * points of each frame and their descriptions (if they are calculated)
+   * @param max_key_points_per_frame - 0 means all
+   * @throw Exception if descriptions of frame don't match its key points
+   */
+  void selectKeyPoints(modelpkg::Trajectory &trj,
+                       size_t max_key_points_per_frame,
+                       const KeyPointsSelector &selector = KeyPointsSelector());
   void saveKeyPoints(const modelpkg::Trajectory &trj,
                      std::string filename);
 
@@ -62,12 +100,70 @@ public:
                                    std::string filename,
                                    cv::Ptr<cv::Feature2D> descriptor,
                                    bool save = false);
+  void loadOrCalculateDescriptions(modelpkg::Trajectory &trj,
+                                   std::string filename,
+                                   const Feature2DFactory &create_descriptor,
+                                   bool save = false);
   void loadDescriptions(modelpkg::Trajectory &trj, std::string filename);
   void calculateDescriptions(modelpkg::Trajectory &trj,
                              cv::Ptr<cv::Feature2D> descriptor);
+  /**
+   * @brief calculateDescriptions - parallel version (see calculateKeyPoints)
+   */
+  void calculateDescriptions(modelpkg::Trajectory &trj,
+                             const Feature2DFactory &create_descriptor);
   void saveDescriptions(const modelpkg::Trajectory &trj,
                         std::string filename);
 
+  /*
+   * Features loader
+   */
+
+  /**
+   * @brief loadOrCalculateFeatures - loads or calculates key points, sorts
+   * them by response and loads or calculates their descriptions. If key
+   * points aren't cached and detector and descriptor are the same algorithm,
+   * both are calculated by one detectAndCompute pass. Descriptions which
+   * don't match key points are recalculated, then both files are saved
+   * @param save - save if calculated
+   */
+  void loadOrCalculateFeatures(modelpkg::Trajectory &trj,
+                               std::string key_points_filename,
+                               std::string descriptions_filename,
+                               const Feature2DFactory &create_detector,
+                               const Feature2DFactory &create_descriptor,
+                               bool save = false);
+  /**
+   * @brief loadOrCalculateFeatures - loads key points sorted by response and
+   * their descriptions from one features file (see saveFeatures), otherwise
+   * calculates them like the version with separate files. Features file of
+   * other version or byte order is recalculated
+   * @param save - save if calculated
+   */
+  void loadOrCalculateFeatures(modelpkg::Trajectory &trj,
+                               std::string features_filename,
+                               const Feature2DFactory &create_detector,
+                               const Feature2DFactory &create_descriptor,
+                               bool save = false);
+  /**
+   * @brief loadFeatures - maps features file, descriptions of frames refer to
+   * it without copying (trajectory keeps it mapped). Arrays of each frame
+   * are verified by their checksums, trj isn't changed if any is corrupted
+   */
+  void loadFeatures(modelpkg::Trajectory &trj, std::string filename);
+  /**
+   * @brief saveFeatures - writes key points and descriptions of all frames to
+   * one versioned file (see MapBundle). Mustn't overwrite file which
+   * descriptions of trj are loaded from
+   */
+  void saveFeatures(const modelpkg::Trajectory &trj, std::string filename);
+  /**
+   * @brief calculateFeatures - parallel detectAndCompute (see
+   *                            calculateKeyPoints)
+   */
+  void calculateFeatures(modelpkg::Trajectory &trj,
+                         const Feature2DFactory &create_feature2d);
+
 
 
   class Exception: public std::runtime_error
@@ -87,7 +183,36 @@ public:
   };
 
 private:
-  static modelpkg::Map loadMapFromRow(std::vector<std::string> params);
+  static modelpkg::Map loadMapFromRow(const std::vector<std::string> &params);
+  static void prefetchImages(const std::vector<modelpkg::Map> &frames);
+  /**
+   * @brief hasAlignedDescriptions - each frame has a row of descriptions for
+   *                                 each key point
+   */
+  static bool hasAlignedDescriptions(const modelpkg::Trajectory &trj);
+
+  /**
+   * @brief calculateSortedFeatures - key points sorted by response and their
+   *                                  descriptions
+   */
+  void calculateSortedFeatures(modelpkg::Trajectory &trj,
+                               const Feature2DFactory &create_detector,
+                               const Feature2DFactory &create_descriptor);
+
+  /**
+   * @brief processFrames - calls process for each frame in worker threads
+   *                        with own instance of Feature2D, rethrows the first
+   *                        exception of workers
+   */
+  void processFrames(size_t frames_count,
+                     const Feature2DFactory &create_feature2d,
+                     const std::function<void(size_t, cv::Feature2D&)> &process);
+  /**
+   * @brief processFrames - each worker thread calls create_worker once and
+   *                        processes frames by the returned function
+   */
+  void processFrames(size_t frames_count,
+              const std::function<std::function<void(size_t)>()> &create_worker);
 };
 
 }
@@ -2,16 +2,14 @@
 
 #include "transformator.h"
 #include "saveable_flann_matcher.h"
+#include "key_points_deduplicator.h"
+#include "utils/feature_extraction.h"
 
-#include <chrono>
 #include <iostream>
 
-#include <opencv2/calib3d.hpp>
-
 using namespace algorithmspkg;
 using namespace std;
 using namespace cv;
-using namespace chrono;
 
 TrajectoryRecover::TrajectoryRecover(cv::Ptr<cv::Feature2D> detector,
                                      cv::Ptr<cv::Feature2D> descriptor)
@@ -26,10 +24,8 @@ void TrajectoryRecover::addFrame(const Mat &frame,
   matcher_trained = false;
 
   vector<KeyPoint> kps;
-  detector->detect(frame, kps);
-
   cv::Mat descrs;
-  descriptor->compute(frame, kps, descrs);
+  utils::cv::detectAndCompute(detector, descriptor, frame, kps, descrs);
 
   this->addFrame(frame, kps, descrs, frame_pos_m, angle, meters_per_pixel);
 }
@@ -67,6 +63,8 @@ void TrajectoryRecover::addFrame(const Mat &frame,
   transformed = Transformator::transform(transformed, Transformator::getScale(meters_per_pixel));
   transformed = Transformator::transform(transformed, Transformator::getTranslate(frame_pos_m));*/
 
+  frames_begin.push_back(key_points_cloud.size());
+  observations_cloud.clear();
   for (size_t i = 0; i < transformed.size(); i++)
   {
     KeyPoint kp = key_points[i];
@@ -119,9 +117,8 @@ double TrajectoryRecover::recoverTrajectory(const Mat &que_frame,
   //there is unnecessary to train matcher, because recoverTrajectory
   //overload below will be called
 
-  key_points.clear();
-  detector->detect(que_frame, key_points);
-  descriptor->compute(que_frame, key_points, descriptors);
+  utils::cv::detectAndCompute(detector, descriptor, que_frame, key_points,
+                              descriptors);
 
   return this->recoverTrajectory(key_points, descriptors, homography, matches);
 }
@@ -143,16 +140,21 @@ double TrajectoryRecover::recoverTrajectory(const vector<KeyPoint> &que_key_poin
   }
 
   vector<cv::DMatch> rough_matches;
-  auto start_match_time = high_resolution_clock::now();
+  RestorerTrace::Clock::time_point start_time;
+  if (trace)
+  {
+    start_time = RestorerTrace::Clock::now();
+  }
 
   matcher->match(que_descriptors, rough_matches);
 
-  auto finish_match_time = high_resolution_clock::now();
-  clog << "Match time: " <<
-          duration_cast<milliseconds>(finish_match_time -
-                                      start_match_time).count() << "ms\n";
+  float match_ms = 0;
+  if (trace)
+  {
+    match_ms = RestorerTrace::elapsedMs(start_time);
+  }
 
-  //prepare points for findHomography | using trajectories_kp_cloud
+  //prepare points for estimator | using trajectories_kp_cloud
   //we need to transform to_trj_pts to points on map
   vector<Point2f> que_trj_pts;
   vector<Point2f> train_trj_pts;
@@ -163,15 +165,15 @@ double TrajectoryRecover::recoverTrajectory(const vector<KeyPoint> &que_key_poin
     que_trj_pts.push_back(que_key_points[match.queryIdx].pt);
   }
 
-  auto start_homo_time = high_resolution_clock::now();
+  if (trace)
+  {
+    start_time = RestorerTrace::Clock::now();
+  }
 
   vector<char> mask;
-  homography = findHomography(que_trj_pts, train_trj_pts, RANSAC, 3, mask);
-
-  auto finish_homo_time = chrono::high_resolution_clock::now();
-  clog << "Finding homography time: " <<
-          duration_cast<milliseconds>(finish_homo_time -
-                                      start_homo_time).count() << "ms\n";
+  homography = estimator.estimate(que_trj_pts, train_trj_pts,
+                          SimilarityEstimator::orderByDistance(rough_matches),
+                          mask);
 
   matches.clear();
   int count = 0;
@@ -185,15 +187,85 @@ double TrajectoryRecover::recoverTrajectory(const vector<KeyPoint> &que_key_poin
   }
   double score = count / double(mask.size());
 
+  if (trace)
+  {
+    TraceRecord record;
+    record.query_num = trace->beginQuery();
+    record.group = 0;
+    record.frame_num = -1;
+    record.matches_count = rough_matches.size();
+    record.inliers_count = count;
+    record.mask_confidence = score;
+    record.area_confidence = 0;
+    record.scale = 0;
+    record.match_ms = match_ms;
+    record.estimate_ms = RestorerTrace::elapsedMs(start_time);
+    record.reserved = 0;
+
+    trace->record(record);
+  }
+
   return score;
 }
 
+void TrajectoryRecover::setTrace(std::shared_ptr<RestorerTrace> trace)
+{
+  this->trace = trace;
+}
+
+size_t TrajectoryRecover::deduplicate(double radius, double max_distance)
+{
+  //cloud is split back to frames
+  vector<vector<KeyPoint>> frames_key_points;
+  vector<Mat> frames_descriptors;
+  for (size_t frame_num = 0; frame_num < frames_begin.size(); frame_num++)
+  {
+    size_t begin = frames_begin[frame_num];
+    size_t end = frame_num + 1 < frames_begin.size()?
+                 frames_begin[frame_num + 1]: key_points_cloud.size();
+    frames_key_points.emplace_back(key_points_cloud.begin() + begin,
+                                   key_points_cloud.begin() + end);
+    frames_descriptors.push_back(descriptors_cloud.rowRange(begin, end));
+  }
+
+  KeyPointsDeduplicator deduplicator(radius, max_distance,
+                                     descriptor->defaultNorm());
+  vector<vector<size_t>> kept;
+  vector<vector<int>> observations;
+  deduplicator.deduplicate(frames_key_points, frames_descriptors,
+                           kept, observations);
+
+  const size_t old_size = key_points_cloud.size();
+  key_points_cloud.clear();
+  Mat deduplicated_descriptors;
+  frames_begin.clear();
+  observations_cloud.clear();
+  for (size_t frame_num = 0; frame_num < kept.size(); frame_num++)
+  {
+    frames_begin.push_back(key_points_cloud.size());
+    for (size_t i = 0; i < kept[frame_num].size(); i++)
+    {
+      size_t kp_num = kept[frame_num][i];
+      key_points_cloud.push_back(frames_key_points[frame_num][kp_num]);
+      deduplicated_descriptors.push_back(
+                                    frames_descriptors[frame_num].row(kp_num));
+      observations_cloud.push_back(observations[frame_num][i]);
+    }
+  }
+  descriptors_cloud = deduplicated_descriptors;
+  matcher_trained = false;
+
+  return old_size - key_points_cloud.size();
+}
+
 void TrajectoryRecover::clear()
 {
   matcher_trained = false;
   matcher->clear();
   key_points_cloud.clear();
   descriptors_cloud = cv::Mat();
+  frames_begin.clear();
+  observations_cloud.clear();
 }
 
 void TrajectoryRecover::setDetector(cv::Ptr<cv::Feature2D> detector)
@@ -204,16 +276,14 @@ void TrajectoryRecover::setDetector(cv::Ptr<cv::Feature2D> detector)
 void TrajectoryRecover::setDescriptor(cv::Ptr<cv::Feature2D> descriptor)
 {
   this->descriptor = descriptor;
-  if (descriptor->defaultNorm() == NORM_HAMMING ||
-      descriptor->defaultNorm() == NORM_HAMMING2)
-  {
-    //matcher = makePtr<BFMatcher>(descriptor->defaultNorm());
-    matcher = makePtr<SaveableFlannMatcher>(new flann::LshIndexParams(20, 10, 2));
-  }
-  else
-  {
-    matcher = makePtr<SaveableFlannMatcher>();
-  }
+  setIndexChoice(FlannIndexTuner::IndexChoice::defaults(
+                                                  descriptor->defaultNorm()));
+}
+
+void TrajectoryRecover::setIndexChoice(
+                                const FlannIndexTuner::IndexChoice &choice)
+{
+  matcher = choice.makeMatcher();
 }
 
 const std::vector<cv::KeyPoint> &TrajectoryRecover::getKeyPointsCloud() const
@@ -226,6 +296,11 @@ const cv::Mat &TrajectoryRecover::getDescriptorsCloud() const
   return descriptors_cloud;
 }
 
+const std::vector<int> &TrajectoryRecover::getObservationsCloud() const
+{
+  return observations_cloud;
+}
+
 
 
 
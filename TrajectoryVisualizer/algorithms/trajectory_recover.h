@@ -3,10 +3,15 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 
 #include <opencv2/core.hpp>
 #include <opencv2/xfeatures2d.hpp>
 
+#include "similarity_estimator.h"
+#include "restorer_trace.h"
+#include "flann_index_tuner.h"
+
 namespace algorithmspkg{
 
 class TrajectoryRecover
@@ -41,13 +46,41 @@ class TrajectoryRecover
                            cv::Mat &homography,
                            std::vector<cv::DMatch> &matches);
 
+  /**
+   * @brief deduplicate - keeps one key point of each ground feature observed
+   *                      by several frames (see KeyPointsDeduplicator)
+   * @param radius - max distance between observations in meters
+   * @param max_distance - max distance between descriptors
+   * @return count of removed key points
+   */
+  size_t deduplicate(double radius, double max_distance);
+
   void clear();
 
+  /**
+   * @brief setTrace - enables recording of queries, nullptr disables it
+   */
+  void setTrace(std::shared_ptr<RestorerTrace> trace);
+
   void setDetector(cv::Ptr<cv::Feature2D> detector);
+  /**
+   * @brief setDescriptor - also resets matcher to untuned index for norm
+   *                        of descriptor
+   */
   void setDescriptor(cv::Ptr<cv::Feature2D> descriptor);
+  /**
+   * @brief setIndexChoice - replaces matcher by one with tuned index
+   *                         (see FlannIndexTuner)
+   */
+  void setIndexChoice(const FlannIndexTuner::IndexChoice &choice);
 
   const std::vector<cv::KeyPoint>& getKeyPointsCloud() const;
   const cv::Mat&                   getDescriptorsCloud() const;
+  /**
+   * @brief getObservationsCloud - count of observations of each key point,
+   *                               empty if cloud isn't deduplicated
+   */
+  const std::vector<int>&          getObservationsCloud() const;
 
  private:
 
@@ -57,9 +90,14 @@ class TrajectoryRecover
   cv::Ptr<cv::DescriptorMatcher> matcher;
   bool                  matcher_trained;
 
+  SimilarityEstimator   estimator;
+  std::shared_ptr<RestorerTrace> trace;
+
   //each point in meters
   std::vector<cv::KeyPoint>   key_points_cloud;
   cv::Mat                     descriptors_cloud;
+  std::vector<size_t>         frames_begin; //first key point of each frame
+  std::vector<int>            observations_cloud;
 };
 
 }
@@ -0,0 +1,245 @@
+#include "vlad_retriever.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+
+using namespace algorithmspkg;
+
+VladRetriever::VladRetriever(int words_count)
+  : words_count(words_count), is_binary(false), first_row(0)
+{
+}
+
+void VladRetriever::train(const std::vector<cv::Mat> &frames_descriptions,
+                          size_t max_samples)
+{
+  vocabulary = cv::Mat();
+  clearFrames();
+
+  size_t total = 0;
+  for (const auto &descriptions: frames_descriptions)
+  {
+    total += descriptions.rows;
+    if (!descriptions.empty())
+    {
+      is_binary = descriptions.depth() == CV_8U;
+    }
+  }
+
+  //uniform sampling over all frames
+  const size_t step = std::max<size_t>(1, total / std::max<size_t>(1,
+                                                                 max_samples));
+  cv::Mat samples;
+  size_t row_num = 0;
+  for (const auto &descriptions: frames_descriptions)
+  {
+    for (int row = 0; row < descriptions.rows; row++, row_num++)
+    {
+      if (row_num % step == 0)
+      {
+        samples.push_back(toFloat(descriptions.row(row)));
+      }
+    }
+  }
+
+  if (samples.rows < words_count)
+  {
+    std::clog << "VladRetriever: not enough descriptions for vocabulary" <<
+                 std::endl;
+    return;
+  }
+
+  cv::Mat labels;
+  cv::kmeans(samples, words_count, labels,
+             cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS,
+                              20, 1e-3),
+             1, cv::KMEANS_PP_CENTERS, vocabulary);
+}
+
+bool VladRetriever::isTrained() const
+{
+  return !vocabulary.empty();
+}
+
+cv::Mat VladRetriever::computeSignature(const cv::Mat &descriptions) const
+{
+  const int dims = vocabulary.cols;
+  cv::Mat vlad = cv::Mat::zeros(1, words_count * dims, CV_32F);
+  if (descriptions.empty() || !isTrained())
+  {
+    return vlad;
+  }
+
+  cv::Mat data = toFloat(descriptions);
+  cv::Mat distances;
+  cv::Mat words;
+  cv::batchDistance(data, vocabulary, distances, CV_32F, words,
+                    cv::NORM_L2SQR, 1);
+
+  float *acc = vlad.ptr<float>();
+  for (int row = 0; row < data.rows; row++)
+  {
+    const int word = words.at<int>(row);
+    const float *descr = data.ptr<float>(row);
+    const float *center = vocabulary.ptr<float>(word);
+    float *residual = acc + word * dims;
+    for (int i = 0; i < dims; i++)
+    {
+      residual[i] += descr[i] - center[i];
+    }
+  }
+
+  //power normalization damps bursty words
+  for (int i = 0; i < vlad.cols; i++)
+  {
+    acc[i] = acc[i] < 0? -std::sqrt(-acc[i]): std::sqrt(acc[i]);
+  }
+
+  //intra normalization, each word gives equal contribution
+  for (int word = 0; word < words_count; word++)
+  {
+    cv::Mat block = vlad.colRange(word * dims, (word + 1) * dims);
+    double block_norm = cv::norm(block);
+    if (block_norm > 0)
+    {
+      block /= block_norm;
+    }
+  }
+
+  cv::normalize(vlad, vlad);
+
+  return vlad;
+}
+
+void VladRetriever::addFrame(const cv::Mat &descriptions)
+{
+  signatures.push_back(computeSignature(descriptions));
+}
+
+void VladRetriever::removeFirstFrame()
+{
+  if (getFramesCount() == 0)
+  {
+    return;
+  }
+
+  first_row++;
+  //rows are copied only when removed ones outnumber current ones,
+  //so a sliding window costs amortized O(1) per frame
+  if (first_row >= signatures.rows - first_row)
+  {
+    signatures = getSignatures().clone();
+    first_row = 0;
+  }
+}
+
+void VladRetriever::clearFrames()
+{
+  signatures = cv::Mat();
+  first_row = 0;
+}
+
+size_t VladRetriever::getFramesCount() const
+{
+  return signatures.rows - first_row;
+}
+
+std::vector<size_t> VladRetriever::retrieve(const cv::Mat &query_descriptions,
+                                            size_t top_k) const
+{
+  std::vector<size_t> all(getFramesCount());
+  std::iota(all.begin(), all.end(), 0);
+
+  return retrieve(query_descriptions, top_k, all);
+}
+
+std::vector<size_t> VladRetriever::retrieve(
+                              const cv::Mat &query_descriptions, size_t top_k,
+                              const std::vector<size_t> &candidates) const
+{
+  if (getFramesCount() == 0 || candidates.empty())
+  {
+    return std::vector<size_t>();
+  }
+
+  cv::Mat query_signature = computeSignature(query_descriptions);
+  cv::Mat similarities = getSignatures() * query_signature.t();
+
+  return selectTop(similarities, top_k, candidates);
+}
+
+void VladRetriever::save(const std::string &filename) const
+{
+  cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+  fs << "words_count" << words_count;
+  fs << "is_binary" << static_cast<int>(is_binary);
+  fs << "vocabulary" << vocabulary;
+  fs << "signatures" << getSignatures();
+}
+
+void VladRetriever::load(const std::string &filename)
+{
+  cv::FileStorage fs(filename, cv::FileStorage::READ);
+  if (!fs.isOpened())
+  {
+    throw std::runtime_error("VladRetriever: Cannot open file: " + filename);
+  }
+
+  int binary = 0;
+  fs["words_count"] >> words_count;
+  fs["is_binary"] >> binary;
+  fs["vocabulary"] >> vocabulary;
+  fs["signatures"] >> signatures;
+  first_row = 0;
+  is_binary = binary != 0;
+}
+
+cv::Mat VladRetriever::toFloat(const cv::Mat &descriptions) const
+{
+  cv::Mat result;
+  if (is_binary)
+  {
+    result.create(descriptions.rows, descriptions.cols * 8, CV_32F);
+    for (int row = 0; row < descriptions.rows; row++)
+    {
+      const uchar *bytes = descriptions.ptr<uchar>(row);
+      float *bits = result.ptr<float>(row);
+      for (int i = 0; i < descriptions.cols * 8; i++)
+      {
+        bits[i] = (bytes[i / 8] >> (i % 8)) & 1;
+      }
+    }
+  }
+  else
+  {
+    descriptions.convertTo(result, CV_32F);
+  }
+
+  return result;
+}
+
+cv::Mat VladRetriever::getSignatures() const
+{
+  return signatures.rowRange(first_row, signatures.rows);
+}
+
+std::vector<size_t> VladRetriever::selectTop(
+                                  const cv::Mat &similarities, size_t top_k,
+                                  const std::vector<size_t> &candidates) const
+{
+  std::vector<size_t> result(candidates);
+  const size_t count = std::min(top_k, result.size());
+
+  std::partial_sort(result.begin(), result.begin() + count, result.end(),
+                    [&similarities](size_t left, size_t right) -> bool
+                    {
+                      return similarities.at<float>(left) >
+                             similarities.at<float>(right);
+                    });
+  result.resize(count);
+
+  return result;
+}
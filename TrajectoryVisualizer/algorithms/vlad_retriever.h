@@ -0,0 +1,84 @@
+#ifndef VLAD_RETRIEVER_H
+#define VLAD_RETRIEVER_H
+
+#include <vector>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+namespace algorithmspkg
+{
+
+/**
+ * @brief The VladRetriever class - image retrieval by global descriptors.
+ * Each frame is described by VLAD (vector of locally aggregated descriptors)
+ * over a small k-means vocabulary, similarity is a dot product of signatures.
+ * Binary descriptors are unpacked to bits before aggregation.
+ */
+class VladRetriever
+{
+ public:
+  explicit VladRetriever(int words_count = 16);
+
+  /**
+   * @brief train - trains vocabulary with k-means
+   * @param frames_descriptions - descriptions of the frames
+   * @param max_samples - descriptions are sampled uniformly up to this count
+   */
+  void train(const std::vector<cv::Mat> &frames_descriptions,
+             size_t max_samples = 100000);
+  bool isTrained() const;
+
+  /**
+   * @brief computeSignature - VLAD with power and intra normalization
+   * @return row 1 x words_count*dims, CV_32F, L2 normalized
+   */
+  cv::Mat computeSignature(const cv::Mat &descriptions) const;
+
+  void addFrame(const cv::Mat &descriptions);
+  /**
+   * @brief removeFirstFrame - numbers of other frames decrease by one
+   */
+  void removeFirstFrame();
+  void clearFrames();
+  size_t getFramesCount() const;
+
+  /**
+   * @brief retrieve - the most similar frames to the query
+   * @param query_descriptions - descriptions of the query frame
+   * @param top_k - max count of returned frames
+   * @return frames numbers sorted by similarity descending
+   */
+  std::vector<size_t> retrieve(const cv::Mat &query_descriptions,
+                               size_t top_k) const;
+  /**
+   * @brief retrieve - the same, but frames are chosen only from candidates
+   */
+  std::vector<size_t> retrieve(const cv::Mat &query_descriptions,
+                               size_t top_k,
+                               const std::vector<size_t> &candidates) const;
+
+  void save(const std::string &filename) const;
+  void load(const std::string &filename);
+
+ private:
+  cv::Mat toFloat(const cv::Mat &descriptions) const;
+  std::vector<size_t> selectTop(const cv::Mat &similarities, size_t top_k,
+                                const std::vector<size_t> &candidates) const;
+  /**
+   * @brief getSignatures - signatures of the current frames, without rows
+   *                        of removed frames
+   */
+  cv::Mat getSignatures() const;
+
+  int words_count;
+  bool is_binary;
+
+  cv::Mat vocabulary; //words_count x dims, CV_32F
+  cv::Mat signatures; //frames x words_count*dims, CV_32F
+  int first_row; //rows before it belong to removed frames
+};
+
+}
+
+#endif // VLAD_RETRIEVER_H
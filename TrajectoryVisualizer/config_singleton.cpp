@@ -10,7 +10,8 @@ using namespace std;
 
 ConfigSingleton::ConfigSingleton()
   : path_to_map_csv(""), path_to_trj1_csv(""), path_to_trj2_csv(""),
-    gradient_m_per_px(4), quality_threshold(60)
+    gradient_m_per_px(4), quality_threshold(60), path_to_trace(""),
+    key_points_selection("response")
 {
 }
 
@@ -78,6 +79,18 @@ void ConfigSingleton::loadIni(string path_to_ini)
     //                   Common/gradient_meters_per_pixel");
   }
 
+  if (ini.contains("Common/path_to_trace"))
+  {
+    path_to_trace = ini.value("Common/path_to_trace").toString().
+                                                        toStdString();
+  }
+
+  if (ini.contains("Common/key_points_selection"))
+  {
+    key_points_selection = ini.value("Common/key_points_selection").toString().
+                                                               toStdString();
+  }
+
 }
 
 string ConfigSingleton::getPathToKeyPoints(int trj_num, string detector_name)
@@ -102,6 +115,13 @@ string ConfigSingleton::getPathToKDTree(int trj_num , string detector_name,
                              descriptor_name + "_KDTree.bin";
 }
 
+string ConfigSingleton::getPathToFeatures(int trj_num, string detector_name,
+                                                        string descriptor_name)
+{
+  string path_to_trj = trj_num == 0? path_to_trj1_csv: path_to_trj2_csv;
+  return getPathToFeatures(path_to_trj, detector_name, descriptor_name);
+}
+
 string ConfigSingleton::getPathToKeyPoints(string path_to_trj_csv,
                                            string detector_name)
 {
@@ -116,6 +136,23 @@ string ConfigSingleton::getPathToDescriptors(string path_to_trj_csv,
                                  descriptor_name + "_descriptors.xml";
 }
 
+string ConfigSingleton::getPathToFeatures(string path_to_trj_csv,
+                                          string detector_name,
+                                          string descriptor_name)
+{
+  return path_to_trj_csv + "_" + detector_name + "_" +
+                                 descriptor_name + "_features.bin";
+}
+
+string ConfigSingleton::getPathToMapBundle(string path_to_trj_csv,
+                                           string detector_name,
+                                           string descriptor_name,
+                                           string algorithm_name)
+{
+  return path_to_trj_csv + "_" + detector_name + "_" + descriptor_name + "_" +
+                                 algorithm_name + "_map.bin";
+}
+
 void ConfigSingleton::setPathToTrajectoryCsv(int trj_num, string path)
 {
   if (trj_num == 0)
@@ -28,12 +28,21 @@ class ConfigSingleton
                                    std::string descriptor_name);
   std::string getPathToKDTree(int trj_num, std::string detector_name,
                               std::string descriptor_name);
+  std::string getPathToFeatures(int trj_num, std::string detector_name,
+                                std::string descriptor_name);
 
   static std::string getPathToKeyPoints(std::string path_to_trj_csv,
                                         std::string detector_name);
   static std::string getPathToDescriptors(std::string path_to_trj_csv,
                                           std::string detector_name,
                                           std::string descriptor_name);
+  static std::string getPathToFeatures(std::string path_to_trj_csv,
+                                       std::string detector_name,
+                                       std::string descriptor_name);
+  static std::string getPathToMapBundle(std::string path_to_trj_csv,
+                                        std::string detector_name,
+                                        std::string descriptor_name,
+                                        std::string algorithm_name);
   /*static std::string getPathToKDTree(std::string path_to_trj_csv,
                                        std::string detector_name,
                                        std::string descriptor_name);*/
@@ -52,6 +61,11 @@ class ConfigSingleton
   double      getGradientMetersPerPixel()     { return gradient_m_per_px; }
 
   double      getQualityThreshold()           { return quality_threshold; }
+
+  //empty if restorers aren't traced
+  std::string getPathToTrace()                { return path_to_trace; }
+  //"response", "grid" or "anms" (see KeyPointsSelector)
+  std::string getKeyPointsSelection()         { return key_points_selection; }
   //exceptions
   class Exception: public std::runtime_error
   {
@@ -73,6 +87,9 @@ class ConfigSingleton
 
   double      gradient_m_per_px;
   double      quality_threshold;
+
+  std::string path_to_trace;
+  std::string key_points_selection;
 };
 
 #endif // CONFIG_SINGLETON_H
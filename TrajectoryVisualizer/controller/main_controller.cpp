@@ -27,6 +27,8 @@
 #include "algorithms/restorer_by_frame.h"
 #include "algorithms/local_restorer_by_frame.h"
 #include "algorithms/restorer_by_frame_blocks.h"
+#include "algorithms/hamming_matcher.h"
+#include "algorithms/multi_index_hashing_matcher.h"
 
 using namespace std;
 using namespace modelpkg;
@@ -54,48 +56,67 @@ void MainController::loadOrCalculateModel(int trj_num, int algorithm_idx,
   string detector_name = detectors_names[detector_idx].toStdString();
   string descriptor_name = descriptors_names[descriptor_idx].toStdString();
 
-  string path_to_kp_bin = cfg.getPathToKeyPoints(trj_num,
-                                                 detector_name);
-  string path_to_descr_bin = cfg.getPathToDescriptors(trj_num,
-                                             detector_name,
-                                             descriptor_name);
-
-  trj_loader.loadOrCalculateKeyPoints(trj, path_to_kp_bin,
-                                             detectors[detector_idx], true);
-  trj_loader.sortKeyPointsByResponse(trj, max_key_points_per_frame);
-
-  bool isAllKeyPoints = max_key_points_per_frame == 0;
-  trj_loader.loadOrCalculateDescriptions(trj, path_to_descr_bin,
-                                                descriptors[descriptor_idx],
-                                                isAllKeyPoints);
-  if (!isAllKeyPoints)
-  {//check for right descriptions, otherwise truncate to key_points size
-    for (size_t frame_num = 0; frame_num < trj.getFramesCount(); frame_num++)
-    {
-      const auto &kps = trj.getFrameAllKeyPoints(frame_num);
-      auto &descrs = trj.getFrameDescription(frame_num);
-      if (kps.size() != static_cast<unsigned>(descrs.rows))
-      {
-        cv::Rect roi;
-        descrs = descrs(cv::Rect(0, 0, descrs.cols, kps.size()));
-      }
-    }
+  string path_to_features_bin = cfg.getPathToFeatures(trj_num,
+                                                      detector_name,
+                                                      descriptor_name);
+
+  //descriptions are cached for all key points, then the best are selected
+  trj_loader.loadOrCalculateFeatures(trj, path_to_features_bin,
+                                     detectors_factories[detector_idx],
+                                     descriptors_factories[descriptor_idx],
+                                     true);
+  //the strongest key points are kept unless other selection is configured
+  KeyPointsSelector::Method selection = KeyPointsSelector::Method::RESPONSE;
+  if (cfg.getKeyPointsSelection() == "grid")
+  {
+    selection = KeyPointsSelector::Method::GRID;
+  }
+  else if (cfg.getKeyPointsSelection() == "anms")
+  {
+    selection = KeyPointsSelector::Method::ANMS;
+  }
+  else if (cfg.getKeyPointsSelection() != "response")
+  {
+    clog << "Unknown key points selection '" << cfg.getKeyPointsSelection()
+         << "', the strongest key points are kept" << endl;
   }
+  const KeyPointsSelector key_points_selector(selection);
+  trj_loader.selectKeyPoints(trj, max_key_points_per_frame,
+                             key_points_selector);
 
   //preparing trajectory recover
   RestorerPtr &restorer = trj_recovers[trj_num];
   if (algorithms_names[algorithm_idx] == "FullTrjCloud")
   {
+    //exact index for binary descriptors, KD-trees don't support them
+    cv::Ptr<cv::DescriptorMatcher> matcher;
+    if (descriptors[descriptor_idx]->defaultNorm() == cv::NORM_HAMMING)
+    {
+      matcher = cv::makePtr<MultiIndexHashingMatcher>();
+    }
+    else
+    {
+      matcher = cv::DescriptorMatcher::create("FlannBased");
+    }
     restorer = make_shared<RestorerByCloud>(detectors[detector_idx],
                                             descriptors[descriptor_idx],
-                                    cv::DescriptorMatcher::create("FlannBased"),
+                                            matcher,
                                             max_key_points_per_frame);
   }
   else if (algorithms_names[algorithm_idx] == "SingleFrame")
   {
+    cv::Ptr<cv::DescriptorMatcher> matcher;
+    if (descriptors[descriptor_idx]->defaultNorm() == cv::NORM_HAMMING)
+    {
+      matcher = cv::makePtr<HammingMatcher>();
+    }
+    else
+    {
+      matcher = cv::DescriptorMatcher::create("BruteForce");
+    }
     restorer = make_shared<RestorerByFrame>(detectors[detector_idx],
                                             descriptors[descriptor_idx],
-                                    cv::DescriptorMatcher::create("BruteForce"),
+                                            matcher,
                                             max_key_points_per_frame);
   }
   else if (algorithms_names[algorithm_idx] == "LocalSingle")
@@ -121,6 +142,24 @@ void MainController::loadOrCalculateModel(int trj_num, int algorithm_idx,
     return;
   }
 
+  restorer->setKeyPointsSelector(key_points_selector);
+
+  if (!cfg.getPathToTrace().empty())
+  {
+    try
+    {
+      if (!restorer_trace)
+      {
+        restorer_trace = RestorerTrace::create(cfg.getPathToTrace());
+      }
+      restorer->setTrace(restorer_trace);
+    }
+    catch (RestorerTrace::Exception &e)
+    {
+      clog << e.what() << endl;
+    }
+  }
+
   for (size_t frame_num = 0; frame_num < trj.getFramesCount(); frame_num++)
   {
       restorer->addFrame(trj.getFrame(frame_num).image_center,
@@ -130,6 +169,8 @@ void MainController::loadOrCalculateModel(int trj_num, int algorithm_idx,
                          trj.getFrame(frame_num).angle,
                          trj.getFrame(frame_num).m_per_px);
   }
+  //builds indices of frames before the first query instead of during it
+  restorer->train();
 
   //stupid way to find out if the model ready for manipulations
   if (model->getTrajectory(0).getFramesCount() != 0 &&
@@ -171,8 +212,8 @@ void MainController::calculateMatches()
           "\tScale: " << scale << endl;
 
   view->setGhostRecovery(utils::cv::toQPointF(pos),
-                         query_frame.image.cols*scale,
-                         query_frame.image.rows*scale,
+                         query_frame.image_size.width*scale,
+                         query_frame.image_size.height*scale,
                          angle);
 
   this->showMatches();
@@ -204,7 +245,7 @@ void MainController::recoverTrajectory(double score_thres)
         {
 //          Transformator::getParams(homography, frame.pos_m, frame.angle,
 //                                               frame.m_per_px);
-          cv::Point2f center(frame.image.cols/2., frame.image.rows/2.);
+          cv::Point2f center(frame.image_center);
           cv::Point2f rotate_pt(center.x+10, center.y);
 
           cv::Point2f bounded_center = Transformator::transform(center, homography);
@@ -278,8 +319,8 @@ void MainController::loadMainMap(string filename, double meters_per_pixel)
 {
     model->getMainMap() = modelpkg::Map(filename, 0, 0, 0, meters_per_pixel);
 
-    double center_x_m = model->getMainMap().image.cols / 2.0 * meters_per_pixel;
-    double center_y_m = model->getMainMap().image.rows / 2.0 * meters_per_pixel;
+    double center_x_m = model->getMainMap().image_size.width / 2.0 * meters_per_pixel;
+    double center_y_m = model->getMainMap().image_size.height / 2.0 * meters_per_pixel;
     model->getMainMap().pos_m = cv::Point2f(center_x_m, center_y_m);
 
     this->showMainMap();
@@ -296,13 +337,20 @@ void MainController::showTrajectory(int trj_num)
     vector<double>  meter_per_pixels;
     const vector<double> &qualities = model->getTrajectory(trj_num).getAllFramesQuality();
 
-    for (const auto &frame: model->getTrajectory(trj_num).getAllFrames())
+    const auto &frames = model->getTrajectory(trj_num).getAllFrames();
+    for (size_t frame_num = 0; frame_num < frames.size(); frame_num++)
     {
+        const auto &frame = frames[frame_num];
+        if (frame_num + 1 < frames.size())
+        {
+            frames[frame_num + 1].prefetchImage();
+        }
+
         QPointF center_px;
         center_px.setX( frame.pos_m.x / frame.m_per_px );
         center_px.setY( frame.pos_m.y / frame.m_per_px );
 
-        qpixs.push_back( utils::ASM::cvMatToQPixmap(frame.image) );
+        qpixs.push_back( utils::ASM::cvMatToQPixmap(frame.getImage()) );
         center_coords_px.push_back( center_px );
         angles.push_back( frame.angle );
         meter_per_pixels.push_back( frame.m_per_px );
@@ -319,7 +367,7 @@ void MainController::showTrajectory(int trj_num)
 
 void MainController::showMainMap()
 {
-    QPixmap qpix = utils::ASM::cvMatToQPixmap(model->getMainMap().image);
+    QPixmap qpix = utils::ASM::cvMatToQPixmap(model->getMainMap().getImage());
     view->setMainMap(qpix, model->getMainMap().m_per_px);
 }
 
@@ -475,12 +523,16 @@ void MainController::calculateFramesQuality()
         for (size_t frame_num = 0; frame_num < trj.getFramesCount(); frame_num++)
         {
             const auto &frame = trj.getFrame(frame_num);
+            if (frame_num + 1 < trj.getFramesCount())
+            {
+                trj.getFrame(frame_num + 1).prefetchImage();
+            }
 
             double scale = frame.m_per_px / ConfigSingleton::getInstance().getGradientMetersPerPixel();
-            cv::Size new_size(frame.image.size().width * scale, frame.image.size().height * scale);
+            cv::Size new_size(frame.image_size.width * scale, frame.image_size.height * scale);
 
             cv::Mat resized;
-            cv::resize(frame.image, resized, new_size);
+            cv::resize(frame.getImage(), resized, new_size);
 
             double quality = std::min( 1., utils::cv::gradientDensity(resized) / threshold );
 
@@ -499,15 +551,19 @@ void MainController::calculateFramesQuality(int trj_num)
   {
     const auto &frame = trj.getFrame(frame_num);
     double quality = 0;
+    if (frame_num + 1 < trj.getFramesCount())
+    {
+      trj.getFrame(frame_num + 1).prefetchImage();
+    }
 
     double scale = frame.m_per_px / ConfigSingleton::getInstance().getGradientMetersPerPixel();
     //if (scale == )
-    cv::Size new_size(frame.image.size().width * scale, frame.image.size().height * scale);
+    cv::Size new_size(frame.image_size.width * scale, frame.image_size.height * scale);
 
     if (new_size.area() != 0)
     {
       cv::Mat resized;
-      cv::resize(frame.image, resized, new_size);
+      cv::resize(frame.getImage(), resized, new_size);
 
       quality =  std::min( 1., utils::cv::gradientDensity(resized) / threshold );
     }
@@ -531,52 +587,65 @@ void MainController::initAlgorithms()
 void MainController::initDetectors()
 {
     detectors_names.push_back("SIFT");
-    detectors.push_back(cv::xfeatures2d::SIFT::create());
+    detectors_factories.push_back([]() { return cv::xfeatures2d::SIFT::create(); });
+    detectors.push_back(detectors_factories.back()());
 
     detectors_names.push_back("SURF");
-    detectors.push_back(cv::xfeatures2d::SURF::create());
+    detectors_factories.push_back([]() { return cv::xfeatures2d::SURF::create(); });
+    detectors.push_back(detectors_factories.back()());
 
     detectors_names.push_back("KAZE");
-    detectors.push_back(cv::KAZE::create());
+    detectors_factories.push_back([]() { return cv::KAZE::create(); });
+    detectors.push_back(detectors_factories.back()());
 
     detectors_names.push_back("AKAZE");
-    detectors.push_back(cv::AKAZE::create());
+    detectors_factories.push_back([]() { return cv::AKAZE::create(); });
+    detectors.push_back(detectors_factories.back()());
 
     detectors_names.push_back("BRISK");
-    detectors.push_back(cv::BRISK::create());
+    detectors_factories.push_back([]() { return cv::BRISK::create(); });
+    detectors.push_back(detectors_factories.back()());
 
     detectors_names.push_back("ORB");
-    detectors.push_back(cv::ORB::create());
+    detectors_factories.push_back([]() { return cv::ORB::create(); });
+    detectors.push_back(detectors_factories.back()());
 }
 
 void MainController::initDescriptors()
 {
     descriptors_names.push_back("SIFT");
-    descriptors.push_back(cv::xfeatures2d::SIFT::create());
+    descriptors_factories.push_back([]() { return cv::xfeatures2d::SIFT::create(); });
+    descriptors.push_back(descriptors_factories.back()());
     norm_types.push_back(cv::NORM_L2SQR);
 
     descriptors_names.push_back("SURF");
-    descriptors.push_back(cv::xfeatures2d::SURF::create());
+    descriptors_factories.push_back([]() { return cv::xfeatures2d::SURF::create(); });
+    descriptors.push_back(descriptors_factories.back()());
     norm_types.push_back(cv::NORM_L2SQR);
 
     descriptors_names.push_back("KAZE");
-    descriptors.push_back(cv::KAZE::create());
+    descriptors_factories.push_back([]() { return cv::KAZE::create(); });
+    descriptors.push_back(descriptors_factories.back()());
     norm_types.push_back(cv::NORM_L2SQR);
 
     descriptors_names.push_back("AKAZE");
-    descriptors.push_back(cv::AKAZE::create());
+    descriptors_factories.push_back([]() { return cv::AKAZE::create(); });
+    descriptors.push_back(descriptors_factories.back()());
     norm_types.push_back(cv::NORM_L2SQR);
 
     descriptors_names.push_back("BRISK");
-    descriptors.push_back(cv::BRISK::create());
+    descriptors_factories.push_back([]() { return cv::BRISK::create(); });
+    descriptors.push_back(descriptors_factories.back()());
     norm_types.push_back(cv::NORM_HAMMING);
 
     descriptors_names.push_back("ORB");
-    descriptors.push_back(cv::ORB::create());
+    descriptors_factories.push_back([]() { return cv::ORB::create(); });
+    descriptors.push_back(descriptors_factories.back()());
     norm_types.push_back(cv::NORM_HAMMING);
 
     descriptors_names.push_back("FREAK");
-    descriptors.push_back(cv::xfeatures2d::FREAK::create());
+    descriptors_factories.push_back([]() { return cv::xfeatures2d::FREAK::create(); });
+    descriptors.push_back(descriptors_factories.back()());
     norm_types.push_back(cv::NORM_HAMMING);
 }
 
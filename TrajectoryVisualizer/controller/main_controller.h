@@ -53,6 +53,10 @@ class MainController
 
   cv::Ptr<cv::Feature2D> getDetector(int i) { return detectors[i]; }
   cv::Ptr<cv::Feature2D> getDescriptor(int i) { return descriptors[i]; }
+  const algorithmspkg::TrajectoryLoader::Feature2DFactory&
+                  getDetectorFactory(int i) const { return detectors_factories[i]; }
+  const algorithmspkg::TrajectoryLoader::Feature2DFactory&
+                  getDescriptorFactory(int i) const { return descriptors_factories[i]; }
 
   //exceptions
   class Exception: public std::runtime_error
@@ -93,9 +97,11 @@ class MainController
 
   std::vector<QString> detectors_names;
   std::vector<cv::Ptr<cv::Feature2D>> detectors;
+  std::vector<algorithmspkg::TrajectoryLoader::Feature2DFactory> detectors_factories;
 
   std::vector<QString> descriptors_names;
   std::vector<cv::Ptr<cv::Feature2D>> descriptors;
+  std::vector<algorithmspkg::TrajectoryLoader::Feature2DFactory> descriptors_factories;
   std::vector<cv::NormTypes> norm_types;
 
   std::vector<std::vector<int>> trajectories_selected_frames;
@@ -109,6 +115,7 @@ class MainController
 
 
   std::vector<RestorerPtr> trj_recovers;
+  std::shared_ptr<algorithmspkg::RestorerTrace> restorer_trace;
   std::vector<int> frames_to_hide_by_score;
 };
 
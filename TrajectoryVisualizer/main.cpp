@@ -13,13 +13,34 @@
 #include "algorithms/trajectory_loader.h"
 #include "algorithms/image_info_gradient_estimator.h"
 #include "utils/geom_utils.h"
+#include "utils/image_cache.h"
 #include "algorithms/restorer_by_cloud.h"
+#include "algorithms/saveable_flann_matcher.h"
+#include "algorithms/flann_index_tuner.h"
+#include "algorithms/hamming_matcher.h"
+#include "algorithms/multi_index_hashing_matcher.h"
 
 using namespace std;
 using namespace algorithmspkg;
 
 int main(int argc, char *argv[])
 {
+    if (argc == 2 && string(argv[1]) == "--self-check")
+    {//compare exact binary matchers with brute force
+        try
+        {
+            HammingMatcher::selfCheck();
+            MultiIndexHashingMatcher::selfCheck();
+        }
+        catch (const runtime_error &er)
+        {
+            cout << "Self-check failed: " << er.what() << endl;
+            return 1;
+        }
+        cout << "Self-check passed, Hamming kernel: " << HammingMatcher::getKernelName() << endl;
+        return 0;
+    }
+
     //for commit
     QApplication a(argc, argv);
 
@@ -46,6 +67,8 @@ int main(int argc, char *argv[])
             cout << "       detector - SIFT SURF KAZE AKAZE BRISK" << endl;
             cout << "       descriptor - SIFT SURT KAZE AKAZE BRISK FREAK" << endl;
             cout << "       a - stands for append" << endl;
+            cout << "       TrajectoryVisualizer --self-check" << endl;
+            cout << "       compares matchers of binary descriptors with brute force" << endl;
             return 1;
         }
 
@@ -74,60 +97,121 @@ int main(int argc, char *argv[])
 
         main_model->setTrajectory(0, trj_loader.loadTrajectory(argv[1]));
         main_model->setTrajectory(1, trj_loader.loadTrajectory(argv[2]));
-        //load or calculate keypoints
+        //load or calculate key points and descriptions
         {
             auto &trj = main_model->getTrajectory(0);
+            string path_to_features_bin = ConfigSingleton::getPathToFeatures(argv[1], detectors_names[detector_idx].toStdString(),
+                                                                            descr_names[descriptor_idx].toStdString());
+            trj_loader.loadOrCalculateFeatures(trj, path_to_features_bin,
+                                               main_controller->getDetectorFactory(detector_idx),
+                                               main_controller->getDescriptorFactory(descriptor_idx),
+                                               true);
+        }
 
-            string path_to_kp_bin = ConfigSingleton::getPathToKeyPoints(argv[1], detectors_names[detector_idx].toStdString());
+        string path_to_bundle = ConfigSingleton::getPathToMapBundle(argv[1], detectors_names[detector_idx].toStdString(),
+                                                                    descr_names[descriptor_idx].toStdString(),
+                                                                    "FullTrjCloud");
+        //map and index parameters are rebuilt if features changed since they were saved
+        auto &train_trj = main_model->getTrajectory(0);
+        const MapBundle::Source features_source = MapBundle::makeSource(train_trj.getAllKeyPoints(),
+                                                                        train_trj.getAllDescriptions());
+        const string descriptions_id = to_string(features_source.frames_count) + "_" +
+                                       to_string(features_source.checksum);
 
+        //load or tune index parameters, they are stored alongside the map
+        FlannIndexTuner::IndexChoice index_choice;
+        bool is_index_tuned = false;
+        {
+            string path_to_index_choice = path_to_bundle + ".index.yml";
+            bool is_index_loaded = false;
             try
             {
-                trj_loader.loadKeyPoints(trj, path_to_kp_bin);
+                index_choice.load(path_to_index_choice);
+                is_index_loaded = index_choice.descriptions_id == descriptions_id;
+                if (!is_index_loaded)
+                {
+                    clog << "Index parameters are outdated: " << path_to_index_choice << endl;
+                }
             }
-            catch (TrajectoryLoader::NoFileExist &e)
+            catch (runtime_error &e)
             {
                 clog << e.what() << endl;
-                clog << "Calculating key points for train trajectory\n";
-                trj_loader.calculateKeyPoints(trj, detector);
+            }
 
-                clog << "Saving key points" << endl;
-                trj_loader.saveKeyPoints(trj, path_to_kp_bin);
+            if (!is_index_loaded)
+            {
+                clog << "Tuning index for train trajectory" << endl;
+                vector<cv::Mat> frames_descriptions;
+                for (size_t frame_num = 0; frame_num < train_trj.getFramesCount(); frame_num++)
+                {
+                    frames_descriptions.push_back(train_trj.getFrameDescription(frame_num));
+                }
+
+                try
+                {
+                    index_choice = FlannIndexTuner().tune(frames_descriptions, descriptor->defaultNorm());
+                    index_choice.descriptions_id = descriptions_id;
+                    is_index_tuned = true;
+                    clog << "Index recall " << index_choice.recall << ", "
+                         << index_choice.query_ms << " ms per query" << endl;
+                    clog << "Saving index parameters" << endl;
+                    index_choice.save(path_to_index_choice);
+                }
+                catch (FlannIndexTuner::Exception &e)
+                {
+                    clog << e.what() << endl;
+                    if (index_choice.recall == 0)
+                    {//not tuned
+                        index_choice = FlannIndexTuner::IndexChoice::defaults(descriptor->defaultNorm());
+                    }
+                }
             }
         }
-        //load or calculate descriptions
+
+        shared_ptr<FeatureBasedRestorer> restorer(new RestorerByCloud(detector, descriptor,
+                                                                      index_choice.makeMatcher()));
+        restorer->setFeature2DFactories(main_controller->getDetectorFactory(detector_idx),
+                                        main_controller->getDescriptorFactory(descriptor_idx));
+        bool is_map_loaded = false;
+        if (is_index_tuned)
+        {//saved index of the map was built with other parameters
+            clog << "Index parameters are changed, map is rebuilt" << endl;
+        }
+        else
         {
-            auto &trj = main_model->getTrajectory(0);
-            string path_to_dscr_xml = ConfigSingleton::getPathToDescriptors(argv[1], detectors_names[detector_idx].toStdString(),
-                                                                        descr_names[descriptor_idx].toStdString());
             try
             {
-                trj_loader.loadDescriptions(trj, path_to_dscr_xml);
+                if (MapBundle(path_to_bundle).getSource() != features_source)
+                {
+                    clog << "Map bundle is outdated: " << path_to_bundle << endl;
+                }
+                else
+                {
+                    restorer->load(path_to_bundle);
+                    is_map_loaded = true;
+                }
             }
-            catch (TrajectoryLoader::NoFileExist &e)
+            catch (runtime_error &e)
             {
                 clog << e.what() << endl;
-                clog << "Calculating descriptors for train trajectory\n";
-                trj_loader.calculateDescriptions(trj, descriptor);
-
-                clog << "Saving descriptors" << endl;
-                trj_loader.saveDescriptions(trj, path_to_dscr_xml);
             }
         }
 
-        shared_ptr<FeatureBasedRestorer> restorer(
-                              new RestorerByCloud(detector, descriptor));
-
+        if (!is_map_loaded)
         {//prepare recover
-            auto &trj = main_model->getTrajectory(0);
-            for (size_t frame_num = 0; frame_num < trj.getFramesCount(); frame_num++)
+            for (size_t frame_num = 0; frame_num < train_trj.getFramesCount(); frame_num++)
             {
-                restorer->addFrame(trj.getFrame(frame_num).image_center,
-                                 trj.getFrameAllKeyPoints(frame_num),
-                                 trj.getFrameDescription(frame_num),
-                                 trj.getFrame(frame_num).pos_m,
-                                 -trj.getFrame(frame_num).angle,
-                                 trj.getFrame(frame_num).m_per_px);
+                restorer->addFrame(train_trj.getFrame(frame_num).image_center,
+                                   train_trj.getFrameAllKeyPoints(frame_num),
+                                   train_trj.getFrameDescription(frame_num),
+                                   train_trj.getFrame(frame_num).pos_m,
+                                   -train_trj.getFrame(frame_num).angle,
+                                   train_trj.getFrame(frame_num).m_per_px);
             }
+            restorer->setMapSource(features_source);
+
+            clog << "Saving map bundle" << endl;
+            restorer->save(path_to_bundle);
         }
 
         ofstream out;
@@ -149,27 +233,53 @@ int main(int argc, char *argv[])
         //start evaluating
         size_t skipped = 0;
         auto &que_trj = main_model->getTrajectory(1);
-        for (size_t frame_num = 0; frame_num < que_trj.getFramesCount(); frame_num++)
-        {
-            const auto& frame = que_trj.getFrame(frame_num);
+        //frames are queried in chunks which fit in the image cache, so
+        //images of the whole trajectory aren't kept in memory at once
+        const size_t cache_capacity = utils::ImageCache::getInstance().getCapacity();
 
-            cv::Point2f pos;
-            double angle;
-            double scale;
-            restorer->recoverLocation(frame.image,
-                                      pos, angle, scale);
+        restorer->train();
+        size_t chunk_begin = 0;
+        while (chunk_begin < que_trj.getFramesCount())
+        {
+            size_t chunk_end = chunk_begin;
+            size_t chunk_size = 0;
+            while (chunk_end < que_trj.getFramesCount())
+            {
+                chunk_size += que_trj.getFrame(chunk_end).image_size.area();
+                if (chunk_size > cache_capacity && chunk_end > chunk_begin)
+                {
+                    break;
+                }
+                que_trj.getFrame(chunk_end).prefetchImage();
+                chunk_end++;
+            }
 
-            double quality = ImageInfoGradientEstimator(frame.m_per_px / 4.).estimate(frame.image);
-            if (!restorer->getLastHomography().empty())
+            vector<cv::Mat> que_images;
+            for (size_t frame_num = chunk_begin; frame_num < chunk_end; frame_num++)
             {
-                out << quality << ',' <<
-                       cv::norm(pos - frame.pos_m) << ',' <<
-                       fabs(angle - frame.angle) << endl;
+                que_images.push_back(que_trj.getFrame(frame_num).getImage());
             }
-            else
+
+            auto results = restorer->recoverLocations(que_images);
+            for (size_t frame_num = chunk_begin; frame_num < chunk_end; frame_num++)
             {
-                skipped++;
+                const auto& frame = que_trj.getFrame(frame_num);
+                const auto& result = results[frame_num - chunk_begin];
+
+                double quality = ImageInfoGradientEstimator(frame.m_per_px / 4.).estimate(que_images[frame_num - chunk_begin]);
+                if (!result.homography.empty())
+                {
+                    out << quality << ',' <<
+                           cv::norm(result.pos - frame.pos_m) << ',' <<
+                           fabs(result.angle - frame.angle) << endl;
+                }
+                else
+                {
+                    skipped++;
+                }
             }
+
+            chunk_begin = chunk_end;
         }
         cout << "Skipped: " << skipped << endl;
 
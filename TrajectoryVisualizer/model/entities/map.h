@@ -5,7 +5,8 @@
 #include <vector>
 
 #include <opencv2/core.hpp>
-#include <opencv2/imgcodecs.hpp>
+
+#include "utils/image_cache.h"
 
 namespace modelpkg
 {
@@ -13,14 +14,43 @@ namespace modelpkg
     {
         Map() {}
 
+        /**
+         * @brief Map - image isn't decoded, only its size is read if possible
+         */
         Map(std::string filename, double x_m, double y_m, double angle, double m_per_px)
-            : image( cv::imread(filename, cv::IMREAD_GRAYSCALE) ), pos_m(x_m, y_m),
+            : filename(filename), pos_m(x_m, y_m),
               angle(angle), m_per_px(m_per_px)
         {
-          image_center = cv::Point2f(image.cols/2., image.rows/2.);
+          image_size = utils::ImageCache::readImageSize(filename);
+          if (image_size.area() == 0)
+          {//size of unknown format is known only after decoding
+            image_size = getImage().size();
+          }
+          image_center = cv::Point2f(image_size.width/2., image_size.height/2.);
+        }
+
+        /**
+         * @brief getImage - grayscale image decoded on demand, shared with
+         *                   the cache of images (don't modify it)
+         */
+        cv::Mat getImage() const
+        {
+          return filename.empty()? cv::Mat():
+                                   utils::ImageCache::getInstance().get(filename);
+        }
+        /**
+         * @brief prefetchImage - hint that image will be needed soon
+         */
+        void prefetchImage() const
+        {
+          if (!filename.empty())
+          {
+            utils::ImageCache::getInstance().prefetch(filename);
+          }
         }
 
-        cv::Mat image;
+        std::string filename;
+        cv::Size image_size;
         cv::Point2f image_center;
         cv::Point2f pos_m; //in meters
         double angle;
@@ -1,6 +1,7 @@
 #ifndef TRAJECTORY_H
 #define TRAJECTORY_H
 
+#include <memory>
 #include <vector>
 
 #include <opencv2/features2d.hpp>
@@ -18,6 +19,11 @@ struct Trajectory
   void setFrameKeyPoints(int frame_num, const std::vector<cv::KeyPoint> &frame_key_points);
   void setFrameDescription(int frame_num, const cv::Mat &description);
   void setFrameQuality(int frame_num, double quality);
+  /**
+   * @brief setFeaturesStorage - keeps alive memory which descriptions refer
+   *                             to (e.g. mapped file of features)
+   */
+  void setFeaturesStorage(std::shared_ptr<const void> storage) { features_storage = storage; }
 
   size_t getFramesCount() const  { return frames.size(); }
 
@@ -48,6 +54,8 @@ struct Trajectory
   std::vector<cv::Mat> descriptions; //for each frame of key points
 
   std::vector<double> frames_quality;
+
+  std::shared_ptr<const void> features_storage;
 };
 
 }
@@ -0,0 +1,134 @@
+#ifndef CONVEX_POLYGON_H
+#define CONVEX_POLYGON_H
+
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace utils
+{
+
+namespace cv
+{
+
+  /**
+   * @brief MAX_CLIPPED_POLYGON_SIZE - intersection of convex n-gon and
+   *        convex m-gon has at most n + m vertices, bigger aren't clipped
+   */
+  const size_t MAX_CLIPPED_POLYGON_SIZE = 32;
+
+  /**
+   * @brief polygonSignedArea - shoelace formula, positive if vertices are
+   *                            in order from x to y
+   */
+  inline double polygonSignedArea(const ::cv::Point2f *points, size_t count)
+  {
+    double area = 0;
+    for (size_t i = 0, j = count - 1; i < count; j = i++)
+    {
+      area += double(points[j].x) * points[i].y -
+              double(points[i].x) * points[j].y;
+    }
+
+    return area / 2.;
+  }
+
+  inline double polygonArea(const std::vector<::cv::Point2f> &polygon)
+  {
+    if (polygon.size() < 3)
+    {
+      return 0;
+    }
+
+    return std::fabs(polygonSignedArea(polygon.data(), polygon.size()));
+  }
+
+  /**
+   * @brief convexIntersectionArea - area of intersection of convex polygons
+   *        by Sutherland-Hodgman clipping, doesn't allocate memory.
+   *        Vertices may be in any order, polygons must be convex.
+   * @return 0 if polygons don't intersect (or are too big, see
+   *         MAX_CLIPPED_POLYGON_SIZE)
+   */
+  inline double convexIntersectionArea(const ::cv::Point2f *subject,
+                                       size_t subject_size,
+                                       const ::cv::Point2f *clip,
+                                       size_t clip_size)
+  {
+    if (subject_size < 3 || clip_size < 3 ||
+        subject_size + clip_size > MAX_CLIPPED_POLYGON_SIZE)
+    {
+      return 0;
+    }
+
+    //inside is on the left of edges of counter-clockwise clip polygon
+    const double orientation = polygonSignedArea(clip, clip_size) > 0? 1: -1;
+
+    ::cv::Point2f buffers[2][MAX_CLIPPED_POLYGON_SIZE];
+    size_t count = subject_size;
+    for (size_t i = 0; i < subject_size; i++)
+    {
+      buffers[0][i] = subject[i];
+    }
+
+    int current = 0;
+    for (size_t edge = 0; edge < clip_size && count != 0; edge++)
+    {
+      const ::cv::Point2f &a = clip[edge];
+      const ::cv::Point2f &b = clip[(edge + 1) % clip_size];
+      const ::cv::Point2f *input = buffers[current];
+      ::cv::Point2f *output = buffers[1 - current];
+
+      auto side = [&a, &b, orientation](const ::cv::Point2f &pt) -> double
+      {
+        return orientation * ((double(b.x) - a.x) * (double(pt.y) - a.y) -
+                              (double(b.y) - a.y) * (double(pt.x) - a.x));
+      };
+
+      size_t output_count = 0;
+      const ::cv::Point2f *prev = &input[count - 1];
+      double prev_side = side(*prev);
+      for (size_t i = 0; i < count; i++)
+      {
+        const ::cv::Point2f &cur = input[i];
+        const double cur_side = side(cur);
+        if ((cur_side >= 0) != (prev_side >= 0))
+        {//edge of subject crosses clipping line
+          const double t = prev_side / (prev_side - cur_side);
+          output[output_count++] = ::cv::Point2f(prev->x + t*(cur.x - prev->x),
+                                                 prev->y + t*(cur.y - prev->y));
+        }
+        if (cur_side >= 0)
+        {
+          output[output_count++] = cur;
+        }
+        prev = &cur;
+        prev_side = cur_side;
+      }
+
+      count = output_count;
+      current = 1 - current;
+    }
+
+    if (count < 3)
+    {
+      return 0;
+    }
+
+    return std::fabs(polygonSignedArea(buffers[current], count));
+  }
+
+  inline double convexIntersectionArea(
+                                   const std::vector<::cv::Point2f> &subject,
+                                   const std::vector<::cv::Point2f> &clip)
+  {
+    return convexIntersectionArea(subject.data(), subject.size(),
+                                  clip.data(), clip.size());
+  }
+
+}
+
+}
+
+#endif // CONVEX_POLYGON_H
@@ -0,0 +1,33 @@
+#include "feature_extraction.h"
+
+#include <typeinfo>
+
+bool utils::cv::isSameAlgorithm(const ::cv::Ptr<::cv::Feature2D> &detector,
+                                const ::cv::Ptr<::cv::Feature2D> &descriptor)
+{
+  if (!detector || !descriptor)
+  {
+    return false;
+  }
+
+  return detector.get() == descriptor.get() ||
+         typeid(*detector) == typeid(*descriptor);
+}
+
+void utils::cv::detectAndCompute(const ::cv::Ptr<::cv::Feature2D> &detector,
+                                 const ::cv::Ptr<::cv::Feature2D> &descriptor,
+                                 const ::cv::Mat &image,
+                                 std::vector<::cv::KeyPoint> &key_points,
+                                 ::cv::Mat &descriptions)
+{
+  key_points.clear();
+  if (isSameAlgorithm(detector, descriptor))
+  {
+    descriptor->detectAndCompute(image, ::cv::noArray(), key_points,
+                                 descriptions);
+    return;
+  }
+
+  detector->detect(image, key_points);
+  descriptor->compute(image, key_points, descriptions);
+}
@@ -0,0 +1,36 @@
+#ifndef FEATURE_EXTRACTION_H
+#define FEATURE_EXTRACTION_H
+
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+namespace utils
+{
+
+namespace cv
+{
+
+  /**
+   * @brief isSameAlgorithm - detector and descriptor are the same instance
+   * or instances of one class (they are assumed to be configured alike), so
+   * one detectAndCompute builds scale space once instead of twice
+   */
+  bool isSameAlgorithm(const ::cv::Ptr<::cv::Feature2D> &detector,
+                       const ::cv::Ptr<::cv::Feature2D> &descriptor);
+
+  /**
+   * @brief detectAndCompute - fused detectAndCompute of descriptor if
+   *                           isSameAlgorithm, otherwise detect and compute
+   */
+  void detectAndCompute(const ::cv::Ptr<::cv::Feature2D> &detector,
+                        const ::cv::Ptr<::cv::Feature2D> &descriptor,
+                        const ::cv::Mat &image,
+                        std::vector<::cv::KeyPoint> &key_points,
+                        ::cv::Mat &descriptions);
+
+}
+
+}
+
+#endif // FEATURE_EXTRACTION_H
@@ -0,0 +1,294 @@
+#include "image_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace utils;
+
+const size_t ImageCache::DEFAULT_CAPACITY;
+
+ImageCache::ImageCache(size_t capacity, int flags)
+  : flags(flags), capacity(capacity), size(0), is_stopped(false)
+{
+}
+
+ImageCache::~ImageCache()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_stopped = true;
+  }
+  for (Prefetcher &prefetcher: prefetchers)
+  {
+    prefetcher.thread.join();
+  }
+}
+
+ImageCache &ImageCache::getInstance()
+{
+  static ImageCache instance;
+  return instance;
+}
+
+cv::Mat ImageCache::get(const std::string &filename)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  auto found = entries.find(filename);
+  if (found != entries.end())
+  {
+    lru.splice(lru.begin(), lru, found->second.lru_pos);
+    std::shared_future<cv::Mat> image = found->second.image;
+    lock.unlock();
+    return image.get();
+  }
+
+  //concurrent requests wait for this decoding
+  std::promise<cv::Mat> decoded;
+  Entry &entry = entries[filename];
+  entry.image = decoded.get_future().share();
+  entry.bytes = 0;
+  lru.push_front(filename);
+  entry.lru_pos = lru.begin();
+  lock.unlock();
+
+  cv::Mat image;
+  try
+  {
+    image = cv::imread(filename, flags);
+  }
+  catch (...)
+  {
+    decoded.set_exception(std::current_exception());
+    lock.lock();
+    found = entries.find(filename);
+    if (found != entries.end() && found->second.bytes == 0)
+    {
+      lru.erase(found->second.lru_pos);
+      entries.erase(found);
+    }
+    throw;
+  }
+  decoded.set_value(image);
+
+  lock.lock();
+  //entry may be evicted or replaced while image was decoded
+  found = entries.find(filename);
+  if (found != entries.end() && found->second.bytes == 0)
+  {
+    found->second.bytes = std::max<size_t>(image.total() * image.elemSize(),
+                                           1);
+    size += found->second.bytes;
+  }
+  evict();
+
+  return image;
+}
+
+void ImageCache::prefetch(const std::string &filename)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (is_stopped || entries.count(filename))
+  {
+    return;
+  }
+
+  prefetch_queue.push_back(filename);
+
+  //threads exit when queue is empty, so idle cache has no threads
+  for (auto it = prefetchers.begin(); it != prefetchers.end();)
+  {
+    if (it->is_finished)
+    {
+      it->thread.join();
+      it = prefetchers.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  const size_t max_prefetchers_count =
+                        std::max(std::thread::hardware_concurrency(), 1u);
+  if (prefetchers.size() < std::min(max_prefetchers_count,
+                                     prefetch_queue.size()))
+  {
+    prefetchers.emplace_back();
+    Prefetcher &prefetcher = prefetchers.back();
+    prefetcher.is_finished = false;
+    prefetcher.thread = std::thread(&ImageCache::prefetchLoop, this,
+                                    &prefetcher);
+  }
+}
+
+void ImageCache::setCapacity(size_t capacity)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->capacity = capacity;
+  evict();
+}
+
+size_t ImageCache::getCapacity() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return capacity;
+}
+
+size_t ImageCache::getSize() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return size;
+}
+
+void ImageCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  lru.clear();
+  prefetch_queue.clear();
+  size = 0;
+}
+
+void ImageCache::evict()
+{
+  //images being decoded have no size yet, they are evicted as well
+  while (size > capacity && lru.size() > 1)
+  {
+    auto found = entries.find(lru.back());
+    size -= found->second.bytes;
+    entries.erase(found);
+    lru.pop_back();
+  }
+}
+
+void ImageCache::prefetchLoop(Prefetcher *prefetcher)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!is_stopped && !prefetch_queue.empty())
+  {
+    std::string filename = prefetch_queue.front();
+    prefetch_queue.pop_front();
+    lock.unlock();
+    try
+    {
+      get(filename);
+    }
+    catch (...)
+    {
+      //it's only a hint, the error is repeated by the real request
+    }
+    lock.lock();
+  }
+
+  prefetcher->is_finished = true;
+}
+
+namespace
+{
+
+uint32_t readBigEndian(const unsigned char *bytes, int count)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < count; i++)
+  {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+uint32_t readLittleEndian(const unsigned char *bytes, int count)
+{
+  uint32_t value = 0;
+  for (int i = count - 1; i >= 0; i--)
+  {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+cv::Size readJpegSize(std::ifstream &in)
+{
+  unsigned char marker[4];
+  while (in.read(reinterpret_cast<char*>(marker), 4) && marker[0] == 0xFF)
+  {
+    const unsigned char type = marker[1];
+    const uint32_t length = readBigEndian(marker + 2, 2);
+    if (length < 2)
+    {
+      break;
+    }
+
+    //decoder applies Exif orientation, header size may be transposed then
+    if (type == 0xE1)
+    {
+      char signature[4];
+      if (length >= 6 && in.read(signature, 4) &&
+          std::memcmp(signature, "Exif", 4) == 0)
+      {
+        break;
+      }
+      in.seekg(length - 2 - 4, std::ios::cur);
+      continue;
+    }
+
+    const bool is_frame = type >= 0xC0 && type <= 0xCF && type != 0xC4 &&
+                          type != 0xC8 && type != 0xCC;
+    if (is_frame)
+    {
+      unsigned char header[5];
+      if (!in.read(reinterpret_cast<char*>(header), 5))
+      {
+        break;
+      }
+      return cv::Size(readBigEndian(header + 3, 2),
+                      readBigEndian(header + 1, 2));
+    }
+
+    in.seekg(length - 2, std::ios::cur);
+  }
+
+  return cv::Size();
+}
+
+}
+
+cv::Size ImageCache::readImageSize(const std::string &filename)
+{
+  std::ifstream in(filename, std::ios::binary);
+  unsigned char header[26];
+  if (!in.read(reinterpret_cast<char*>(header), 2))
+  {
+    return cv::Size();
+  }
+
+  if (header[0] == 0xFF && header[1] == 0xD8)
+  {
+    return readJpegSize(in);
+  }
+
+  if (!in.read(reinterpret_cast<char*>(header) + 2, sizeof(header) - 2))
+  {
+    return cv::Size();
+  }
+
+  const unsigned char png_signature[] = {0x89, 'P', 'N', 'G',
+                                         '\r', '\n', 0x1A, '\n'};
+  if (std::memcmp(header, png_signature, 8) == 0 &&
+      std::memcmp(header + 12, "IHDR", 4) == 0)
+  {
+    return cv::Size(readBigEndian(header + 16, 4),
+                    readBigEndian(header + 20, 4));
+  }
+
+  if (header[0] == 'B' && header[1] == 'M')
+  {
+    //height is negative for top-down bitmaps
+    int32_t height = static_cast<int32_t>(readLittleEndian(header + 22, 4));
+    return cv::Size(readLittleEndian(header + 18, 4), std::abs(height));
+  }
+
+  return cv::Size();
+}
@@ -0,0 +1,111 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <deque>
+#include <future>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+namespace utils
+{
+
+/**
+ * @brief The ImageCache class - decoded images by filenames with LRU
+ * eviction when their size exceeds the capacity. Images are decoded on
+ * demand, each image is decoded once even if it's requested concurrently.
+ * Returned images share data with the cache and mustn't be modified.
+ * Thread-safe.
+ */
+class ImageCache
+{
+ public:
+  ImageCache(ImageCache const&) = delete;
+  void operator=(ImageCache const&) = delete;
+
+  /**
+   * @param capacity - max size of decoded images in bytes, the last
+   *                   requested image is kept anyway
+   * @param flags - flags of cv::imread
+   */
+  explicit ImageCache(size_t capacity = DEFAULT_CAPACITY,
+                      int flags = ::cv::IMREAD_GRAYSCALE);
+  ~ImageCache();
+
+  /**
+   * @brief getInstance - grayscale images of frames and maps
+   */
+  static ImageCache& getInstance();
+
+  /**
+   * @brief get - decodes image if it isn't cached
+   * @return empty if image can't be decoded
+   */
+  ::cv::Mat get(const std::string &filename);
+
+  /**
+   * @brief prefetch - hint that image will be requested soon (e.g. the next
+   *                   frame of sequential access), it's decoded in background.
+   *                   Hinted images are decoded in parallel in order of hints
+   *                   by threads which exit when all hints are decoded
+   */
+  void prefetch(const std::string &filename);
+
+  void setCapacity(size_t capacity);
+  size_t getCapacity() const;
+  /**
+   * @brief getSize - size of cached images in bytes
+   */
+  size_t getSize() const;
+  void clear();
+
+  /**
+   * @brief readImageSize - reads only header of PNG, BMP or JPEG (without
+   *                        Exif orientation) file
+   * @return empty if size is unknown without decoding
+   */
+  static ::cv::Size readImageSize(const std::string &filename);
+
+  static const size_t DEFAULT_CAPACITY = 512 << 20;
+
+ private:
+  struct Entry
+  {
+    std::shared_future<::cv::Mat> image;
+    size_t bytes; //0 while image is decoded
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  /**
+   * @brief The Prefetcher struct - thread decoding hinted images
+   */
+  struct Prefetcher
+  {
+    std::thread thread;
+    bool is_finished; //thread can be joined
+  };
+
+  void evict();
+  void prefetchLoop(Prefetcher *prefetcher);
+
+  const int flags;
+  size_t capacity;
+  size_t size;
+
+  mutable std::mutex mutex;
+  std::unordered_map<std::string, Entry> entries;
+  std::list<std::string> lru; //front is the last requested
+
+  std::deque<std::string> prefetch_queue;
+  std::list<Prefetcher> prefetchers; //started by prefetch while queue is long
+  bool is_stopped;
+};
+
+}
+
+#endif // IMAGE_CACHE_H
@@ -0,0 +1,80 @@
+#include "mapped_file.h"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_USE_MMAP
+#endif
+
+using namespace utils;
+
+#ifdef MAPPED_FILE_USE_MMAP
+
+MappedFile::MappedFile(const std::string &filename)
+  : begin(nullptr), length(0)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw NoFileExist(filename);
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0)
+  {
+    close(fd);
+    throw NoFileExist(filename);
+  }
+
+  length = info.st_size;
+  if (length != 0)
+  {
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+      close(fd);
+      throw std::runtime_error("MappedFile: Cannot map file: " + filename);
+    }
+    begin = static_cast<const char*>(mapped);
+  }
+
+  //mapping stays valid after closing of descriptor
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (begin != nullptr)
+  {
+    munmap(const_cast<char*>(begin), length);
+  }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &filename)
+  : begin(nullptr), length(0)
+{
+  std::ifstream in(filename, std::ios::binary | std::ios::ate);
+  if (!in)
+  {
+    throw NoFileExist(filename);
+  }
+
+  length = in.tellg();
+  buffer.resize(length);
+  in.seekg(0);
+  in.read(buffer.data(), length);
+
+  begin = buffer.data();
+}
+
+MappedFile::~MappedFile()
+{
+}
+
+#endif
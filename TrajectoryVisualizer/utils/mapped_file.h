@@ -0,0 +1,44 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+namespace utils
+{
+
+/**
+ * @brief The MappedFile class - read only memory mapping of the whole file.
+ * Falls back to reading into memory where mmap isn't available.
+ */
+class MappedFile
+{
+ public:
+  explicit MappedFile(const std::string &filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return begin; }
+  size_t      size() const { return length; }
+
+  class NoFileExist: public std::runtime_error
+  {
+  public:
+    NoFileExist(const std::string &filename):
+      std::runtime_error("MappedFile: Cannot open file: " + filename)
+    {}
+  };
+
+ private:
+  const char *begin;
+  size_t length;
+
+  std::vector<char> buffer; //used only without mmap
+};
+
+}
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,37 @@
+#include "parallel_for.h"
+
+namespace
+{
+
+class ParallelForBody : public cv::ParallelLoopBody
+{
+ public:
+  explicit ParallelForBody(const std::function<void(size_t)> &body)
+    : body(body)
+  {
+  }
+
+  void operator()(const cv::Range &range) const override
+  {
+    for (int i = range.start; i < range.end; i++)
+    {
+      body(i);
+    }
+  }
+
+ private:
+  const std::function<void(size_t)> &body;
+};
+
+}
+
+void utils::cv::parallelFor(size_t count,
+                            const std::function<void(size_t)> &body)
+{
+  if (count == 0)
+  {
+    return;
+  }
+
+  ::cv::parallel_for_(::cv::Range(0, count), ParallelForBody(body));
+}
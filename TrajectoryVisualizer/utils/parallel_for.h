@@ -0,0 +1,26 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <functional>
+
+#include <opencv2/core.hpp>
+
+namespace utils
+{
+
+namespace cv
+{
+
+  /**
+   * @brief parallelFor - calls body for each index of [0, count) in OpenCV
+   *                      thread pool (sequentially if OpenCV has no threads)
+   * @param count
+   * @param body - must be thread-safe for different indices
+   */
+  void parallelFor(size_t count, const std::function<void(size_t)> &body);
+
+}
+
+}
+
+#endif // PARALLEL_FOR_H